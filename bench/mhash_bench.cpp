@@ -0,0 +1,630 @@
+/*
+ * Microbenchmark of the mhash headers against std::unordered_map and a plain open-addressing
+ * table. It measures, per key count: build time and retries (including the one-key-at-a-time
+ * rebuilds that columns perform), the distribution of num_hashes over random key sets, memory
+ * per key, and lookup latency and throughput for mixes of hits and misses and for short,
+ * medium and long keys, and one-at-a-time lookups against the batched, prefetching ones.
+ * Hardware counters come from perf_event_open where it is permitted.
+ *
+ * Keys are owned by one array and referenced by all tables (as column dimension names are), so
+ * memory per key counts the tables only. Build with `make bench` and run
+ * `build/mhash_bench [lookups]`.
+ */
+#include "../src/mhash/mhash.h"
+#include "../src/mhash/mhash_str.h"
+#include "../src/mhash/mhash_compact.h"
+#include "../src/mhash/mhash_cpp.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#ifdef __linux__
+  #include <linux/perf_event.h>
+  #include <sys/ioctl.h>
+  #include <sys/syscall.h>
+  #include <unistd.h>
+  #include <cerrno>
+#endif
+
+static const uint64_t MISS = UINT64_MAX;
+static volatile uint64_t opaque_zero = 0;   // ties each lookup of the latency loop to the previous one
+static volatile uint64_t sink = 0;
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static uint64_t splitmix64(uint64_t *state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// --- keys
+
+struct LengthMix {
+    const char *name;
+    size_t min_len;
+    size_t max_len;
+};
+
+static const LengthMix length_mixes[] = {
+    {"short 1-8", 1, 8},        // e.g., categories such as gender or region
+    {"medium 8-24", 8, 24},     // e.g., identifiers
+    {"long 32-128", 32, 128},   // e.g., free text
+};
+
+// distinct random keys, followed by extra ones that serve as misses
+static std::vector<std::string> make_keys(size_t count, const LengthMix &mix, uint64_t *seed) {
+    static const char alphabet[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_- ";
+    std::vector<std::string> keys;
+    std::unordered_set<std::string> seen;
+    keys.reserve(count);
+    while (keys.size() < count) {
+        size_t len = mix.min_len + splitmix64(seed) % (mix.max_len - mix.min_len + 1);
+        std::string key(len, ' ');
+        for (char &c : key)
+            c = alphabet[splitmix64(seed) % (sizeof(alphabet) - 1)];
+        if (seen.insert(key).second)
+            keys.push_back(std::move(key));
+    }
+    return keys;
+}
+
+static std::vector<const char*> pointers(const std::vector<std::string> &keys, size_t count) {
+    std::vector<const char*> ptrs(count);
+    for (size_t i = 0; i < count; ++i)
+        ptrs[i] = keys[i].c_str();
+    return ptrs;
+}
+
+// --- tables under test
+
+// mhash_compact as columns use it (mhash_compact_build with word hashes)
+struct CompactTable {
+    MHashCompact map{};
+    const char *const *keys = nullptr;
+    bool build(const std::vector<const char*> &ptrs) {
+        keys = ptrs.data();
+        return mhash_compact_build(&map, const_cast<const char**>(ptrs.data()), ptrs.size(), mhash_strn_word_multi) == MHASH_OK;
+    }
+    uint64_t find(const char *s, size_t len) const { return mhash_compact_find(&map, s, len, keys); }
+    size_t bytes() const { return sizeof(uint32_t) * map.table_size; }
+    ~CompactTable() { mhash_compact_free(&map); }
+};
+
+// the generic C mhash with prefix hashes, grown like MHashMap::rebuild in mhash_cpp.h
+struct GenericTable {
+    MHash map{};
+    std::vector<MHASH_INDEX_UINT> table;
+    const char *const *keys = nullptr;
+    bool build(const std::vector<const char*> &ptrs) {
+        keys = ptrs.data();
+        size_t n = ptrs.size();
+        size_t table_size = n * 3;
+        size_t max_hashes = 2;
+        for (size_t bits = n; bits; bits >>= 1)
+            ++max_hashes;
+        table.assign(table_size, MHASH_EMPTY_SLOT);
+        for (;;) {
+            bool success = mhash_init(&map, table.data(), table_size, (const void**)ptrs.data(), n, mhash_str_prefix) == MHASH_OK;
+            if (success && map.num_hashes < max_hashes)
+                return true;
+            table_size = table_size < 16 ? table_size + 1 : table_size + table_size / 5 + 1;
+            if (table_size > 65536 || table_size > 128 * n)
+                return success;
+            table.assign(table_size, MHASH_EMPTY_SLOT);
+        }
+    }
+    uint64_t find(const char *s, size_t) const {
+        MHASH_INDEX_UINT entry = mhash_entry(&map, s);
+        return entry != MHASH_EMPTY_SLOT && !strcmp(keys[entry], s) ? entry : MISS;
+    }
+    size_t bytes() const { return sizeof(MHASH_INDEX_UINT) * table.size(); }
+};
+
+// counts the bytes that std::unordered_map allocates for its buckets and nodes
+static size_t allocated_bytes = 0;
+template<typename T>
+struct CountingAllocator {
+    using value_type = T;
+    CountingAllocator() = default;
+    template<typename U> CountingAllocator(const CountingAllocator<U>&) {}
+    T *allocate(size_t n) {
+        allocated_bytes += n * sizeof(T);
+        return std::allocator<T>().allocate(n);
+    }
+    void deallocate(T *p, size_t n) {
+        allocated_bytes -= n * sizeof(T);
+        std::allocator<T>().deallocate(p, n);
+    }
+    template<typename U> bool operator==(const CountingAllocator<U>&) const { return true; }
+    template<typename U> bool operator!=(const CountingAllocator<U>&) const { return false; }
+};
+
+struct StdTable {
+    using Map = std::unordered_map<std::string_view, uint32_t, std::hash<std::string_view>, std::equal_to<std::string_view>,
+                                   CountingAllocator<std::pair<const std::string_view, uint32_t>>>;
+    Map map;
+    size_t allocated = 0;
+    bool build(const std::vector<const char*> &ptrs) {
+        size_t before = allocated_bytes;
+        map.clear();
+        for (size_t i = 0; i < ptrs.size(); ++i)
+            map.emplace(std::string_view(ptrs[i]), (uint32_t)i);
+        allocated = allocated_bytes - before;
+        return true;
+    }
+    uint64_t find(const char *s, size_t len) const {
+        auto it = map.find(std::string_view(s, len));
+        return it == map.end() ? MISS : it->second;
+    }
+    size_t bytes() const { return sizeof(map) + allocated; }
+};
+
+// linear probing over a power-of-two table at most half full, which keeps each key's hash next
+// to its index so that probes rarely compare keys that do not match
+struct OpenTable {
+    std::vector<uint64_t> hashes;
+    std::vector<uint32_t> entries;  // index plus one, or 0 if empty
+    uint64_t mask = 0;
+    const char *const *keys = nullptr;
+    std::vector<uint32_t> lengths;
+    static uint64_t hash(const char *s, size_t len) { return mhash__mix64(mhash_strn_word_base(s, len)); }
+    bool build(const std::vector<const char*> &ptrs) {
+        keys = ptrs.data();
+        size_t size = 16;
+        while (size < 2 * ptrs.size())
+            size *= 2;
+        mask = size - 1;
+        hashes.assign(size, 0);
+        entries.assign(size, 0);
+        lengths.resize(ptrs.size());
+        for (size_t i = 0; i < ptrs.size(); ++i) {
+            size_t len = strlen(ptrs[i]);
+            lengths[i] = (uint32_t)len;
+            uint64_t h = hash(ptrs[i], len);
+            size_t slot = h & mask;
+            while (entries[slot])
+                slot = (slot + 1) & mask;
+            hashes[slot] = h;
+            entries[slot] = (uint32_t)(i + 1);
+        }
+        return true;
+    }
+    uint64_t find(const char *s, size_t len) const {
+        uint64_t h = hash(s, len);
+        for (size_t slot = h & mask; entries[slot]; slot = (slot + 1) & mask) {
+            uint32_t entry = entries[slot] - 1;
+            if (hashes[slot] == h && lengths[entry] == len && !memcmp(keys[entry], s, len))
+                return entry;
+        }
+        return MISS;
+    }
+    size_t bytes() const { return (sizeof(uint64_t) + sizeof(uint32_t)) * hashes.size() + sizeof(uint32_t) * lengths.size(); }
+};
+
+// --- hardware counters
+
+struct Counters {
+    int fds[4] = {-1, -1, -1, -1};
+    bool available = false;
+    uint64_t values[4] = {0, 0, 0, 0};  // cycles, instructions, branch misses, cache misses
+};
+
+static const char *counter_error = nullptr;
+
+static void counters_open(Counters &counters) {
+#ifdef __linux__
+    static const uint64_t configs[4] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                        PERF_COUNT_HW_BRANCH_MISSES, PERF_COUNT_HW_CACHE_MISSES};
+    for (int c = 0; c < 4; ++c) {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = configs[c];
+        attr.disabled = c == 0;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        counters.fds[c] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, c ? counters.fds[0] : -1, 0);
+        if (counters.fds[c] < 0) {
+            counter_error = strerror(errno);
+            for (int o = 0; o < c; ++o)
+                close(counters.fds[o]);
+            return;
+        }
+    }
+    counters.available = true;
+#else
+    counter_error = "perf_event_open is Linux-only";
+    (void)counters;
+#endif
+}
+
+static void counters_start(Counters &counters) {
+#ifdef __linux__
+    if (!counters.available)
+        return;
+    ioctl(counters.fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(counters.fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#else
+    (void)counters;
+#endif
+}
+
+static void counters_stop(Counters &counters) {
+#ifdef __linux__
+    if (!counters.available)
+        return;
+    ioctl(counters.fds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    for (int c = 0; c < 4; ++c)
+        if (read(counters.fds[c], &counters.values[c], sizeof(uint64_t)) != sizeof(uint64_t))
+            counters.values[c] = 0;
+#else
+    (void)counters;
+#endif
+}
+
+// --- measurements
+
+struct Query {
+    const char *s;
+    size_t len;
+};
+
+// lookups of random keys, of which hit_percent% are present
+static std::vector<Query> make_queries(const std::vector<std::string> &keys, size_t count, size_t lookups, unsigned hit_percent, uint64_t *seed) {
+    std::vector<Query> queries(lookups);
+    size_t misses = keys.size() - count;
+    for (Query &q : queries) {
+        bool hit = splitmix64(seed) % 100 < hit_percent || !misses;
+        const std::string &key = hit ? keys[splitmix64(seed) % count] : keys[count + splitmix64(seed) % misses];
+        q.s = key.c_str();
+        q.len = key.size();
+    }
+    return queries;
+}
+
+struct LookupResult {
+    double throughput_ns;   // per lookup, with lookups independent of each other
+    double latency_ns;      // per lookup, with each lookup waiting for the previous one
+    double counters[4];     // per lookup of the throughput loop
+};
+
+template<typename Table>
+static LookupResult measure_lookups(const Table &table, const std::vector<Query> &queries, Counters &counters) {
+    LookupResult result{};
+    uint64_t found = 0;
+    for (const Query &q : queries)  // warm-up
+        found += table.find(q.s, q.len) != MISS;
+    counters_start(counters);
+    auto start = std::chrono::steady_clock::now();
+    for (const Query &q : queries)
+        found += table.find(q.s, q.len) != MISS;
+    result.throughput_ns = seconds_since(start) * 1e9 / (double)queries.size();
+    counters_stop(counters);
+    for (int c = 0; c < 4; ++c)
+        result.counters[c] = (double)counters.values[c] / (double)queries.size();
+
+    uint64_t zero = opaque_zero;
+    size_t next = 0;
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < queries.size(); ++i) {
+        uint64_t entry = table.find(queries[next].s, queries[next].len);
+        next = (i + 1) ^ (size_t)(entry & zero);
+        found += entry != MISS;
+    }
+    result.latency_ns = seconds_since(start) * 1e9 / (double)queries.size();
+    sink = found;
+    return result;
+}
+
+// median time of building a table, repeated for at least 20ms
+template<typename Table>
+static double measure_build(const std::vector<const char*> &ptrs, bool *ok) {
+    std::vector<double> times;
+    auto begin = std::chrono::steady_clock::now();
+    do {
+        Table table;
+        auto start = std::chrono::steady_clock::now();
+        *ok = table.build(ptrs);
+        times.push_back(seconds_since(start));
+    } while (times.size() < 3 || (seconds_since(begin) < 0.02 && times.size() < 1000));
+    std::sort(times.begin(), times.end());
+    return times[times.size() / 2];
+}
+
+// hash functions tried by mhash_compact_build, which tries all MHASH_MAX_HASHES at each
+// table size it outgrows (growing by 25% from 2n+1)
+static size_t compact_attempts(const MHashCompact &map, size_t count) {
+    size_t attempts = map.num_hashes;
+    for (size_t size = count * 2 + 1; size < map.table_size; size = size + size / 4 + 1)
+        attempts += MHASH_MAX_HASHES;
+    return attempts;
+}
+
+// the cost of registering keys one at a time, as column_dimension does for new values
+static double measure_incremental(const std::vector<const char*> &ptrs, bool *ok) {
+    MHashCompact map{};
+    auto start = std::chrono::steady_clock::now();
+    *ok = true;
+    for (size_t n = 1; n <= ptrs.size() && *ok; ++n)
+        *ok = mhash_compact_build(&map, const_cast<const char**>(ptrs.data()), n, mhash_strn_word_multi) == MHASH_OK;
+    double seconds = seconds_since(start);
+    mhash_compact_free(&map);
+    return seconds;
+}
+
+static void print_build(uint64_t *seed) {
+    printf("\n== Build (short keys; memory excludes the keys, which all tables reference)\n");
+    printf("%7s | %-28s | %-28s | %-14s | %-14s | %s\n", "keys", "mhash_compact: time, B/key",
+           "  hashes, tries, one-by-one", "mhash: time", "B/key", "unordered_map, open: time, B/key");
+    const size_t counts[] = {8, 32, 128, 512, 2048, 8192};
+    for (size_t count : counts) {
+        std::vector<std::string> keys = make_keys(count, length_mixes[0], seed);
+        std::vector<const char*> ptrs = pointers(keys, count);
+        bool compact_ok, generic_ok, std_ok, open_ok, incremental_ok = false;
+        double compact_time = measure_build<CompactTable>(ptrs, &compact_ok);
+        double generic_time = measure_build<GenericTable>(ptrs, &generic_ok);
+        double std_time = measure_build<StdTable>(ptrs, &std_ok);
+        double open_time = measure_build<OpenTable>(ptrs, &open_ok);
+        // one-by-one rebuilds clear the whole table per try, which gets prohibitive past a few hundred keys
+        double incremental_time = count <= 512 ? measure_incremental(ptrs, &incremental_ok) : 0.0;
+        CompactTable compact;
+        GenericTable generic;
+        StdTable std_table;
+        OpenTable open;
+        compact.build(ptrs);
+        generic.build(ptrs);
+        std_table.build(ptrs);
+        open.build(ptrs);
+        char compact_text[64], hashes_text[64], generic_text[64], generic_bytes[32];
+        if (compact_ok) {
+            snprintf(compact_text, sizeof(compact_text), "%10.1f us %9.1f", compact_time * 1e6, (double)compact.bytes() / (double)count);
+            char incremental[32];
+            if (incremental_ok)
+                snprintf(incremental, sizeof(incremental), "%.2f ms", incremental_time * 1e3);
+            else
+                snprintf(incremental, sizeof(incremental), "%s", count <= 512 ? "fails" : "-");
+            snprintf(hashes_text, sizeof(hashes_text), "  %2zu %7zu %12s", (size_t)compact.map.num_hashes,
+                     compact_attempts(compact.map, count), incremental);
+        }
+        else {
+            snprintf(compact_text, sizeof(compact_text), "%28s", "fails (table too large)");
+            snprintf(hashes_text, sizeof(hashes_text), "%28s", "-");
+        }
+        if (generic_ok) {
+            snprintf(generic_text, sizeof(generic_text), "%11.1f us", generic_time * 1e6);
+            snprintf(generic_bytes, sizeof(generic_bytes), "%14.1f", (double)generic.bytes() / (double)count);
+        }
+        else {
+            snprintf(generic_text, sizeof(generic_text), "%14s", "fails");
+            snprintf(generic_bytes, sizeof(generic_bytes), "%14s", "-");
+        }
+        printf("%7zu | %s | %s | %s | %s | %8.1f us %5.1f, %8.1f us %5.1f\n", count, compact_text, hashes_text, generic_text, generic_bytes,
+               std_time * 1e6, (double)std_table.bytes() / (double)count, open_time * 1e6, (double)open.bytes() / (double)count);
+    }
+}
+
+static void print_hash_distribution(uint64_t *seed) {
+    printf("\n== num_hashes of mhash_compact over 200 random key sets (and mean load of the table)\n");
+    printf("%7s |", "keys");
+    for (int h = 1; h <= MHASH_MAX_HASHES; ++h)
+        printf(" %5d", h);
+    printf(" | %s\n", "load");
+    const size_t counts[] = {8, 32, 128, 512, 2048};
+    for (size_t count : counts) {
+        size_t histogram[MHASH_MAX_HASHES + 1] = {0};
+        double load = 0.0;
+        const size_t trials = 200;
+        for (size_t t = 0; t < trials; ++t) {
+            std::vector<std::string> keys = make_keys(count, length_mixes[0], seed);
+            std::vector<const char*> ptrs = pointers(keys, count);
+            CompactTable table;
+            if (table.build(ptrs)) {
+                ++histogram[table.map.num_hashes];
+                load += (double)count / (double)table.map.table_size;
+            }
+        }
+        printf("%7zu |", count);
+        for (int h = 1; h <= MHASH_MAX_HASHES; ++h)
+            printf(" %5zu", histogram[h]);
+        printf(" | %.4f\n", load / (double)trials);
+    }
+}
+
+static void print_lookup_cell(const LookupResult *result, bool counters) {
+    if (!result)
+        printf(" %21s", "-");
+    else if (counters)
+        printf(" %5.0f %5.0f %4.2f %4.2f", result->counters[0], result->counters[1], result->counters[2], result->counters[3]);
+    else
+        printf(" %6.1f %6.1f %7.1f", result->throughput_ns, result->latency_ns, 1e3 / result->throughput_ns);
+}
+
+static void print_lookups(size_t lookups, uint64_t *seed) {
+    Counters counters;
+    counters_open(counters);
+    printf("\n== Lookups (%zu per row): ns per lookup when independent, ns per lookup when dependent, million lookups/s\n", lookups);
+    if (counters.available)
+        printf("   and per lookup: cycles, instructions, branch misses, cache misses\n");
+    else
+        printf("   hardware counters unavailable (%s)\n", counter_error);
+    printf("%-12s %6s %4s | %-21s | %-21s | %-21s | %-21s\n", "keys", "count", "hit%", " mhash_compact", " mhash", " unordered_map", " open addressing");
+    const size_t counts[] = {16, 256, 4096};
+    const unsigned hit_percents[] = {100, 90, 50, 0};
+    for (const LengthMix &mix : length_mixes) {
+        for (size_t count : counts) {
+            std::vector<std::string> keys = make_keys(count + count, mix, seed);
+            std::vector<const char*> ptrs = pointers(keys, count);
+            CompactTable compact;
+            GenericTable generic;
+            StdTable std_table;
+            OpenTable open;
+            bool compact_ok = compact.build(ptrs);
+            bool generic_ok = generic.build(ptrs);
+            std_table.build(ptrs);
+            open.build(ptrs);
+            for (unsigned hit_percent : hit_percents) {
+                std::vector<Query> queries = make_queries(keys, count, lookups, hit_percent, seed);
+                LookupResult results[4] = {};
+                if (compact_ok)
+                    results[0] = measure_lookups(compact, queries, counters);
+                if (generic_ok)
+                    results[1] = measure_lookups(generic, queries, counters);
+                results[2] = measure_lookups(std_table, queries, counters);
+                results[3] = measure_lookups(open, queries, counters);
+                for (int row = 0; row < (counters.available ? 2 : 1); ++row) {
+                    if (row)
+                        printf("%-12s %6s %4s |", "", "", "");
+                    else
+                        printf("%-12s %6zu %4u |", mix.name, count, hit_percent);
+                    print_lookup_cell(compact_ok ? &results[0] : nullptr, row);
+                    printf(" |");
+                    print_lookup_cell(generic_ok ? &results[1] : nullptr, row);
+                    printf(" |");
+                    print_lookup_cell(&results[2], row);
+                    printf(" |");
+                    print_lookup_cell(&results[3], row);
+                    printf("\n");
+                }
+            }
+        }
+    }
+}
+
+// --- batched lookups
+
+// median ns per lookup of a pass over all queries, repeated for at least 20ms
+template<typename Pass>
+static double measure_pass(size_t lookups, Pass pass) {
+    std::vector<double> times;
+    auto begin = std::chrono::steady_clock::now();
+    sink = pass();  // warm-up
+    do {
+        auto start = std::chrono::steady_clock::now();
+        sink = pass();
+        times.push_back(seconds_since(start) * 1e9 / (double)lookups);
+    } while (times.size() < 3 || (seconds_since(begin) < 0.02 && times.size() < 1000));
+    std::sort(times.begin(), times.end());
+    return times[times.size() / 2];
+}
+
+static int compare_strings(const void *a, const void *b) {
+    return strcmp((const char*)a, (const char*)b);
+}
+
+static void print_batches(size_t lookups, uint64_t *seed) {
+    printf("\n== Batched lookups (medium keys): ns per lookup, one at a time / batched (MHASH_BATCH=%d)\n", MHASH_BATCH);
+    printf("%6s %4s | %-15s | %-15s | %-15s\n", "count", "hit%", " mhash_compact", " mhash", " MHashMap");
+    const size_t counts[] = {256, 2048, 8192};
+    const unsigned hit_percents[] = {100, 50};
+    for (size_t count : counts) {
+        std::vector<std::string> keys = make_keys(count + count, length_mixes[1], seed);
+        std::vector<const char*> ptrs = pointers(keys, count);
+        std::vector<uint32_t> ids(count);
+        CompactTable compact;
+        GenericTable generic;
+        MHashMap<uint32_t> map;
+        for (size_t i = 0; i < count; ++i) {
+            ids[i] = (uint32_t)i;
+            map.insert(keys[i], (uint32_t)i);
+        }
+        bool compact_ok = compact.build(ptrs);
+        bool generic_ok = generic.build(ptrs);
+        bool map_ok = true;
+        try {
+            map.build();
+        }
+        catch (const std::runtime_error&) {
+            map_ok = false;
+        }
+        for (unsigned hit_percent : hit_percents) {
+            std::vector<Query> queries = make_queries(keys, count, lookups, hit_percent, seed);
+            std::vector<const char*> cells(lookups);
+            std::vector<size_t> lens(lookups);
+            std::vector<std::string_view> views(lookups);
+            for (size_t i = 0; i < lookups; ++i) {
+                cells[i] = queries[i].s;
+                lens[i] = queries[i].len;
+                views[i] = std::string_view(queries[i].s, queries[i].len);
+            }
+            std::vector<MHASH_INDEX_UINT> indexes(lookups);
+            std::vector<void*> values(lookups);
+            std::vector<uint32_t*> found(lookups);
+            printf("%6zu %4u |", count, hit_percent);
+            if (compact_ok) {
+                double single = measure_pass(lookups, [&] {
+                    uint64_t hits = 0;
+                    for (size_t i = 0; i < lookups; ++i)
+                        hits += compact.find(cells[i], lens[i]) != MISS;
+                    return hits;
+                });
+                double batched = measure_pass(lookups, [&] {
+                    mhash_compact_find_batch(&compact.map, cells.data(), lens.data(), lookups, compact.keys, indexes.data());
+                    return (uint64_t)std::count_if(indexes.begin(), indexes.end(), [](MHASH_INDEX_UINT e) { return e != MHASH_EMPTY_SLOT; });
+                });
+                printf(" %6.1f / %6.1f |", single, batched);
+            }
+            else
+                printf(" %15s |", "-");
+            if (generic_ok) {
+                double single = measure_pass(lookups, [&] {
+                    uint64_t hits = 0;
+                    for (size_t i = 0; i < lookups; ++i)
+                        hits += generic.find(cells[i], lens[i]) != MISS;
+                    return hits;
+                });
+                double batched = measure_pass(lookups, [&] {
+                    mhash_lookup_batch(&generic.map, (const void *const *)cells.data(), lookups, (const void**)ptrs.data(),
+                                       ids.data(), sizeof(uint32_t), compare_strings, values.data());
+                    return (uint64_t)std::count_if(values.begin(), values.end(), [](void *v) { return v != nullptr; });
+                });
+                printf(" %6.1f / %6.1f |", single, batched);
+            }
+            else
+                printf(" %15s |", "-");
+            if (map_ok) {
+                double single = measure_pass(lookups, [&] {
+                    uint64_t hits = 0;
+                    for (size_t i = 0; i < lookups; ++i)
+                        hits += map.get(views[i]) != nullptr;
+                    return hits;
+                });
+                double batched = measure_pass(lookups, [&] {
+                    map.get_batch(views.data(), lookups, found.data());
+                    return (uint64_t)std::count_if(found.begin(), found.end(), [](uint32_t *v) { return v != nullptr; });
+                });
+                printf(" %6.1f / %6.1f\n", single, batched);
+            }
+            else
+                printf(" %15s\n", "-");
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    size_t lookups = argc > 1 ? (size_t)atol(argv[1]) : 500000;
+    if (!lookups) {
+        fprintf(stderr, "Usage: %s [lookups]\n", argv[0]);
+        return 2;
+    }
+    uint64_t seed = 1;
+    printf("mhash microbenchmark (MHASH_MAX_HASHES=%d)\n", MHASH_MAX_HASHES);
+    print_build(&seed);
+    print_hash_distribution(&seed);
+    print_lookups(lookups, &seed);
+    print_batches(lookups, &seed);
+    return 0;
+}
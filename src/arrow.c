@@ -0,0 +1,543 @@
+#include "arrow.h"
+#include "mapping.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// union tags of the Arrow flatbuffers schema (Message.fbs and Schema.fbs)
+#define MESSAGE_SCHEMA 1
+#define MESSAGE_DICTIONARY_BATCH 2
+#define MESSAGE_RECORD_BATCH 3
+
+#define TYPE_NULL 1
+#define TYPE_INT 2
+#define TYPE_FLOATING_POINT 3
+#define TYPE_BINARY 4
+#define TYPE_UTF8 5
+#define TYPE_BOOL 6
+#define TYPE_DECIMAL 7
+#define TYPE_DATE 8
+#define TYPE_TIME 9
+#define TYPE_TIMESTAMP 10
+#define TYPE_INTERVAL 11
+#define TYPE_LIST 12
+#define TYPE_STRUCT 13
+#define TYPE_UNION 14
+#define TYPE_FIXED_SIZE_BINARY 15
+#define TYPE_FIXED_SIZE_LIST 16
+#define TYPE_MAP 17
+#define TYPE_DURATION 18
+#define TYPE_LARGE_BINARY 19
+#define TYPE_LARGE_UTF8 20
+#define TYPE_LARGE_LIST 21
+#define TYPE_RUN_END_ENCODED 22
+#define TYPE_LIST_VIEW 25
+#define TYPE_LARGE_LIST_VIEW 26
+
+#define MAX_NESTING 32
+
+// --- bounds-checked reading of flatbuffers tables; every helper returns 0 on malformed input
+
+struct FlatTable {
+    const uint8_t *buf;
+    size_t size;
+    size_t pos;
+    size_t vtable;
+    size_t vtable_size;
+};
+
+static inline uint32_t load_u32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static inline int64_t load_i64(const uint8_t *p) {
+    int64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static int flat_table_at(const uint8_t *buf, size_t size, size_t pos, struct FlatTable *table) {
+    if (pos > size || size - pos < 4)
+        return 0;
+    int64_t vtable = (int64_t)pos - (int64_t)(int32_t)load_u32(buf + pos);
+    if (vtable < 0 || (size_t)vtable > size || size - (size_t)vtable < 4)
+        return 0;
+    uint16_t vtable_size;
+    memcpy(&vtable_size, buf + vtable, 2);
+    if (vtable_size < 4 || size - (size_t)vtable < vtable_size)
+        return 0;
+    table->buf = buf;
+    table->size = size;
+    table->pos = pos;
+    table->vtable = (size_t)vtable;
+    table->vtable_size = vtable_size;
+    return 1;
+}
+
+// position of a field of the table, or 0 if absent (including out of bounds)
+static size_t flat_field(const struct FlatTable *table, size_t field, size_t width) {
+    size_t entry = 4 + 2 * field;
+    if (entry + 2 > table->vtable_size)
+        return 0;
+    uint16_t offset;
+    memcpy(&offset, table->buf + table->vtable + entry, 2);
+    if (!offset || table->pos + offset + width > table->size)
+        return 0;
+    return table->pos + offset;
+}
+
+static int64_t flat_int(const struct FlatTable *table, size_t field, size_t width, int64_t missing) {
+    size_t pos = flat_field(table, field, width);
+    if (!pos)
+        return missing;
+    const uint8_t *p = table->buf + pos;
+    switch (width) {
+        case 1: return (int64_t)(int8_t)p[0];
+        case 2: {
+            int16_t v;
+            memcpy(&v, p, 2);
+            return v;
+        }
+        case 4: return (int64_t)(int32_t)load_u32(p);
+        default: return load_i64(p);
+    }
+}
+
+// follows the offset stored in a field, returning 0 if the field is absent or malformed
+static size_t flat_ref(const struct FlatTable *table, size_t field) {
+    size_t pos = flat_field(table, field, 4);
+    if (!pos)
+        return 0;
+    size_t target = pos + load_u32(table->buf + pos);
+    return target < table->size ? target : 0;
+}
+
+static int flat_table(const struct FlatTable *table, size_t field, struct FlatTable *out) {
+    size_t target = flat_ref(table, field);
+    return target && flat_table_at(table->buf, table->size, target, out);
+}
+
+static int flat_vector(const struct FlatTable *table, size_t field, size_t element_size, size_t *start, size_t *count) {
+    size_t target = flat_ref(table, field);
+    if (!target || table->size - target < 4)
+        return 0;
+    *count = load_u32(table->buf + target);
+    *start = target + 4;
+    return *count <= (table->size - *start) / element_size;
+}
+
+static int flat_vector_table(const struct FlatTable *table, size_t start, size_t i, struct FlatTable *out) {
+    size_t pos = start + 4 * i;
+    return flat_table_at(table->buf, table->size, pos + load_u32(table->buf + pos), out);
+}
+
+// --- schema
+
+// counts the nodes and buffers that a field and its children occupy in each record batch
+static int field_layout(const struct FlatTable *field, size_t *nodes, size_t *buffers, int depth) {
+    if (depth > MAX_NESTING)
+        return 0;
+    *nodes += 1;
+    struct FlatTable dictionary;
+    if (flat_table(field, 4, &dictionary)) {
+        *buffers += 2; // validity and indices; the values arrive in dictionary batches
+        return 1;
+    }
+    switch (flat_int(field, 2, 1, 0)) {
+        case TYPE_NULL:
+        case TYPE_RUN_END_ENCODED:
+            break;
+        case TYPE_STRUCT:
+        case TYPE_FIXED_SIZE_LIST:
+            *buffers += 1;
+            break;
+        case TYPE_UNION: {
+            struct FlatTable type;
+            int dense = flat_table(field, 3, &type) && flat_int(&type, 0, 2, 0) == 1;
+            *buffers += dense ? 2 : 1;
+            break;
+        }
+        case TYPE_INT:
+        case TYPE_FLOATING_POINT:
+        case TYPE_BOOL:
+        case TYPE_DECIMAL:
+        case TYPE_DATE:
+        case TYPE_TIME:
+        case TYPE_TIMESTAMP:
+        case TYPE_INTERVAL:
+        case TYPE_FIXED_SIZE_BINARY:
+        case TYPE_DURATION:
+        case TYPE_LIST:
+        case TYPE_LARGE_LIST:
+        case TYPE_MAP:
+            *buffers += 2;
+            break;
+        case TYPE_BINARY:
+        case TYPE_UTF8:
+        case TYPE_LARGE_BINARY:
+        case TYPE_LARGE_UTF8:
+        case TYPE_LIST_VIEW:
+        case TYPE_LARGE_LIST_VIEW:
+            *buffers += 3;
+            break;
+        default:
+            return 0; // e.g., views with a variable number of buffers
+    }
+    size_t start, count;
+    if (flat_vector(field, 5, 4, &start, &count))
+        for (size_t i = 0; i < count; ++i) {
+            struct FlatTable child;
+            if (!flat_vector_table(field, start, i, &child) || !field_layout(&child, nodes, buffers, depth + 1))
+                return 0;
+        }
+    return 1;
+}
+
+// reads the value type of a field (or of its dictionary values) that can be analyzed
+static void field_type(const struct FlatTable *table, struct ArrowField *field) {
+    struct FlatTable type;
+    int has_type = flat_table(table, 3, &type);
+    field->type = ARROW_TYPE_UNSUPPORTED;
+    switch (flat_int(table, 2, 1, 0)) {
+        case TYPE_INT:
+            if (!has_type)
+                return;
+            field->bit_width = (int)flat_int(&type, 0, 4, 0);
+            field->is_signed = (int)flat_int(&type, 1, 1, 0);
+            if (field->bit_width == 8 || field->bit_width == 16 || field->bit_width == 32 || field->bit_width == 64)
+                field->type = ARROW_TYPE_INT;
+            return;
+        case TYPE_FLOATING_POINT: {
+            int64_t precision = has_type ? flat_int(&type, 0, 2, 0) : 0;
+            if (precision == 1 || precision == 2) { // SINGLE or DOUBLE
+                field->bit_width = precision == 1 ? 32 : 64;
+                field->type = ARROW_TYPE_FLOAT;
+            }
+            return;
+        }
+        case TYPE_BOOL:
+            field->type = ARROW_TYPE_BOOL;
+            return;
+        case TYPE_BINARY:
+        case TYPE_UTF8:
+            field->type = ARROW_TYPE_UTF8;
+            return;
+        case TYPE_LARGE_BINARY:
+        case TYPE_LARGE_UTF8:
+            field->type = ARROW_TYPE_LARGE_UTF8;
+            return;
+        default:
+            return;
+    }
+}
+
+static int read_schema(struct ArrowFile *file, const struct FlatTable *schema) {
+    if (flat_int(schema, 0, 2, 0) != 0) {
+        fprintf(stderr, "Error: big-endian Arrow files are not supported\n");
+        return 2;
+    }
+    size_t start, count;
+    if (!flat_vector(schema, 1, 4, &start, &count)) {
+        fprintf(stderr, "Error: malformed Arrow schema\n");
+        return 2;
+    }
+    if (count > ARROW_MAX_FIELDS) {
+        fprintf(stderr, "Error: too many columns in Arrow schema\n");
+        return 2;
+    }
+    file->field_count = count;
+    for (size_t i = 0; i < count; ++i) {
+        struct FlatTable table;
+        struct ArrowField *field = &file->fields[i];
+        memset(field, 0, sizeof(struct ArrowField));
+        field->first_node = file->node_count;
+        field->first_buffer = file->buffer_count;
+        if (!flat_vector_table(schema, start, i, &table)
+            || !field_layout(&table, &file->node_count, &file->buffer_count, 0)) {
+            fprintf(stderr, "Error: unsupported or malformed Arrow field %zu\n", i);
+            return 2;
+        }
+        size_t name_start, name_len;
+        if (flat_vector(&table, 0, 1, &name_start, &name_len)) {
+            field->name = (const char *)table.buf + name_start;
+            field->name_len = name_len;
+        }
+        else {
+            field->name = "";
+            field->name_len = 0;
+        }
+        field_type(&table, field);
+        struct FlatTable dictionary, index_type;
+        if (flat_table(&table, 4, &dictionary)) {
+            field->dictionary = 1;
+            field->dictionary_id = flat_int(&dictionary, 0, 8, 0);
+            field->index_bit_width = 32;
+            field->index_signed = 1;
+            if (flat_table(&dictionary, 1, &index_type)) {
+                field->index_bit_width = (int)flat_int(&index_type, 0, 4, 32);
+                field->index_signed = (int)flat_int(&index_type, 1, 1, 0);
+            }
+            if (field->index_bit_width != 8 && field->index_bit_width != 16
+                && field->index_bit_width != 32 && field->index_bit_width != 64)
+                field->type = ARROW_TYPE_UNSUPPORTED;
+        }
+    }
+    return 0;
+}
+
+// --- messages
+
+struct Message {
+    struct FlatTable header;
+    int header_type;
+    const uint8_t *body;
+    size_t body_length;
+};
+
+// reads the next encapsulated message, setting *done at the end-of-stream marker
+static int read_message(struct ArrowFile *file, struct Message *message, int *done) {
+    *done = 0;
+    if (file->pos >= file->end || file->end - file->pos < 4) {
+        *done = 1;
+        return 0;
+    }
+    size_t pos = file->pos;
+    uint32_t length = load_u32(file->data + pos);
+    pos += 4;
+    if (length == 0xFFFFFFFFu) { // continuation marker of the current format
+        if (file->end - pos < 4) {
+            *done = 1;
+            return 0;
+        }
+        length = load_u32(file->data + pos);
+        pos += 4;
+    }
+    if (length == 0) {
+        *done = 1;
+        return 0;
+    }
+    struct FlatTable root;
+    if (length < 4 || length > file->end - pos
+        || !flat_table_at(file->data + pos, length, load_u32(file->data + pos), &root)) {
+        fprintf(stderr, "Error: malformed Arrow message\n");
+        return 2;
+    }
+    message->header_type = (int)flat_int(&root, 1, 1, 0);
+    int64_t body_length = flat_int(&root, 3, 8, 0);
+    if (!flat_table(&root, 2, &message->header)
+        || body_length < 0
+        || (uint64_t)body_length > file->end - pos - length) {
+        fprintf(stderr, "Error: malformed Arrow message\n");
+        return 2;
+    }
+    message->body = file->data + pos + length;
+    message->body_length = (size_t)body_length;
+    file->pos = pos + length + (size_t)body_length;
+    return 0;
+}
+
+// locates buffer i of a record batch within the message body, checking that it holds min_length bytes
+static int batch_buffer(const struct Message *message, const struct FlatTable *batch, size_t buffers, size_t buffer_count,
+                        size_t i, size_t min_length, const uint8_t **out) {
+    if (i >= buffer_count)
+        return 0;
+    const uint8_t *entry = batch->buf + buffers + 16 * i;
+    int64_t offset = load_i64(entry);
+    int64_t length = load_i64(entry + 8);
+    if (offset < 0 || length < 0 || (uint64_t)offset > message->body_length
+        || (uint64_t)length > message->body_length - (size_t)offset || (uint64_t)length < min_length)
+        return 0;
+    *out = message->body + offset;
+    return 1;
+}
+
+// reads the array of a field whose nodes and buffers start at the given positions
+static int read_array(const struct Message *message, const struct FlatTable *batch, int type, int bit_width,
+                      size_t node, size_t buffer, struct ArrowArray *array) {
+    size_t nodes_start, node_count, buffers_start, buffer_count;
+    if (!flat_vector(batch, 1, 16, &nodes_start, &node_count)
+        || !flat_vector(batch, 2, 16, &buffers_start, &buffer_count)
+        || node >= node_count)
+        return 0;
+    int64_t length = load_i64(batch->buf + nodes_start + 16 * node);
+    int64_t null_count = load_i64(batch->buf + nodes_start + 16 * node + 8);
+    if (length < 0 || null_count < 0 || (uint64_t)length > SIZE_MAX / 16)
+        return 0;
+    memset(array, 0, sizeof(struct ArrowArray));
+    array->length = (size_t)length;
+    array->null_count = (size_t)null_count;
+    size_t bitmap_length = (array->length + 7) / 8;
+    if (array->null_count && !batch_buffer(message, batch, buffers_start, buffer_count, buffer, bitmap_length, &array->validity))
+        return 0;
+    size_t values_length;
+    if (type == ARROW_TYPE_BOOL)
+        values_length = bitmap_length;
+    else if (type == ARROW_TYPE_UTF8)
+        values_length = (array->length + 1) * 4;
+    else if (type == ARROW_TYPE_LARGE_UTF8)
+        values_length = (array->length + 1) * 8;
+    else
+        values_length = array->length * (size_t)(bit_width / 8);
+    if (!array->length)
+        return 1;
+    if (!batch_buffer(message, batch, buffers_start, buffer_count, buffer + 1, values_length, &array->values))
+        return 0;
+    if (type != ARROW_TYPE_UTF8 && type != ARROW_TYPE_LARGE_UTF8)
+        return 1;
+
+    // string offsets are checked once here, so that cells can be read without bounds checks
+    if (!batch_buffer(message, batch, buffers_start, buffer_count, buffer + 2, 0, &array->data))
+        return 0;
+    int64_t data_length = load_i64(batch->buf + buffers_start + 16 * (buffer + 2) + 8);
+    int64_t previous = 0;
+    for (size_t i = 0; i <= array->length; ++i) {
+        int64_t offset;
+        if (type == ARROW_TYPE_LARGE_UTF8)
+            offset = load_i64(array->values + 8 * i);
+        else
+            offset = (int64_t)(int32_t)load_u32(array->values + 4 * i);
+        if (offset < previous || offset > data_length)
+            return 0;
+        previous = offset;
+    }
+    return 1;
+}
+
+static int read_record_batch(struct ArrowFile *file, const struct Message *message) {
+    const struct FlatTable *batch = &message->header;
+    struct FlatTable compression;
+    if (flat_table(batch, 3, &compression)) {
+        fprintf(stderr, "Error: compressed Arrow record batches are not supported\n");
+        return 2;
+    }
+    int64_t length = flat_int(batch, 0, 8, 0);
+    if (length < 0) {
+        fprintf(stderr, "Error: malformed Arrow record batch\n");
+        return 2;
+    }
+    file->batch_length = (size_t)length;
+    for (size_t i = 0; i < file->field_count; ++i) {
+        const struct ArrowField *field = &file->fields[i];
+        struct ArrowArray *array = &file->columns[i];
+        memset(array, 0, sizeof(struct ArrowArray));
+        if (field->type == ARROW_TYPE_UNSUPPORTED)
+            continue;
+        int type = field->dictionary ? ARROW_TYPE_INT : field->type;
+        int bit_width = field->dictionary ? field->index_bit_width : field->bit_width;
+        if (!read_array(message, batch, type, bit_width, field->first_node, field->first_buffer, array)
+            || array->length != file->batch_length) {
+            fprintf(stderr, "Error: malformed Arrow column %.*s\n", (int)field->name_len, field->name);
+            return 2;
+        }
+    }
+    return 0;
+}
+
+static int read_dictionary_batch(struct ArrowFile *file, const struct Message *message) {
+    struct FlatTable batch;
+    if (!flat_table(&message->header, 1, &batch)) {
+        fprintf(stderr, "Error: malformed Arrow dictionary batch\n");
+        return 2;
+    }
+    struct FlatTable compression;
+    if (flat_table(&batch, 3, &compression)) {
+        fprintf(stderr, "Error: compressed Arrow record batches are not supported\n");
+        return 2;
+    }
+    file->dictionary_id = flat_int(&message->header, 0, 8, 0);
+    file->dictionary_delta = (int)flat_int(&message->header, 2, 1, 0);
+    file->dictionary_type = ARROW_TYPE_UNSUPPORTED;
+    memset(&file->dictionary_values, 0, sizeof(struct ArrowArray));
+    for (size_t i = 0; i < file->field_count; ++i) {
+        const struct ArrowField *field = &file->fields[i];
+        if (!field->dictionary || field->dictionary_id != file->dictionary_id)
+            continue;
+        file->dictionary_type = field->type;
+        if (field->type == ARROW_TYPE_UNSUPPORTED)
+            return 0; // values are never read
+        if (!read_array(message, &batch, field->type, field->bit_width, 0, 0, &file->dictionary_values)) {
+            fprintf(stderr, "Error: malformed Arrow dictionary of column %.*s\n", (int)field->name_len, field->name);
+            return 2;
+        }
+        return 0;
+    }
+    return 0;
+}
+
+int arrow_next(struct ArrowFile *file, int *kind) {
+    for (;;) {
+        struct Message message;
+        int done;
+        if (read_message(file, &message, &done))
+            return 2;
+        if (done) {
+            *kind = ARROW_END;
+            return 0;
+        }
+        if (message.header_type == MESSAGE_RECORD_BATCH) {
+            *kind = ARROW_RECORD_BATCH;
+            return read_record_batch(file, &message);
+        }
+        if (message.header_type == MESSAGE_DICTIONARY_BATCH) {
+            *kind = ARROW_DICTIONARY;
+            return read_dictionary_batch(file, &message);
+        }
+        // other messages (e.g., a repeated schema) carry nothing to accumulate
+    }
+}
+
+// --- mapping
+
+int arrow_detect(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return 0;
+    unsigned char magic[6];
+    size_t n = fread(magic, 1, sizeof(magic), f);
+    fclose(f);
+    if (n == 6 && !memcmp(magic, "ARROW1", 6))
+        return 1;
+    return n >= 4 && magic[0] == 0xFF && magic[1] == 0xFF && magic[2] == 0xFF && magic[3] == 0xFF;
+}
+
+void arrow_close(struct ArrowFile *file) {
+    if (!file->data)
+        return;
+    unmap_file(file->data, file->size, file->mapping);
+    file->data = NULL;
+}
+
+int arrow_open(struct ArrowFile *file, const char *path) {
+    memset(file, 0, sizeof(struct ArrowFile));
+    if (map_file(path, &file->data, &file->size, &file->mapping)) {
+        fprintf(stderr, "Error: could not map Arrow file %s\n", path);
+        return 2;
+    }
+    file->end = file->size;
+    if (file->size >= 8 && !memcmp(file->data, "ARROW1", 6)) {
+        // file format: magic and padding, the stream, the footer, its length, and the magic again
+        file->pos = 8;
+        if (file->size >= 18 && !memcmp(file->data + file->size - 6, "ARROW1", 6)) {
+            uint32_t footer_length = load_u32(file->data + file->size - 10);
+            if (footer_length <= file->size - 18)
+                file->end = file->size - 10 - footer_length;
+        }
+    }
+    struct Message message;
+    int done;
+    if (read_message(file, &message, &done)) {
+        arrow_close(file);
+        return 2;
+    }
+    if (done || message.header_type != MESSAGE_SCHEMA) {
+        fprintf(stderr, "Error: Arrow input does not start with a schema\n");
+        arrow_close(file);
+        return 2;
+    }
+    if (read_schema(file, &message.header)) {
+        arrow_close(file);
+        return 2;
+    }
+    return 0;
+}
@@ -0,0 +1,136 @@
+#ifndef ARROW_H
+#define ARROW_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/*
+ * Reader of uncompressed Arrow IPC files (ARROW1 magic) and streams, mapped into memory.
+ * Metadata is decoded from its flatbuffers by hand, and record batch buffers are exposed as
+ * pointers into the mapping, so that no cell is copied or converted to text.
+ */
+
+#define ARROW_MAX_FIELDS 64
+
+#define ARROW_TYPE_UNSUPPORTED 0  // present in the schema but never read (e.g., nested columns)
+#define ARROW_TYPE_INT 1
+#define ARROW_TYPE_FLOAT 2
+#define ARROW_TYPE_BOOL 3
+#define ARROW_TYPE_UTF8 4         // also Binary
+#define ARROW_TYPE_LARGE_UTF8 5   // also LargeBinary
+
+#define ARROW_END 0
+#define ARROW_DICTIONARY 1
+#define ARROW_RECORD_BATCH 2
+
+struct ArrowField {
+    const char *name;         // points into the mapping, not null-terminated
+    size_t name_len;
+    int type;                 // value type (of the dictionary values when dictionary-encoded)
+    int bit_width;            // of INT and FLOAT values
+    int is_signed;
+    int dictionary;           // whether cells are indices into a dictionary
+    int64_t dictionary_id;
+    int index_bit_width;
+    int index_signed;
+    size_t first_node;        // positions among the flattened nodes and buffers of a batch
+    size_t first_buffer;
+};
+
+// one column of a record batch or the values of a dictionary batch, pointing into the mapping
+struct ArrowArray {
+    size_t length;
+    size_t null_count;
+    const uint8_t *validity;  // NULL when there are no nulls
+    const uint8_t *values;    // values, bits of booleans, dictionary indices, or string offsets
+    const uint8_t *data;      // bytes of strings
+};
+
+struct ArrowFile {
+    const uint8_t *data;
+    size_t size;
+    size_t pos;               // next message
+    size_t end;               // end of the message stream (the footer of files is not needed)
+    void *mapping;            // platform handle of the mapping
+    struct ArrowField fields[ARROW_MAX_FIELDS];
+    size_t field_count;
+    size_t node_count;        // nodes and buffers per record batch, including nested ones
+    size_t buffer_count;
+
+    // last message read by arrow_next
+    size_t batch_length;
+    struct ArrowArray columns[ARROW_MAX_FIELDS];   // of ARROW_RECORD_BATCH (unsupported fields are empty)
+    int64_t dictionary_id;                         // of ARROW_DICTIONARY
+    int dictionary_delta;                          // whether dictionary_values extend the previous ones
+    struct ArrowArray dictionary_values;
+    int dictionary_type;
+};
+
+// Returns whether the first bytes of a file are those of an Arrow IPC file or stream.
+int arrow_detect(const char *path);
+
+// Maps the file and reads its schema. Returns 0 on success and 2 on error (with a message).
+int arrow_open(struct ArrowFile *file, const char *path);
+
+// Reads the next dictionary or record batch into file and sets *kind to ARROW_DICTIONARY,
+// ARROW_RECORD_BATCH or ARROW_END. Returns 0 on success and 2 on error (with a message).
+int arrow_next(struct ArrowFile *file, int *kind);
+
+void arrow_close(struct ArrowFile *file);
+
+static inline int arrow_is_valid(const struct ArrowArray *array, size_t i) {
+    return !array->validity || ((array->validity[i >> 3] >> (i & 7)) & 1);
+}
+
+static inline int64_t arrow_int(const uint8_t *values, size_t i, int bit_width, int is_signed) {
+    switch (bit_width) {
+        case 8: return is_signed ? (int64_t)((const int8_t *)values)[i] : (int64_t)values[i];
+        case 16: {
+            uint16_t v;
+            memcpy(&v, values + i * 2, 2);
+            return is_signed ? (int64_t)(int16_t)v : (int64_t)v;
+        }
+        case 32: {
+            uint32_t v;
+            memcpy(&v, values + i * 4, 4);
+            return is_signed ? (int64_t)(int32_t)v : (int64_t)v;
+        }
+        default: {
+            int64_t v;
+            memcpy(&v, values + i * 8, 8);
+            return v;
+        }
+    }
+}
+
+static inline double arrow_float(const uint8_t *values, size_t i, int bit_width) {
+    if (bit_width == 32) {
+        float v;
+        memcpy(&v, values + i * 4, 4);
+        return (double)v;
+    }
+    double v;
+    memcpy(&v, values + i * 8, 8);
+    return v;
+}
+
+// Returns the bytes of string i of a UTF8 or LARGE_UTF8 array.
+static inline const char *arrow_string(const struct ArrowArray *array, int type, size_t i, size_t *len) {
+    int64_t start, end;
+    if (type == ARROW_TYPE_LARGE_UTF8) {
+        memcpy(&start, array->values + i * 8, 8);
+        memcpy(&end, array->values + i * 8 + 8, 8);
+    }
+    else {
+        int32_t s, e;
+        memcpy(&s, array->values + i * 4, 4);
+        memcpy(&e, array->values + i * 4 + 4, 4);
+        start = s;
+        end = e;
+    }
+    *len = (size_t)(end - start);
+    return (const char *)array->data + start;
+}
+
+#endif // ARROW_H
@@ -0,0 +1,286 @@
+#include "data.h"
+#include "arrow.h"
+#include "numeric.h"
+
+// how the cells of an Arrow column are turned into dimensions and values
+#define KIND_SKIP 0
+#define KIND_DICTIONARY 1   // dictionary indices, each entry resolved once through the column's handler
+#define KIND_BOOL 2         // bits, resolved like the cells "0" and "1"
+#define KIND_NUMBER 3       // int or float label/predict values that are used as they are
+#define KIND_NUMBER_TEXT 4  // int or float cells that go through the handler as text
+#define KIND_TEXT 5         // strings that go through the handler
+
+#define BOOL_ENTRIES 2
+#define INT_ENTRIES (1 << 16)  // non-negative ints below this are cached like dictionary entries
+
+struct ArrowColumn {
+    int kind;
+    const struct ArrowField *field;
+    struct ValueCache cache;    // entries of a dictionary (or of booleans, or small ints)
+    uint32_t *dims;             // per row of a batch, for accumulated columns and the partition
+    double *values;             // per row of a batch, for the label and predict columns
+    int null_resolved;
+    MHASH_INDEX_UINT null_dim;
+    double null_value;
+};
+
+// resolves a small int like the entry of the same index, whose text is only formatted the first time
+static inline int resolve_int(struct ArrowColumn *state, size_t entry, int64_t number, MHASH_INDEX_UINT *dim, double *value) {
+    struct ValueCache *cache = &state->cache;
+    if (cache->entry_dims[entry] != MHASH_EMPTY_SLOT) {
+        *dim = cache->entry_dims[entry];
+        *value = cache->entry_values[entry];
+        return 0;
+    }
+    char text[32];
+    size_t len = (size_t)snprintf(text, sizeof(text), "%lld", (long long)number);
+    return value_cache_miss(cache, entry, text, len, dim, value);
+}
+
+// registers (or, unless delta, replaces) the dictionary entries of a column
+static int load_dictionary(struct ArrowColumn *state, const struct ArrowFile *file) {
+    const struct ArrowArray *values = &file->dictionary_values;
+    struct ValueCache *cache = &state->cache;
+    if (!file->dictionary_delta)
+        cache->entries = 0;
+    size_t first = cache->entries;
+    if (value_cache_reserve(cache, first + values->length))
+        return 2;
+    for (size_t i = 0; i < values->length; ++i) {
+        size_t entry = first + i;
+        if (arrow_is_valid(values, i))
+            cache->entry_texts[entry] = arrow_string(values, file->dictionary_type, i, &cache->entry_lens[entry]);
+        else {
+            cache->entry_texts[entry] = "null";
+            cache->entry_lens[entry] = 4;
+        }
+    }
+    return 0;
+}
+
+static int resolve_null(struct ArrowColumn *state, MHASH_INDEX_UINT *dim, double *value) {
+    if (state->null_resolved) {
+        *dim = state->null_dim;
+        *value = state->null_value;
+        return 0;
+    }
+    int stable;
+    if (value_cache_text(&state->cache, "null", 4, dim, value, &stable))
+        return 2;
+    if (stable) {
+        state->null_resolved = 1;
+        state->null_dim = *dim;
+        state->null_value = *value;
+    }
+    return 0;
+}
+
+// resolves rows [0,n) of a dictionary or boolean column into dims and values
+static int decode_entries(struct ArrowColumn *state, const struct ArrowArray *array, size_t n) {
+    const struct ArrowField *field = state->field;
+    uint32_t *dims = state->dims;
+    double *values = state->values;
+    for (size_t r = 0; r < n; ++r) {
+        MHASH_INDEX_UINT dim;
+        double value;
+        if (!arrow_is_valid(array, r)) {
+            if (resolve_null(state, &dim, &value))
+                return 2;
+        }
+        else {
+            size_t entry;
+            if (state->kind == KIND_BOOL)
+                entry = (array->values[r >> 3] >> (r & 7)) & 1;
+            else {
+                int64_t index = arrow_int(array->values, r, field->index_bit_width, field->index_signed);
+                if (index < 0 || (uint64_t)index >= state->cache.entries) {
+                    fprintf(stderr, "Error: dictionary index out of range in column %s\n", state->cache.name);
+                    return 2;
+                }
+                entry = (size_t)index;
+            }
+            if (value_cache_entry(&state->cache, entry, &dim, &value))
+                return 2;
+        }
+        if (dims)
+            dims[r] = (uint32_t)dim;
+        if (values)
+            values[r] = value;
+    }
+    return 0;
+}
+
+// resolves rows [0,n) of a column whose cells are not dictionary entries
+static int decode_cells(struct ArrowColumn *state, const struct ArrowArray *array, size_t n) {
+    const struct ArrowField *field = state->field;
+    uint32_t *dims = state->dims;
+    double *values = state->values;
+    for (size_t r = 0; r < n; ++r) {
+        MHASH_INDEX_UINT dim = 0;
+        double value;
+        int64_t number = 0;
+        int is_int = field->type == ARROW_TYPE_INT;
+        if (is_int)
+            number = arrow_int(array->values, r, field->bit_width, field->is_signed);
+        if (!arrow_is_valid(array, r)) {
+            if (resolve_null(state, &dim, &value))
+                return 2;
+        }
+        else if (state->kind == KIND_NUMBER)
+            value = is_int ? (double)number : arrow_float(array->values, r, field->bit_width);
+        else if (state->kind == KIND_NUMBER_TEXT && is_int && number >= 0 && number < INT_ENTRIES) {
+            if (value_cache_reserve(&state->cache, (size_t)number + 1) || resolve_int(state, (size_t)number, number, &dim, &value))
+                return 2;
+        }
+        else {
+            char text[32];
+            const char *cell = text;
+            size_t len;
+            int stable;
+            if (state->kind == KIND_TEXT)
+                cell = arrow_string(array, field->type, r, &len);
+            else if (is_int)
+                len = (size_t)snprintf(text, sizeof(text), "%lld", (long long)number);
+            else
+                len = (size_t)snprintf(text, sizeof(text), "%.15g", arrow_float(array->values, r, field->bit_width));
+            if (value_cache_text(&state->cache, cell, len, &dim, &value, &stable))
+                return 2;
+        }
+        if (dims)
+            dims[r] = (uint32_t)dim;
+        if (values)
+            values[r] = value;
+    }
+    return 0;
+}
+
+int accumulate_arrow(
+    struct ArrowFile *file,
+    struct Column *columns,
+    const size_t *handled,
+    size_t handled_count,
+    const size_t *accumulated,
+    size_t accumulated_count,
+    MHASH_INDEX_UINT label_index,
+    const MHASH_INDEX_UINT *predict_indexes,
+    size_t predict_count,
+    MHASH_INDEX_UINT partition_index,
+    struct Column *partition_dict,
+    const char *partition_col,
+    fbt ***partitions,
+    size_t *partition_count,
+    double forget,
+    unsigned long *total_rows
+) {
+    // every column that is read gets a decoding state, and the partition column comes last
+    struct ArrowColumn states[MAX_COLS + 1];
+    size_t state_count = 0;
+    size_t accumulated_pos[MAX_COLS];
+    for (size_t k = 0; k < accumulated_count; ++k)
+        accumulated_pos[accumulated[k]] = k;
+    memset(states, 0, sizeof(states));
+    for (size_t h = 0; h <= handled_count; ++h) {
+        size_t i;
+        if (h < handled_count)
+            i = handled[h];
+        else if (partition_index != MHASH_EMPTY_SLOT)
+            i = partition_index;
+        else
+            break;
+        struct ArrowColumn *state = &states[state_count++];
+        const struct ArrowField *field = &file->fields[i];
+        state->field = field;
+        struct ValueCache *cache = &state->cache;
+        cache->is_partition = h == handled_count;
+        cache->column = cache->is_partition ? partition_dict : &columns[i];
+        cache->name = cache->is_partition ? partition_col : columns[i].name;
+        int is_value = !cache->is_partition && (i == label_index || predict_position(i, predict_indexes, predict_count) < predict_count);
+        cache->value_only = is_value;
+        int status = columns[i].config ? columns[i].config->status : CONFIG_STATUS_AUTO;
+        if (field->dictionary)
+            state->kind = field->type == ARROW_TYPE_UTF8 || field->type == ARROW_TYPE_LARGE_UTF8 ? KIND_DICTIONARY : KIND_SKIP;
+        else if (field->type == ARROW_TYPE_BOOL)
+            state->kind = KIND_BOOL;
+        else if (field->type == ARROW_TYPE_INT || field->type == ARROW_TYPE_FLOAT)
+            state->kind = is_value && (status == CONFIG_STATUS_AUTO || status == CONFIG_STATUS_NUMERIC) ? KIND_NUMBER : KIND_NUMBER_TEXT;
+        else if (field->type == ARROW_TYPE_UTF8 || field->type == ARROW_TYPE_LARGE_UTF8)
+            state->kind = KIND_TEXT;
+        if (state->kind == KIND_SKIP) {
+            fprintf(stderr, "Error: column %s has an Arrow type that cannot be analyzed (skip it with @%s --skip)\n", cache->name, cache->name);
+            return 2;
+        }
+        if (state->kind == KIND_BOOL) {
+            if (value_cache_reserve(cache, BOOL_ENTRIES))
+                return 2;
+            for (size_t e = 0; e < BOOL_ENTRIES; ++e) {
+                cache->entry_texts[e] = e ? "1" : "0";
+                cache->entry_lens[e] = 1;
+            }
+        }
+    }
+
+    uint32_t *codes[MAX_COLS] = {NULL};
+    double *y = NULL, *p[MAX_COLS] = {NULL};
+    uint32_t *partition_dims = NULL;
+    size_t batch_capacity = 0;
+    int kind;
+    for (;;) {
+        if (arrow_next(file, &kind))
+            return 2;
+        if (kind == ARROW_END)
+            break;
+        if (kind == ARROW_DICTIONARY) {
+            for (size_t s = 0; s < state_count; ++s)
+                if (states[s].kind == KIND_DICTIONARY && states[s].field->dictionary_id == file->dictionary_id
+                    && load_dictionary(&states[s], file))
+                    return 2;
+            continue;
+        }
+
+        size_t n = file->batch_length;
+        if (n > batch_capacity) {
+            int failed = 0;
+            for (size_t k = 0; k < accumulated_count; ++k)
+                failed |= !(codes[k] = realloc(codes[k], sizeof(uint32_t) * n));
+            failed |= !(y = realloc(y, sizeof(double) * n));
+            for (size_t k = 0; k < predict_count; ++k)
+                failed |= !(p[k] = realloc(p[k], sizeof(double) * n));
+            failed |= !(partition_dims = realloc(partition_dims, sizeof(uint32_t) * n));
+            if (failed) {
+                fprintf(stderr, "Error: out of memory reading Arrow batches\n");
+                return 2;
+            }
+            batch_capacity = n;
+        }
+        for (size_t s = 0; s < state_count; ++s) {
+            struct ArrowColumn *state = &states[s];
+            size_t i = (size_t)(state->field - file->fields);
+            size_t predictor = predict_position(i, predict_indexes, predict_count);
+            state->dims = state->cache.is_partition ? partition_dims
+                        : (i != label_index && predictor == predict_count) ? codes[accumulated_pos[i]] : NULL;
+            state->values = state->cache.is_partition ? NULL : i == label_index ? y : predictor < predict_count ? p[predictor] : NULL;
+            const struct ArrowArray *array = &file->columns[i];
+            if (state->kind == KIND_DICTIONARY || state->kind == KIND_BOOL
+                    ? decode_entries(state, array, n)
+                    : decode_cells(state, array, n))
+                return 2;
+        }
+        *total_rows += n;
+
+        if (partitions_push_columns(partitions, partition_count, partition_dict,
+                                    partition_index == MHASH_EMPTY_SLOT ? NULL : partition_dims,
+                                    columns, accumulated, accumulated_count, (const uint32_t *const *)codes, y,
+                                    (const double *const *)p, predict_count, n, forget))
+            return 2;
+    }
+
+    for (size_t s = 0; s < state_count; ++s)
+        value_cache_free(&states[s].cache);
+    for (size_t k = 0; k < accumulated_count; ++k)
+        free(codes[k]);
+    free(y);
+    for (size_t k = 0; k < predict_count; ++k)
+        free(p[k]);
+    free(partition_dims);
+    return 0;
+}
@@ -0,0 +1,389 @@
+#include "cache.h"
+#include "mapping.h"
+#include "mhash/mhash_str.h"
+#include <stdlib.h>
+
+#define CACHE_MAGIC "FBTCACHE"
+#define CACHE_VERSION 1
+#define HEADER_SIZE 64
+
+static inline uint64_t load_u64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static inline size_t align8(size_t n) {
+    return (n + 7) & ~(size_t)7;
+}
+
+// --- writing
+
+static void write_bytes(struct CacheWriter *writer, const void *data, size_t len) {
+    if (len && fwrite(data, 1, len, writer->f) != len)
+        writer->failed = 1;
+    writer->offset += len;
+}
+
+static void write_u32(struct CacheWriter *writer, uint32_t v) {
+    write_bytes(writer, &v, 4);
+}
+
+static void write_u64(struct CacheWriter *writer, uint64_t v) {
+    write_bytes(writer, &v, 8);
+}
+
+static void write_padding(struct CacheWriter *writer) {
+    static const uint8_t zeros[8] = {0};
+    write_bytes(writer, zeros, align8((size_t)writer->offset) - (size_t)writer->offset);
+}
+
+static void write_header(struct CacheWriter *writer, uint64_t index_offset, uint64_t dictionary_offset) {
+    write_bytes(writer, CACHE_MAGIC, 8);
+    write_u32(writer, CACHE_VERSION);
+    write_u32(writer, (uint32_t)writer->col_count);
+    write_u64(writer, writer->source_size);
+    write_u64(writer, (uint64_t)writer->source_mtime);
+    write_u64(writer, writer->rows);
+    write_u64(writer, writer->block_count);
+    write_u64(writer, index_offset);
+    write_u64(writer, dictionary_offset);
+}
+
+static int dictionary_grow(struct CacheDictionary *dictionary) {
+    size_t slot_count = dictionary->slot_count ? dictionary->slot_count * 2 : 1024;
+    uint32_t *slots = calloc(slot_count, sizeof(uint32_t));
+    if (!slots)
+        return 2;
+    size_t mask = slot_count - 1;
+    for (size_t e = 0; e < dictionary->entries; ++e) {
+        const char *text = dictionary->bytes + dictionary->offsets[e];
+        size_t len = dictionary->offsets[e + 1] - dictionary->offsets[e];
+        size_t slot = (size_t)mhash_strn_word(text, len, 1) & mask;
+        while (slots[slot])
+            slot = (slot + 1) & mask;
+        slots[slot] = (uint32_t)(e + 1);
+    }
+    free(dictionary->slots);
+    dictionary->slots = slots;
+    dictionary->slot_count = slot_count;
+    return 0;
+}
+
+// finds the code of a cell text, adding it to the dictionary if it is new
+static int dictionary_code(struct CacheDictionary *dictionary, const char *text, size_t len, uint32_t *code) {
+    if (2 * (dictionary->entries + 1) > dictionary->slot_count && dictionary_grow(dictionary))
+        return 2;
+    size_t mask = dictionary->slot_count - 1;
+    size_t slot = (size_t)mhash_strn_word(text, len, 1) & mask;
+    for (; dictionary->slots[slot]; slot = (slot + 1) & mask) {
+        uint32_t e = dictionary->slots[slot] - 1;
+        uint32_t start = dictionary->offsets[e];
+        if (dictionary->offsets[e + 1] - start == len && !memcmp(dictionary->bytes + start, text, len)) {
+            *code = e;
+            return 0;
+        }
+    }
+    if (dictionary->bytes_len + len > UINT32_MAX || dictionary->entries + 2 > UINT32_MAX)
+        return 2;
+    if (dictionary->entries + 2 > dictionary->offset_capacity) {
+        size_t capacity = dictionary->offset_capacity * 2;
+        uint32_t *offsets = realloc(dictionary->offsets, sizeof(uint32_t) * capacity);
+        if (!offsets)
+            return 2;
+        dictionary->offsets = offsets;
+        dictionary->offset_capacity = capacity;
+    }
+    if (dictionary->bytes_len + len > dictionary->bytes_capacity) {
+        size_t capacity = dictionary->bytes_capacity * 2;
+        while (capacity < dictionary->bytes_len + len)
+            capacity *= 2;
+        char *bytes = realloc(dictionary->bytes, capacity);
+        if (!bytes)
+            return 2;
+        dictionary->bytes = bytes;
+        dictionary->bytes_capacity = capacity;
+    }
+    memcpy(dictionary->bytes + dictionary->bytes_len, text, len);
+    dictionary->bytes_len += len;
+    *code = (uint32_t)dictionary->entries++;
+    dictionary->offsets[dictionary->entries] = (uint32_t)dictionary->bytes_len;
+    dictionary->slots[slot] = *code + 1;
+    return 0;
+}
+
+static void write_block(struct CacheWriter *writer) {
+    size_t rows = writer->block_rows;
+    if (!rows)
+        return;
+    size_t stride = 16 + align8(writer->col_count);
+    if (writer->index_len + stride > writer->index_capacity) {
+        size_t capacity = writer->index_capacity ? writer->index_capacity * 2 : stride * 16;
+        uint8_t *index = realloc(writer->index, capacity);
+        if (!index) {
+            writer->failed = 1;
+            return;
+        }
+        writer->index = index;
+        writer->index_capacity = capacity;
+    }
+    uint8_t *record = writer->index + writer->index_len;
+    memset(record, 0, stride);
+    memcpy(record, &writer->offset, 8);
+    uint64_t block_rows = rows;
+    memcpy(record + 8, &block_rows, 8);
+    for (size_t i = 0; i < writer->col_count; ++i) {
+        const uint32_t *codes = writer->codes[i];
+        uint32_t max_code = 0;
+        for (size_t r = 0; r < rows; ++r)
+            max_code = codes[r] > max_code ? codes[r] : max_code;
+        uint8_t width = max_code <= UINT8_MAX ? 1 : max_code <= UINT16_MAX ? 2 : 4;
+        record[16 + i] = width;
+        uint8_t *narrow = writer->narrow;
+        if (width == 1)
+            for (size_t r = 0; r < rows; ++r)
+                narrow[r] = (uint8_t)codes[r];
+        else if (width == 2)
+            for (size_t r = 0; r < rows; ++r) {
+                uint16_t v = (uint16_t)codes[r];
+                memcpy(narrow + r * 2, &v, 2);
+            }
+        else
+            memcpy(narrow, codes, rows * 4);
+        write_bytes(writer, narrow, rows * width);
+        write_padding(writer);
+    }
+    writer->index_len += stride;
+    writer->block_count++;
+    writer->block_rows = 0;
+}
+
+int cache_writer_open(struct CacheWriter *writer, const char *path, const char *source, const char *const *col_names, size_t col_count) {
+    memset(writer, 0, sizeof(struct CacheWriter));
+    if (col_count > CACHE_MAX_COLUMNS) {
+        fprintf(stderr, "Error: too many columns to cache\n");
+        return 2;
+    }
+    if (file_identity(source, &writer->source_size, &writer->source_mtime)) {
+        fprintf(stderr, "Error: could not read the size and time of %s\n", source);
+        return 2;
+    }
+    size_t len = strlen(path);
+    writer->path = malloc(len + 1);
+    writer->tmp_path = malloc(len + 5);
+    writer->narrow = malloc(sizeof(uint32_t) * CACHE_BLOCK_ROWS);
+    int failed = !writer->path || !writer->tmp_path || !writer->narrow;
+    for (size_t i = 0; i < col_count && !failed; ++i) {
+        struct CacheDictionary *dictionary = &writer->dictionaries[i];
+        writer->codes[i] = malloc(sizeof(uint32_t) * CACHE_BLOCK_ROWS);
+        dictionary->offset_capacity = 1024;
+        dictionary->offsets = malloc(sizeof(uint32_t) * dictionary->offset_capacity);
+        dictionary->bytes_capacity = 4096;
+        dictionary->bytes = malloc(dictionary->bytes_capacity);
+        failed = !writer->codes[i] || !dictionary->offsets || !dictionary->bytes || dictionary_grow(dictionary);
+        if (!failed)
+            dictionary->offsets[0] = 0;
+    }
+    writer->col_count = col_count;
+    if (failed) {
+        fprintf(stderr, "Error: out of memory preparing the cache\n");
+        return 2;
+    }
+    memcpy(writer->path, path, len + 1);
+    memcpy(writer->tmp_path, path, len);
+    memcpy(writer->tmp_path + len, ".tmp", 5);
+    writer->f = fopen(writer->tmp_path, "wb");
+    if (!writer->f) {
+        fprintf(stderr, "Error: could not write cache %s\n", writer->tmp_path);
+        return 2;
+    }
+    // the header is rewritten once the counts and offsets are known
+    write_header(writer, 0, 0);
+    for (size_t i = 0; i < col_count; ++i) {
+        size_t name_len = strlen(col_names[i]);
+        write_u32(writer, (uint32_t)name_len);
+        write_bytes(writer, col_names[i], name_len);
+    }
+    write_padding(writer);
+    return 0;
+}
+
+int cache_writer_row(struct CacheWriter *writer, const char *line, const size_t *cell_start, const size_t *cell_len) {
+    size_t r = writer->block_rows;
+    for (size_t i = 0; i < writer->col_count; ++i)
+        if (dictionary_code(&writer->dictionaries[i], line + cell_start[i], cell_len[i], &writer->codes[i][r])) {
+            fprintf(stderr, "Error: out of memory growing the cache dictionaries\n");
+            return 2;
+        }
+    writer->rows++;
+    if (++writer->block_rows == CACHE_BLOCK_ROWS)
+        write_block(writer);
+    return 0;
+}
+
+static void writer_free(struct CacheWriter *writer) {
+    for (size_t i = 0; i < writer->col_count; ++i) {
+        free(writer->dictionaries[i].slots);
+        free(writer->dictionaries[i].offsets);
+        free(writer->dictionaries[i].bytes);
+        free(writer->codes[i]);
+    }
+    free(writer->narrow);
+    free(writer->index);
+    free(writer->path);
+    free(writer->tmp_path);
+}
+
+int cache_writer_close(struct CacheWriter *writer) {
+    write_block(writer);
+    uint64_t index_offset = writer->offset;
+    write_bytes(writer, writer->index, writer->index_len);
+    uint64_t dictionary_offset = writer->offset;
+    for (size_t i = 0; i < writer->col_count; ++i) {
+        const struct CacheDictionary *dictionary = &writer->dictionaries[i];
+        write_u64(writer, dictionary->entries);
+        write_u64(writer, dictionary->bytes_len);
+        write_bytes(writer, dictionary->offsets, sizeof(uint32_t) * (dictionary->entries + 1));
+        write_padding(writer);
+        write_bytes(writer, dictionary->bytes, dictionary->bytes_len);
+        write_padding(writer);
+    }
+    if (fseek(writer->f, 0, SEEK_SET))
+        writer->failed = 1;
+    write_header(writer, index_offset, dictionary_offset);
+    if (fclose(writer->f))
+        writer->failed = 1;
+    int failed = writer->failed;
+    if (!failed) {
+        remove(writer->path);  // rename does not replace existing files on Windows
+        failed = rename(writer->tmp_path, writer->path) != 0;
+    }
+    if (failed) {
+        fprintf(stderr, "Error: could not write cache %s\n", writer->path);
+        remove(writer->tmp_path);
+    }
+    writer_free(writer);
+    return failed ? 2 : 0;
+}
+
+// --- reading
+
+// checks that the mapped cache is complete and consistent, so that reading it needs no further bounds checks
+static int read_layout(struct CacheFile *file, uint64_t index_offset, uint64_t dictionary_offset) {
+    const uint8_t *data = file->data;
+    size_t size = file->size;
+    size_t pos = HEADER_SIZE;
+    for (size_t i = 0; i < file->col_count; ++i) {
+        if (pos + 4 > size)
+            return 1;
+        size_t len = cache_u32(data + pos);
+        if (len > size - pos - 4)
+            return 1;
+        file->columns[i].name = (const char *)data + pos + 4;
+        file->columns[i].name_len = len;
+        pos += 4 + len;
+    }
+    pos = align8(pos);
+
+    if (index_offset > dictionary_offset || dictionary_offset > size || index_offset < pos)
+        return 1;
+    file->index_stride = 16 + align8(file->col_count);
+    if (file->block_count > (dictionary_offset - index_offset) / file->index_stride)
+        return 1;
+    file->index = data + index_offset;
+    uint64_t rows = 0;
+    for (size_t b = 0; b < file->block_count; ++b) {
+        const uint8_t *record = file->index + b * file->index_stride;
+        uint64_t offset = load_u64(record);
+        uint64_t block_rows = load_u64(record + 8);
+        if (offset < pos || !block_rows || block_rows > CACHE_BLOCK_ROWS)
+            return 1;
+        for (size_t i = 0; i < file->col_count; ++i) {
+            uint8_t width = record[16 + i];
+            if (width != 1 && width != 2 && width != 4)
+                return 1;
+            offset += align8((size_t)block_rows * width);
+        }
+        if (offset > index_offset)
+            return 1;
+        pos = (size_t)offset;
+        rows += block_rows;
+    }
+    if (rows != file->rows)
+        return 1;
+
+    pos = (size_t)dictionary_offset;
+    for (size_t i = 0; i < file->col_count; ++i) {
+        struct CacheColumn *column = &file->columns[i];
+        if (pos + 16 > size)
+            return 1;
+        uint64_t entries = load_u64(data + pos);
+        uint64_t bytes_len = load_u64(data + pos + 8);
+        pos += 16;
+        if (entries >= UINT32_MAX || (entries + 1) * 4 > size - pos)
+            return 1;
+        column->entries = (size_t)entries;
+        column->offsets = data + pos;
+        pos = align8(pos + (size_t)(entries + 1) * 4);
+        if (pos > size || bytes_len > size - pos)
+            return 1;
+        column->bytes = (const char *)data + pos;
+        uint32_t previous = 0;
+        for (size_t e = 0; e <= column->entries; ++e) {
+            uint32_t offset = cache_u32(column->offsets + e * 4);
+            if (offset < previous || offset > bytes_len || (e == 0 && offset))
+                return 1;
+            previous = offset;
+        }
+        if (previous != bytes_len)
+            return 1;
+        pos = align8(pos + (size_t)bytes_len);
+    }
+    return 0;
+}
+
+int cache_open(struct CacheFile *file, const char *path, const char *source) {
+    memset(file, 0, sizeof(struct CacheFile));
+    uint64_t source_size;
+    int64_t source_mtime;
+    if (file_identity(source, &source_size, &source_mtime))
+        return 1;
+    if (map_file(path, &file->data, &file->size, &file->mapping))
+        return 1;
+    const uint8_t *data = file->data;
+    int stale = file->size < HEADER_SIZE
+        || memcmp(data, CACHE_MAGIC, 8)
+        || cache_u32(data + 8) != CACHE_VERSION
+        || load_u64(data + 16) != source_size
+        || (int64_t)load_u64(data + 24) != source_mtime;
+    if (!stale) {
+        file->col_count = cache_u32(data + 12);
+        file->rows = load_u64(data + 32);
+        file->block_count = load_u64(data + 40);
+        stale = !file->col_count || file->col_count > CACHE_MAX_COLUMNS
+            || read_layout(file, load_u64(data + 48), load_u64(data + 56));
+    }
+    if (stale) {
+        cache_close(file);
+        return 1;
+    }
+    return 0;
+}
+
+void cache_block(const struct CacheFile *file, size_t block, size_t *rows, const uint8_t **codes, int *widths) {
+    const uint8_t *record = file->index + block * file->index_stride;
+    size_t offset = (size_t)load_u64(record);
+    *rows = (size_t)load_u64(record + 8);
+    for (size_t i = 0; i < file->col_count; ++i) {
+        widths[i] = record[16 + i];
+        codes[i] = file->data + offset;
+        offset += align8(*rows * (size_t)widths[i]);
+    }
+}
+
+void cache_close(struct CacheFile *file) {
+    if (!file->data)
+        return;
+    unmap_file(file->data, file->size, file->mapping);
+    file->data = NULL;
+}
@@ -0,0 +1,120 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/*
+ * Columnar sidecar (.fbc) of a CSV file, written by --cache during a first pass and mapped
+ * into memory by later runs. Each column keeps a dictionary of its distinct cell texts, and
+ * each cell is stored as a code into it. Codes are grouped in blocks of rows, where every
+ * column takes the fewest bytes (1, 2 or 4) that fit its largest code within the block.
+ * The size and modification time of the CSV are recorded, so that stale caches are rebuilt.
+ * Cells are kept as text, so that any later configuration can resolve them differently.
+ *
+ * Layout (little-endian on the platforms fbt is built for, 8-byte aligned sections):
+ *   header     magic, version, column count, source size and mtime, rows, block count,
+ *              offsets of the block index and of the dictionaries
+ *   names      per column, a u32 length and the bytes of its header name
+ *   blocks     per block and column, the codes of its rows
+ *   index      per block, its offset, its rows, and one code width per column
+ *   dicts      per column, the entry count, the byte count, entry count + 1 u32 offsets,
+ *              and the bytes of all entries
+ */
+
+#define CACHE_MAX_COLUMNS 64
+#define CACHE_BLOCK_ROWS 65536
+
+// distinct texts of a column while writing, found through an open-addressing hash table
+struct CacheDictionary {
+    uint32_t *slots;        // entry + 1, or 0 when the slot is empty
+    size_t slot_count;      // a power of two
+    uint32_t *offsets;      // entries + 1 offsets into bytes
+    size_t entries;
+    size_t offset_capacity;
+    char *bytes;
+    size_t bytes_len;
+    size_t bytes_capacity;
+};
+
+struct CacheWriter {
+    FILE *f;
+    char *path;
+    char *tmp_path;         // written first and renamed over path when complete
+    uint64_t source_size;
+    int64_t source_mtime;
+    size_t col_count;
+    struct CacheDictionary dictionaries[CACHE_MAX_COLUMNS];
+    uint32_t *codes[CACHE_MAX_COLUMNS];  // of the block being filled
+    uint8_t *narrow;                     // codes of one column narrowed to their width
+    size_t block_rows;
+    uint64_t rows;
+    uint64_t offset;        // where the next bytes are written
+    uint8_t *index;         // records of the written blocks
+    size_t index_len;
+    size_t index_capacity;
+    uint64_t block_count;
+    int failed;
+};
+
+struct CacheColumn {
+    const char *name;       // points into the mapping, not null-terminated
+    size_t name_len;
+    size_t entries;
+    const uint8_t *offsets; // entries + 1 u32 offsets into bytes
+    const char *bytes;
+};
+
+struct CacheFile {
+    const uint8_t *data;
+    size_t size;
+    void *mapping;
+    size_t col_count;
+    struct CacheColumn columns[CACHE_MAX_COLUMNS];
+    uint64_t rows;
+    uint64_t block_count;
+    const uint8_t *index;
+    size_t index_stride;
+};
+
+// Starts a cache of the CSV file source, whose header has col_count columns. Returns 0 on
+// success and 2 on error (with a message).
+int cache_writer_open(struct CacheWriter *writer, const char *path, const char *source, const char *const *col_names, size_t col_count);
+
+// Adds a row, whose cell i is line[cell_start[i]] with cell_len[i] bytes.
+int cache_writer_row(struct CacheWriter *writer, const char *line, const size_t *cell_start, const size_t *cell_len);
+
+// Writes the remaining rows and the dictionaries, and moves the cache into place.
+int cache_writer_close(struct CacheWriter *writer);
+
+// Maps the cache of the CSV file source. Returns 0 on success, and 1 if the cache is missing,
+// stale or unreadable, so that it should be rebuilt.
+int cache_open(struct CacheFile *file, const char *path, const char *source);
+
+// Finds the rows of a block and, per column, its codes and their width in bytes.
+void cache_block(const struct CacheFile *file, size_t block, size_t *rows, const uint8_t **codes, int *widths);
+
+void cache_close(struct CacheFile *file);
+
+static inline uint32_t cache_code(const uint8_t *codes, int width, size_t i) {
+    if (width == 1)
+        return codes[i];
+    if (width == 2) {
+        uint16_t v;
+        memcpy(&v, codes + i * 2, 2);
+        return v;
+    }
+    uint32_t v;
+    memcpy(&v, codes + i * 4, 4);
+    return v;
+}
+
+static inline uint32_t cache_u32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+#endif // CACHE_H
@@ -0,0 +1,117 @@
+#include "data.h"
+#include "cache.h"
+
+struct CachedColumn {
+    size_t index;
+    struct ValueCache cache;    // the dictionary of the column
+    uint32_t *dims;             // per row of a block, for accumulated columns and the partition
+    double *values;             // per row of a block, for the label and predict columns
+};
+
+// resolves the codes of rows [0,n), with width fixed by the caller so that it is inlined away
+static inline int decode_codes(struct CachedColumn *state, const uint8_t *codes, int width, size_t n) {
+    struct ValueCache *cache = &state->cache;
+    size_t entries = cache->entries;
+    uint32_t *dims = state->dims;
+    double *values = state->values;
+    for (size_t r = 0; r < n; ++r) {
+        uint32_t code = cache_code(codes, width, r);
+        if (code >= entries) {
+            fprintf(stderr, "Error: cached code out of range in column %s\n", cache->name);
+            return 2;
+        }
+        MHASH_INDEX_UINT dim;
+        double value;
+        if (value_cache_entry(cache, code, &dim, &value))
+            return 2;
+        if (dims)
+            dims[r] = (uint32_t)dim;
+        if (values)
+            values[r] = value;
+    }
+    return 0;
+}
+
+int accumulate_cache(
+    struct CacheFile *file,
+    struct Column *columns,
+    const size_t *handled,
+    size_t handled_count,
+    const size_t *accumulated,
+    size_t accumulated_count,
+    MHASH_INDEX_UINT label_index,
+    const MHASH_INDEX_UINT *predict_indexes,
+    size_t predict_count,
+    MHASH_INDEX_UINT partition_index,
+    struct Column *partition_dict,
+    const char *partition_col,
+    fbt ***partitions,
+    size_t *partition_count,
+    double forget,
+    unsigned long *total_rows
+) {
+    // every column that is read gets a dictionary, and the partition column comes last
+    struct CachedColumn states[MAX_COLS + 1];
+    size_t state_count = 0;
+    memset(states, 0, sizeof(states));
+    struct RowBlock block;
+    if (row_block_open(&block, CACHE_BLOCK_ROWS, accumulated_count, predict_count))
+        return 2;
+    size_t accumulated_pos[MAX_COLS];
+    for (size_t k = 0; k < accumulated_count; ++k)
+        accumulated_pos[accumulated[k]] = k;
+    for (size_t h = 0; h <= handled_count; ++h) {
+        size_t i;
+        if (h < handled_count)
+            i = handled[h];
+        else if (partition_index != MHASH_EMPTY_SLOT)
+            i = partition_index;
+        else
+            break;
+        struct CachedColumn *state = &states[state_count++];
+        struct ValueCache *cache = &state->cache;
+        const struct CacheColumn *cached = &file->columns[i];
+        state->index = i;
+        cache->is_partition = h == handled_count;
+        cache->column = cache->is_partition ? partition_dict : &columns[i];
+        cache->name = cache->is_partition ? partition_col : columns[i].name;
+        size_t predictor = predict_position(i, predict_indexes, predict_count);
+        cache->value_only = !cache->is_partition && (i == label_index || predictor < predict_count);
+        state->dims = cache->is_partition ? block.partition_dims
+                    : (i != label_index && predictor == predict_count) ? block.codes[accumulated_pos[i]] : NULL;
+        state->values = cache->is_partition ? NULL : i == label_index ? block.y : predictor < predict_count ? block.p[predictor] : NULL;
+        if (value_cache_reserve(cache, cached->entries))
+            return 2;
+        for (size_t e = 0; e < cached->entries; ++e) {
+            uint32_t start = cache_u32(cached->offsets + e * 4);
+            cache->entry_texts[e] = cached->bytes + start;
+            cache->entry_lens[e] = cache_u32(cached->offsets + e * 4 + 4) - start;
+        }
+    }
+
+    const uint8_t *block_codes[CACHE_MAX_COLUMNS];
+    int widths[CACHE_MAX_COLUMNS];
+    for (size_t b = 0; b < file->block_count; ++b) {
+        size_t n;
+        cache_block(file, b, &n, block_codes, widths);
+        for (size_t s = 0; s < state_count; ++s) {
+            struct CachedColumn *state = &states[s];
+            const uint8_t *column_codes = block_codes[state->index];
+            int width = widths[state->index];
+            if (width == 1 ? decode_codes(state, column_codes, 1, n)
+                : width == 2 ? decode_codes(state, column_codes, 2, n)
+                : decode_codes(state, column_codes, 4, n))
+                return 2;
+        }
+        *total_rows += n;
+        block.n = n;
+        if (row_block_push(&block, partitions, partition_count, partition_index == MHASH_EMPTY_SLOT ? NULL : partition_dict,
+                           columns, accumulated, accumulated_count, predict_count, forget))
+            return 2;
+    }
+
+    for (size_t s = 0; s < state_count; ++s)
+        value_cache_free(&states[s].cache);
+    row_block_free(&block);
+    return 0;
+}
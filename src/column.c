@@ -0,0 +1,613 @@
+#include "data.h"
+#include "numeric.h"
+#include "timestamp.h"
+
+static uint64_t evicted_hash(const char *value, size_t len) {
+    return (uint64_t)mhash_strn_word(value, len, 1);
+}
+
+// whether --max-memory folded the value into [other] earlier
+static int column_was_evicted(const struct Column *column, const char *value, size_t len) {
+    uint64_t hash = evicted_hash(value, len);
+    size_t low = 0, high = column->evicted;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (column->evicted_hashes[mid] < hash)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low < column->evicted && column->evicted_hashes[low] == hash;
+}
+
+// finds the dimension of a categorical value, registering it (and rebuilding the column's mhash) if it is new
+int column_dimension(struct Column *column, const char *col_name, const char *value, size_t len, MHASH_INDEX_UINT *dim) {
+    MHASH_INDEX_UINT dim_idx = mhash_compact_find(&column->map, value, len, (const char *const *)column->dimension_names);
+    if (dim_idx != MHASH_EMPTY_SLOT) {
+        *dim = dim_idx;
+        return 0;
+    }
+    // evicted values are not registered again, so that their rows all stay in [other]
+    if (column->evicted && column_was_evicted(column, value, len)) {
+        *dim = column->other_dim;
+        return 0;
+    }
+    // full columns (see --max-memory) only register their [other] group
+    if (column->full) {
+        if (column->other_dim != MHASH_EMPTY_SLOT) {
+            *dim = column->other_dim;
+            return 0;
+        }
+        value = OTHER_GROUP;
+        len = strlen(OTHER_GROUP);
+        column->other_dim = (MHASH_INDEX_UINT)column->num_dimensions;
+    }
+    column->name_bytes += len + 1;
+    size_t old = column->num_dimensions++;
+    column->dimension_names = realloc(column->dimension_names, sizeof(char*) * column->num_dimensions);
+    column->dimension_names[old] = malloc(len + 1);
+    memcpy(column->dimension_names[old], value, len);
+    column->dimension_names[old][len] = '\0';
+    ++column->rebuilds;
+    if (mhash_compact_build(&column->map,
+                (const char**)column->dimension_names,
+                column->num_dimensions,
+                mhash_strn_word_multi)) {
+        fprintf(stderr, "Error: too many categorical values during column %s\n", col_name);
+        return 2;
+    }
+    *dim = old;
+    return 0;
+}
+
+// starts a column's dimensions from its first encountered value
+int column_first_value(struct Column *column, const char *col_name, const char *value, size_t len) {
+    column->dimension_names = malloc(sizeof(char**));
+    column->num_dimensions = 1;
+    column->name_bytes = len + 1;
+    column->dimension_names[0] = malloc(len + 1);
+    memcpy(column->dimension_names[0], value, len);
+    column->dimension_names[0][len] = '\0';
+    memset(&column->map, 0, sizeof(column->map));
+    ++column->rebuilds;
+    if (mhash_compact_build(&column->map,
+        (const char**) column->dimension_names,
+        1,
+        mhash_strn_word_multi
+    )) {
+        fprintf(stderr, "Error: too many categorical values during column %s\n", col_name);
+        return 2;
+    }
+    //printf("Initialized column %s with first dimension %s\n", col_name, column->dimension_names[0]);
+    return 0;
+}
+
+// --- cell handlers: each resolves one null-terminated cell into the column's active dimension and its explicit value
+
+static int handle_skip(struct Column *column, const char *cell, size_t len, double *value) {
+    (void)column; (void)cell; (void)len; (void)value;
+    return 0;
+}
+
+static int handle_range(struct Column *column, const char *cell, size_t len, double *value) {
+    (void)len;
+    char c = cell[0];
+    char range_start = column->config->range[0];
+    char range_end = column->config->range[1];
+    column->active_dim = (c<range_start || c>range_end)?((MHASH_INDEX_UINT)(range_end-range_start+1)):((MHASH_INDEX_UINT)(c-range_start));
+    *value = 0.0;
+    return 0;
+}
+
+static int handle_numeric(struct Column *column, const char *cell, size_t len, double *value) {
+    int valid;
+    *value = parse_number(cell, len, &valid);
+    column->malformed += (size_t)!valid;
+    return 0;
+}
+
+static int handle_binary(struct Column *column, const char *cell, size_t len, double *value) {
+    (void)len;
+    *value = strcmp(cell, column->config->binary)?0:1;
+    return 0;
+}
+
+// the dimension of a cell of an automatic column, given its lookup in the column's mhash if it
+// was looked up already (MHASH_EMPTY_SLOT otherwise, or if it was not found)
+static int auto_dimension(struct Column *column, const char *cell, size_t len, MHASH_INDEX_UINT found, MHASH_INDEX_UINT *dim) {
+    if(column->num_dimensions >= column->categorical_dimensions) {
+        int is_number;
+        parse_number(cell, len, &is_number);
+        if(is_number) {
+            *dim = 0; // numeric: single global bucket
+            return 0;
+        }
+    }
+    if (found != MHASH_EMPTY_SLOT) {
+        *dim = found;
+        return 0;
+    }
+    return column_dimension(column, column->name, cell, len, dim);
+}
+
+static int handle_auto(struct Column *column, const char *cell, size_t len, double *value) {
+    char c = cell[0];
+    *value = (c=='y' || c=='Y' || c=='1') ? 1.0 : 0.0;
+    return auto_dimension(column, cell, len, MHASH_EMPTY_SLOT, &column->active_dim);
+}
+
+// the first value of an automatic column initializes its mhash and then hands over to handle_auto
+static int handle_auto_first(struct Column *column, const char *cell, size_t len, double *value) {
+    if(column_first_value(column, column->name, cell, len))
+        return 2;
+    column->handle = handle_auto;
+    return handle_auto(column, cell, len, value);
+}
+
+int column_init(struct Column *column, struct Config *config, const char *name, MHASH_INDEX_UINT categorical_dimensions) {
+    memset(column, 0, sizeof(struct Column));
+    column->other_dim = MHASH_EMPTY_SLOT;
+    column->config = config;
+    column->name = name;
+    column->categorical_dimensions = categorical_dimensions;
+    int status = config ? config->status : CONFIG_STATUS_AUTO;
+    if (status == CONFIG_STATUS_AUTO) {
+        column->handle = handle_auto_first;
+        return 0;
+    }
+    // non-automatic columns know their dimensions in advance
+    column->num_dimensions = 1;
+    if (status == CONFIG_STATUS_RANGE) {
+        column->num_dimensions = (size_t)(config->range[1] - config->range[0] + 2); // start..end (inclusive) + 1 for other
+        column->handle = handle_range;
+        column->dimension_names = malloc(sizeof(char*) * column->num_dimensions);
+        if (!column->dimension_names) {
+            fprintf(stderr, "Error: out of memory allocating column %s\n", name);
+            return 2;
+        }
+        for (size_t d = 0; d + 1 < column->num_dimensions; ++d) {
+            char first[2] = {(char)(config->range[0] + (char)d), '\0'};
+            column->dimension_names[d] = xstrdup(first);
+        }
+        column->dimension_names[column->num_dimensions - 1] = xstrdup("other");
+    }
+    else if (status == CONFIG_STATUS_NUMERIC)
+        column->handle = handle_numeric;
+    else if (status == CONFIG_STATUS_BINARY)
+        column->handle = handle_binary;
+    else
+        column->handle = handle_skip;
+    return 0;
+}
+
+#define COLUMN_BATCH_SLOTS (1 << 16)    // mhash slots (256 KiB) beyond which cells are looked up in batches
+
+int column_defers(const struct Column *column) {
+    return column->batched && column->handle == handle_auto && column->map.table_size > COLUMN_BATCH_SLOTS;
+}
+
+int column_is_automatic(const struct Column *column) {
+    return column->handle == handle_auto_first || column->handle == handle_auto;
+}
+
+int column_preload(struct Column *column, char **names, size_t count) {
+    if (column->handle != handle_auto_first || !count)
+        return 0;
+    return column_restore(column, column->name, names, count);
+}
+
+int column_restore(struct Column *column, const char *col_name, char **names, size_t count) {
+    column->dimension_names = names;
+    column->num_dimensions = count;
+    column->name_bytes = 0;
+    for (size_t d = 0; d < count; ++d)
+        column->name_bytes += strlen(names[d]) + 1;
+    memset(&column->map, 0, sizeof(column->map));
+    ++column->rebuilds;
+    if (mhash_compact_build(&column->map, (const char**)names, count, mhash_strn_word_multi)) {
+        fprintf(stderr, "Error: too many (or repeated) categorical values preloaded for column %s\n", col_name);
+        return 2;
+    }
+    if (column->handle == handle_auto_first)
+        column->handle = handle_auto;
+    return 0;
+}
+
+size_t column_memory(const struct Column *column) {
+    return column->name_bytes + sizeof(char*) * column->num_dimensions + sizeof(uint32_t) * column->map.table_size
+         + sizeof(MHASH_INDEX_UINT) * column->bucket_span + sizeof(uint64_t) * column->evicted;
+}
+
+// a group with its samples, by which the groups to keep are chosen
+struct Counted {
+    double count;
+    size_t group;
+};
+
+static int compare_count(const void *a, const void *b) {
+    const struct Counted *ca = (const struct Counted *)a;
+    const struct Counted *cb = (const struct Counted *)b;
+    if (ca->count != cb->count)
+        return ca->count < cb->count ? 1 : -1;
+    return ca->group < cb->group ? -1 : (ca->group > cb->group);
+}
+
+static int compare_hash(const void *a, const void *b) {
+    uint64_t ha = *(const uint64_t *)a;
+    uint64_t hb = *(const uint64_t *)b;
+    return ha < hb ? -1 : ha > hb;
+}
+
+int column_evict(struct Column *column, size_t attribute, fbt *const *partitions, size_t partition_count, size_t *evicted) {
+    *evicted = 0;
+    size_t n = column->num_dimensions;
+    if ((column->handle != handle_auto) || n < 4)
+        return 0;
+    int failed = 2;
+    char *other_name = NULL;
+    MHashCompact map;
+    memset(&map, 0, sizeof(map));
+    struct Counted *counted = calloc(n, sizeof(struct Counted));
+    size_t *mapping = malloc(sizeof(size_t) * n);
+    char **names = malloc(sizeof(char*) * (n + 1));
+    uint64_t *hashes = realloc(column->evicted_hashes, sizeof(uint64_t) * (column->evicted + n));
+    if (hashes)
+        column->evicted_hashes = hashes;
+    if (!counted || !mapping || !names || !hashes
+        || (column->other_dim == MHASH_EMPTY_SLOT && !(other_name = malloc(strlen(OTHER_GROUP) + 1)))) {
+        fprintf(stderr, "Error: out of memory evicting groups of column %s\n", column->name);
+        goto done;
+    }
+    for (size_t d = 0; d < n; ++d)
+        counted[d].group = d;
+    for (size_t p = 0; p < partition_count; ++p) {
+        const struct Attribute *attr = &partitions[p]->attributes[attribute];
+        for (size_t d = 0; d < attr->num_groups && d < n; ++d)
+            counted[d].count += attr->stats[d].count;
+    }
+    // the first group also holds the numbers of the column, [other] is where the rest goes, and
+    // the more frequent half of the groups is kept too (marked with 0 until they are renumbered)
+    qsort(counted, n, sizeof(struct Counted), compare_count);
+    for (size_t d = 0; d < n; ++d)
+        mapping[d] = SIZE_MAX;
+    for (size_t r = 0; r < n / 2; ++r)
+        mapping[counted[r].group] = 0;
+    mapping[0] = 0;
+
+    // kept groups keep their order, and every other group is folded into [other] at the end
+    size_t kept = 0;
+    for (size_t d = 0; d < n; ++d) {
+        if (mapping[d] == SIZE_MAX || d == column->other_dim)
+            continue;
+        mapping[d] = kept;
+        names[kept++] = column->dimension_names[d];
+    }
+    size_t other = kept;
+    if (other_name) {
+        memcpy(other_name, OTHER_GROUP, strlen(OTHER_GROUP) + 1);
+        names[kept++] = other_name;
+    }
+    else
+        names[kept++] = column->dimension_names[column->other_dim];
+    // the mhash is rebuilt from scratch, so that its table shrinks too, and the column is only
+    // changed once it is built
+    ++column->rebuilds;
+    if (mhash_compact_build(&map, (const char**)names, kept, mhash_strn_word_multi)) {
+        fprintf(stderr, "Error: too many categorical values during column %s\n", column->name);
+        goto done;
+    }
+    for (size_t d = 0; d < n; ++d) {
+        if (d == column->other_dim)
+            mapping[d] = other;
+        else if (mapping[d] == SIZE_MAX) {
+            mapping[d] = other;
+            size_t len = strlen(column->dimension_names[d]);
+            column->name_bytes -= len + 1;
+            hashes[column->evicted + *evicted] = evicted_hash(column->dimension_names[d], len);
+            free(column->dimension_names[d]);
+            ++*evicted;
+        }
+    }
+    if (other_name)
+        column->name_bytes += strlen(OTHER_GROUP) + 1;
+    other_name = NULL;
+    free(column->dimension_names);
+    column->dimension_names = names;
+    names = NULL;
+    column->num_dimensions = kept;
+    column->other_dim = (MHASH_INDEX_UINT)other;
+    column->evicted += *evicted;
+    qsort(hashes, column->evicted, sizeof(uint64_t), compare_hash);
+    mhash_compact_free(&column->map);
+    column->map = map;
+    map.table = NULL;
+
+    // a partition that cannot be regrouped fails the run, as its group ids no longer match
+    failed = 0;
+    for (size_t p = 0; p < partition_count && !failed; ++p)
+        failed = fbt_regroup(partitions[p], attribute, mapping, partitions[p]->attributes[attribute].num_groups ? kept : 0);
+done:
+    mhash_compact_free(&map);
+    free(other_name);
+    free(counted);
+    free(mapping);
+    free(names);
+    return failed;
+}
+
+// opens the accumulators of a new partition, with one attribute per accumulated column
+fbt *partition_open(const struct Column *columns, const size_t *accumulated, size_t accumulated_count, double forget) {
+    const char *attribute_names[MAX_COLS];
+    for (size_t k = 0; k < accumulated_count; ++k)
+        attribute_names[k] = columns[accumulated[k]].name;
+    struct fbt_config config;
+    config.attribute_count = accumulated_count;
+    config.attribute_names = attribute_names;
+    config.forget = forget;
+    fbt *partition = fbt_open(&config);
+    if (!partition) {
+        fprintf(stderr, "Error: out of memory allocating accumulators\n");
+        return NULL;
+    }
+    // groups that are already known (e.g., from --char ranges) are reported even if they never occur
+    for (size_t k = 0; k < accumulated_count; ++k)
+        if (fbt_reserve(partition, k, columns[accumulated[k]].num_dimensions)) {
+            fbt_close(partition);
+            return NULL;
+        }
+    return partition;
+}
+
+void partition_buckets(struct Column *partition_dict, int64_t width) {
+    partition_dict->time_bucket = width;
+}
+
+// Records the position of a bucket, growing the span of directly looked up buckets (in both
+// directions, as rows may be out of order) while it stays within MAX_BUCKET_SPAN.
+static void bucket_record(struct Column *partition_dict, int64_t bucket, MHASH_INDEX_UINT pos) {
+    int64_t first = partition_dict->first_bucket;
+    int64_t end = first + (int64_t)partition_dict->bucket_span;
+    if (!partition_dict->bucket_span)
+        first = end = bucket;
+    if (bucket < first || bucket >= end) {
+        int64_t span = end - first;
+        int64_t grown_first = bucket < first ? (bucket < end - 2 * span ? bucket : end - 2 * span) : first;
+        int64_t grown_end = bucket >= end ? (bucket >= first + 2 * span ? bucket + 1 : first + 2 * span) : end;
+        if (grown_end - grown_first > MAX_BUCKET_SPAN)
+            return;
+        MHASH_INDEX_UINT *grown = malloc(sizeof(MHASH_INDEX_UINT) * (size_t)(grown_end - grown_first));
+        if (!grown)
+            return;  // the label is hashed instead
+        for (int64_t b = grown_first; b < grown_end; ++b)
+            grown[b - grown_first] = b >= first && b < end ? partition_dict->bucket_dims[b - first] : MHASH_EMPTY_SLOT;
+        free(partition_dict->bucket_dims);
+        partition_dict->bucket_dims = grown;
+        partition_dict->first_bucket = first = grown_first;
+        partition_dict->bucket_span = (size_t)(grown_end - grown_first);
+    }
+    partition_dict->bucket_dims[bucket - first] = pos;
+}
+
+// finds the position of a --partition value (or of the bucket of a --time-col value), registering it if it is new
+int partition_find(struct Column *partition_dict, const char *col_name, const char *key, size_t len, MHASH_INDEX_UINT *pos) {
+    char label[32];
+    int64_t bucket = 0;
+    if (partition_dict->time_bucket) {
+        int64_t seconds;
+        if (parse_timestamp(key, len, &seconds)) {
+            fprintf(stderr, "Error: could not read timestamp '%.*s' of column %s\n", (int)len, key, col_name);
+            return 2;
+        }
+        bucket = floor_div(seconds, partition_dict->time_bucket);
+        int64_t offset = bucket - partition_dict->first_bucket;
+        if (offset >= 0 && offset < (int64_t)partition_dict->bucket_span && partition_dict->bucket_dims[offset] != MHASH_EMPTY_SLOT) {
+            *pos = partition_dict->bucket_dims[offset];
+            return 0;
+        }
+        len = format_bucket(bucket * partition_dict->time_bucket, partition_dict->time_bucket, label);
+        key = label;
+    }
+    int result;
+    if (partition_dict->num_dimensions == 0) {
+        *pos = 0;
+        result = column_first_value(partition_dict, col_name, key, len);
+    }
+    else
+        result = column_dimension(partition_dict, col_name, key, len, pos);
+    if (partition_dict->time_bucket && !result)
+        bucket_record(partition_dict, bucket, *pos);
+    return result;
+}
+
+// opens accumulators for any partitions registered since the last call
+int partitions_fit(fbt ***partitions, size_t *partition_count, size_t needed,
+                   const struct Column *columns, const size_t *accumulated, size_t accumulated_count, double forget) {
+    if (needed <= *partition_count)
+        return 0;
+    fbt **grown = realloc(*partitions, sizeof(fbt*) * needed);
+    if (!grown) {
+        fprintf(stderr, "Error: out of memory allocating accumulators\n");
+        return 2;
+    }
+    *partitions = grown;
+    for (; *partition_count < needed; ++*partition_count) {
+        grown[*partition_count] = partition_open(columns, accumulated, accumulated_count, forget);
+        if (!grown[*partition_count])
+            return 2;
+    }
+    return 0;
+}
+
+// Resolves a cell given as text through the column's handler. *stable tells whether the same
+// text will always resolve the same way, so that its outcome can be cached. It will not for
+// numbers of automatic columns that still take new categories (they later fall to the single
+// numeric bucket), nor for malformed --numeric cells, which are counted each time. Values
+// alone depend on the text only, so the former holds for value_only caches.
+int value_cache_text(struct ValueCache *cache, const char *text, size_t len, MHASH_INDEX_UINT *dim, double *value, int *stable) {
+    char cell[MAX_STR_LEN];
+    if (len >= MAX_STR_LEN - 1) {
+        fprintf(stderr, "Error: column value too large\n");
+        return 2;
+    }
+    memcpy(cell, text, len);
+    cell[len] = '\0';
+    *value = 0.0;
+    *stable = 1;
+    if (cache->is_partition)
+        return partition_find(cache->column, cache->name, cell, len, dim);
+    struct Column *column = cache->column;
+    int status = column->config ? column->config->status : CONFIG_STATUS_AUTO;
+    if ((status == CONFIG_STATUS_AUTO && !cache->value_only && column->num_dimensions < column->categorical_dimensions)
+        || status == CONFIG_STATUS_NUMERIC) {
+        int is_number;
+        parse_number(cell, len, &is_number);
+        *stable = status == CONFIG_STATUS_NUMERIC ? is_number : !is_number;
+    }
+    if (column->handle(column, cell, len, value))
+        return 2;
+    *dim = column->active_dim;
+    return 0;
+}
+
+int value_cache_miss(struct ValueCache *cache, size_t entry, const char *text, size_t len, MHASH_INDEX_UINT *dim, double *value) {
+    int stable;
+    if (value_cache_text(cache, text, len, dim, value, &stable))
+        return 2;
+    if (stable) {
+        cache->entry_dims[entry] = *dim;
+        cache->entry_values[entry] = *value;
+    }
+    return 0;
+}
+
+// makes room for count entries, marking new ones as unresolved
+int value_cache_reserve(struct ValueCache *cache, size_t count) {
+    if (count <= cache->entries)
+        return 0;
+    if (count > cache->capacity) {
+        size_t capacity = cache->capacity ? cache->capacity : 16;
+        while (capacity < count)
+            capacity *= 2;
+        cache->entry_dims = realloc(cache->entry_dims, sizeof(MHASH_INDEX_UINT) * capacity);
+        cache->entry_values = realloc(cache->entry_values, sizeof(double) * capacity);
+        cache->entry_texts = realloc(cache->entry_texts, sizeof(char*) * capacity);
+        cache->entry_lens = realloc(cache->entry_lens, sizeof(size_t) * capacity);
+        if (!cache->entry_dims || !cache->entry_values || !cache->entry_texts || !cache->entry_lens) {
+            fprintf(stderr, "Error: out of memory caching column values\n");
+            return 2;
+        }
+        cache->capacity = capacity;
+    }
+    for (; cache->entries < count; ++cache->entries)
+        cache->entry_dims[cache->entries] = MHASH_EMPTY_SLOT;
+    return 0;
+}
+
+void value_cache_free(struct ValueCache *cache) {
+    free(cache->entry_dims);
+    free(cache->entry_values);
+    free(cache->entry_texts);
+    free(cache->entry_lens);
+}
+
+int row_block_open(struct RowBlock *block, size_t capacity, size_t accumulated_count, size_t predict_count) {
+    memset(block, 0, sizeof(*block));
+    block->capacity = capacity;
+    block->y = malloc(sizeof(double) * capacity);
+    block->partition_dims = malloc(sizeof(uint32_t) * capacity);
+    int failed = !block->y || !block->partition_dims;
+    for (size_t k = 0; k < predict_count; ++k)
+        failed |= !(block->p[k] = malloc(sizeof(double) * capacity));
+    for (size_t k = 0; k < accumulated_count; ++k)
+        failed |= !(block->codes[k] = malloc(sizeof(uint32_t) * capacity));
+    if (failed) {
+        fprintf(stderr, "Error: out of memory allocating row blocks\n");
+        row_block_free(block);
+        return 2;
+    }
+    return 0;
+}
+
+void row_block_free(struct RowBlock *block) {
+    for (size_t k = 0; k < MAX_COLS; ++k) {
+        free(block->codes[k]);
+        free(block->p[k]);
+    }
+    free(block->y);
+    free(block->partition_dims);
+    free(block->cells);
+    memset(block, 0, sizeof(*block));
+}
+
+int row_block_defer(struct RowBlock *block, size_t k, size_t r, const char *cell, size_t len) {
+    if (block->cells_used + len + 1 > block->cells_capacity) {
+        size_t capacity = block->cells_capacity ? block->cells_capacity : 4096;
+        while (capacity < block->cells_used + len + 1)
+            capacity *= 2;
+        char *cells = realloc(block->cells, capacity);
+        if (!cells) {
+            fprintf(stderr, "Error: out of memory allocating row blocks\n");
+            return 2;
+        }
+        block->cells = cells;
+        block->cells_capacity = capacity;
+    }
+    memcpy(block->cells + block->cells_used, cell, len);
+    block->cells[block->cells_used + len] = '\0';
+    block->codes[k][r] = (uint32_t)block->cells_used;
+    block->cells_used += len + 1;
+    ++block->deferred[k];
+    return 0;
+}
+
+int row_block_resolve(struct RowBlock *block, struct Column *columns, const size_t *accumulated, size_t accumulated_count) {
+    const char *cells[MHASH_BATCH];
+    size_t lens[MHASH_BATCH];
+    MHASH_INDEX_UINT found[MHASH_BATCH];
+    for (size_t k = 0; k < accumulated_count; ++k) {
+        if (!block->deferred[k])
+            continue;
+        struct Column *column = &columns[accumulated[k]];
+        uint32_t *codes = block->codes[k];
+        for (size_t start = block->n - block->deferred[k]; start < block->n; start += MHASH_BATCH) {
+            size_t count = block->n - start < MHASH_BATCH ? block->n - start : MHASH_BATCH;
+            for (size_t i = 0; i < count; ++i) {
+                cells[i] = block->cells + codes[start + i];
+                lens[i] = strlen(cells[i]);
+            }
+            // cells registered by this batch only append dimensions, so that earlier lookups stay valid
+            mhash_compact_find_batch(&column->map, cells, lens, count, (const char *const *)column->dimension_names, found);
+            for (size_t i = 0; i < count; ++i) {
+                MHASH_INDEX_UINT dim;
+                if (auto_dimension(column, cells[i], lens[i], found[i], &dim))
+                    return 2;
+                codes[start + i] = (uint32_t)dim;
+            }
+        }
+        block->deferred[k] = 0;
+    }
+    block->cells_used = 0;
+    return 0;
+}
+
+// accumulates n decoded rows, whole columns at a time unless --partition splits them row by row
+int partitions_push_columns(fbt ***partitions, size_t *partition_count, const struct Column *partition_dict, const uint32_t *partition_dims,
+                            const struct Column *columns, const size_t *accumulated, size_t accumulated_count,
+                            const uint32_t *const *codes, const double *y, const double *const *p, size_t predict_count, size_t n, double forget) {
+    if (!partition_dims) {
+        for (size_t k = 0; k < predict_count; ++k)
+            if (fbt_push_columns((*partitions)[k], codes, y, p[k], n))
+                return 2;
+        return 0;
+    }
+    if (partitions_fit(partitions, partition_count, partition_dict->num_dimensions, columns, accumulated, accumulated_count, forget))
+        return 2;
+    size_t group_ids[MAX_COLS];
+    for (size_t r = 0; r < n; ++r) {
+        for (size_t k = 0; k < accumulated_count; ++k)
+            group_ids[k] = codes[k][r];
+        if (fbt_push((*partitions)[partition_dims[r]], group_ids, y[r], p[0][r]))
+            return 2;
+    }
+    return 0;
+}
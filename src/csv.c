@@ -0,0 +1,152 @@
+#include "data.h"
+
+#ifdef __SSE2__
+  #include <emmintrin.h>
+#endif
+
+#define CHUNK 64
+#define MAX_CHUNKS (MAX_LINE_SIZE / CHUNK + 1)
+
+// bits of the bytes of a 64-byte chunk that are double quotes or delimiters
+static inline void chunk_masks(const char *p, char delimiter, uint64_t *quotes, uint64_t *delimiters) {
+#ifdef __SSE2__
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i delim = _mm_set1_epi8(delimiter);
+    uint64_t q = 0, d = 0;
+    for (int k = 0; k < CHUNK / 16; ++k) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + 16 * k));
+        q |= (uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, quote)) << (16 * k);
+        d |= (uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, delim)) << (16 * k);
+    }
+    *quotes = q;
+    *delimiters = d;
+#else
+    uint64_t q = 0, d = 0;
+    for (int j = 0; j < CHUNK; ++j) {
+        q |= (uint64_t)(p[j] == '"') << j;
+        d |= (uint64_t)(p[j] == delimiter) << j;
+    }
+    *quotes = q;
+    *delimiters = d;
+#endif
+}
+
+// sets each bit to the parity of the set bits up to and including it, i.e., marks the bytes
+// from an opening quote up to (but not including) its closing quote
+static inline uint64_t prefix_xor(uint64_t m) {
+    m ^= m << 1;
+    m ^= m << 2;
+    m ^= m << 4;
+    m ^= m << 8;
+    m ^= m << 16;
+    m ^= m << 32;
+    return m;
+}
+
+static inline int lowest_bit(uint64_t m) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(m);
+#else
+    int i = 0;
+    while (!(m & 1)) {
+        m >>= 1;
+        ++i;
+    }
+    return i;
+#endif
+}
+
+static inline int is_blank(char c) {
+    return c == ' ' || c == '\r' || c == '\n' || c == '\'';
+}
+
+// trims and unquotes the cell line[start,end) in place, doubled quotes within quotes standing for one
+static int finish_cell(char *line, size_t start, size_t end, size_t *cell_start, size_t *cell_len) {
+    while (start < end && is_blank(line[start]))
+        ++start;
+    size_t out = end;
+    size_t kept = start;  // blanks up to here were quoted and are kept
+    if (memchr(line + start, '"', end - start)) {
+        int quoted = 0;
+        out = start;
+        for (size_t i = start; i < end; ++i) {
+            char c = line[i];
+            if (c != '"')
+                line[out++] = c;
+            else if (quoted && i + 1 < end && line[i + 1] == '"') {
+                line[out++] = '"';
+                ++i;
+            }
+            else {
+                quoted = !quoted;
+                kept = out;
+            }
+        }
+    }
+    while (out > kept && is_blank(line[out - 1]))
+        --out;
+    if (out <= start) {
+        fprintf(stderr, "Error: empty_column\n");
+        return 2;
+    }
+    if (out - start >= MAX_STR_LEN - 1) {
+        fprintf(stderr, "Error: column value too large\n");
+        return 2;
+    }
+    line[out] = '\0';
+    *cell_start = start;
+    *cell_len = out - start;
+    return 0;
+}
+
+int csv_split(char *line, size_t len, char delimiter, size_t *cell_start, size_t *cell_len, size_t max_cells, size_t *cell_count) {
+    if (len > MAX_LINE_SIZE) {
+        fprintf(stderr, "Error: row too large\n");
+        return 2;
+    }
+    // first pass: delimiters outside quotes, found 64 bytes at a time without branching on
+    // quotes, so that the line is left untouched if its last quoted cell continues on the next line
+    uint64_t separators[MAX_CHUNKS];
+    size_t chunks = (len + CHUNK - 1) / CHUNK;
+    uint64_t inside = 0;  // all ones while a quoted cell continues from the previous chunk
+    for (size_t c = 0; c < chunks; ++c) {
+        uint64_t quotes, delimiters;
+        size_t offset = c * CHUNK;
+        if (offset + CHUNK <= len)
+            chunk_masks(line + offset, delimiter, &quotes, &delimiters);
+        else {
+            char tail[CHUNK];
+            memset(tail, 0, sizeof(tail));
+            memcpy(tail, line + offset, len - offset);
+            chunk_masks(tail, delimiter, &quotes, &delimiters);
+            if (!delimiter)
+                delimiters &= (((uint64_t)1) << (len - offset)) - 1;
+        }
+        uint64_t quoted = prefix_xor(quotes) ^ inside;
+        separators[c] = delimiters & ~quoted;
+        inside = (uint64_t)0 - (quoted >> 63);
+    }
+    if (inside)
+        return CSV_OPEN_QUOTE;
+
+    // second pass: cells between separators
+    size_t count = 0, start = 0;
+    for (size_t c = 0; c < chunks && count < max_cells; ++c) {
+        uint64_t m = separators[c];
+        while (m && count < max_cells) {
+            size_t end = c * CHUNK + (size_t)lowest_bit(m);
+            m &= m - 1;
+            if (finish_cell(line, start, end, &cell_start[count], &cell_len[count]))
+                return 2;
+            ++count;
+            start = end + 1;
+        }
+    }
+    if (count < max_cells) {
+        if (finish_cell(line, start, len, &cell_start[count], &cell_len[count]))
+            return 2;
+        ++count;
+    }
+    *cell_count = count;
+    return 0;
+}
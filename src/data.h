@@ -1,9 +1,13 @@
 #ifndef DATA_H
 #define DATA_H
 
+#include <stdio.h>
 #include <stdlib.h>
+#include "fbt.h"
+#include "fbt_internal.h"
 #include "mhash/mhash.h"
 #include "mhash/mhash_str.h"
+#include "mhash/mhash_compact.h"
 
 #define MAX_COLS 64
 #define MAX_STR_LEN 128
@@ -26,34 +30,229 @@ struct Config {
     };
 };
 
-struct Stats {
-    double tp;
-    double tn;
-    double positives;
-    double labels;
-    double count;
-};
+struct Column;
+typedef int (*cell_handler)(struct Column *column, const char *cell, size_t len, double *value);
 
 struct Column {
-    MHash map;
+    MHashCompact map;
     size_t num_dimensions;
     MHASH_INDEX_UINT active_dim;
     char** dimension_names;
-    struct Stats *stats;
     struct Config *config;
+    size_t malformed;   // --numeric cells that could not be parsed (and were read as 0)
+    cell_handler handle; // chosen once from the config by column_init
+    const char *name;
+    MHASH_INDEX_UINT categorical_dimensions;
+    size_t name_bytes;  // of the dimension names, for --max-memory
+    int full;           // new values go to the [other] group until --max-memory frees room
+    MHASH_INDEX_UINT other_dim; // the [other] group, or MHASH_EMPTY_SLOT until groups are folded into it
+    size_t evicted;     // groups folded into [other] by --max-memory
+    uint64_t *evicted_hashes; // sorted hashes of the names of those groups, whose values stay in [other]
+    size_t rebuilds;    // of the mhash, for --metrics
+    int batched;        // accumulated through row blocks, which may look up its cells in batches (see column_defers)
+    // --time-col: partition dictionaries whose keys are timestamps cut into buckets of this
+    // many seconds (0 otherwise), with the position of each bucket from first_bucket on, or
+    // MHASH_EMPTY_SLOT for buckets not met yet
+    int64_t time_bucket;
+    int64_t first_bucket;
+    MHASH_INDEX_UINT *bucket_dims;
+    size_t bucket_span;
+};
+
+#define MAX_BUCKET_SPAN (1 << 20)   // buckets looked up directly, beyond which their labels are hashed
+
+#define OTHER_GROUP "[other]"
+
+#define CSV_OPEN_QUOTE 3   // the line ends within a quoted cell, which continues on the next line
+
+// Splits line[0,len) at the delimiters that are outside double quotes (RFC 4180), so that quoted
+// cells may contain delimiters, newlines and doubled "" quotes. Cells are trimmed of surrounding
+// spaces, line endings and single quotes, unquoted in place and null-terminated, and at most
+// max_cells of them are kept. Returns 0 on success, CSV_OPEN_QUOTE without changing the line
+// if it needs its continuation, and 2 on error (with a message).
+int csv_split(char *line, size_t len, char delimiter, size_t *cell_start, size_t *cell_len, size_t max_cells, size_t *cell_count);
+
+// Sets up a column for its config (NULL for automatic columns). Returns 0 on success and 2 on
+// error (with a message).
+int column_init(struct Column *column, struct Config *config, const char *name, MHASH_INDEX_UINT categorical_dimensions);
+int column_first_value(struct Column *column, const char *col_name, const char *value, size_t len);
+int column_dimension(struct Column *column, const char *col_name, const char *value, size_t len, MHASH_INDEX_UINT *dim);
+
+// whether the column finds its groups among the values it meets (i.e., has no other config)
+int column_is_automatic(const struct Column *column);
+
+// Registers the given values (taking ownership of the array and its strings) before any
+// cell of an automatic column is read, building its mhash once. Other columns are left
+// untouched. Returns 0 on success.
+int column_preload(struct Column *column, char **names, size_t count);
+
+// Registers the given groups (taking ownership like column_preload) of a column that has none
+// yet, whether automatic or a partition dictionary. Returns 0 on success.
+int column_restore(struct Column *column, const char *col_name, char **names, size_t count);
+
+// Preloads the values saved by dict_save (see --dict) into the automatic columns, if the
+// file exists. Returns 0 on success and 2 on error (with a message).
+int dict_load(const char *path, struct Column *columns, size_t col_count);
+
+// Saves the values of the automatic columns, in the order of their groups.
+int dict_save(const char *path, const struct Column *columns, size_t col_count);
+
+// bytes held by the dimension names of a column and their mhash
+size_t column_memory(const struct Column *column);
+
+// Folds the less frequent half of the groups of an automatic column (the one accumulated as
+// the given attribute of the partitions) into its [other] group, and sets *evicted to the
+// number of groups folded (0 if the column has too few groups). Their values go to [other]
+// from then on. Returns 0 on success.
+int column_evict(struct Column *column, size_t attribute, fbt *const *partitions, size_t partition_count, size_t *evicted);
+
+fbt *partition_open(const struct Column *columns, const size_t *accumulated, size_t accumulated_count, double forget);
+int partition_find(struct Column *partition_dict, const char *col_name, const char *key, size_t len, MHASH_INDEX_UINT *pos);
+
+// Makes the keys of a partition dictionary timestamps (see timestamp.h), which partition_find
+// maps to the label of their bucket of the given width in seconds.
+void partition_buckets(struct Column *partition_dict, int64_t width);
+int partitions_fit(fbt ***partitions, size_t *partition_count, size_t needed,
+                   const struct Column *columns, const size_t *accumulated, size_t accumulated_count, double forget);
+
+// accumulates n decoded rows, given as one group code column per accumulated column, into
+// the partition of each row (when partition_dims is not NULL, with a single predictor), or
+// with the predictions p[k] of each of the predict_count predictors into partition k
+int partitions_push_columns(fbt ***partitions, size_t *partition_count, const struct Column *partition_dict, const uint32_t *partition_dims,
+                            const struct Column *columns, const size_t *accumulated, size_t accumulated_count,
+                            const uint32_t *const *codes, const double *y, const double *const *p, size_t predict_count, size_t n, double forget);
+
+#define ROW_BLOCK_ROWS 1024
+
+// Rows decoded column by column, i.e., one group code column per accumulated column, the labels,
+// one prediction column per predict column, and the partition of each row. Inputs fill blocks
+// row by row or column by column and hand them over whole to partitions_push_columns, so that
+// accumulation runs in tight per-column loops away from parsing.
+struct RowBlock {
+    uint32_t *codes[MAX_COLS];
+    double *y;
+    double *p[MAX_COLS];
+    uint32_t *partition_dims;
+    size_t n;
+    size_t capacity;
+    // cells that row_block_defer copied until the block is accumulated, and how many of the last
+    // rows of each code column hold the offsets of such cells instead of group codes
+    char *cells;
+    size_t cells_used;
+    size_t cells_capacity;
+    size_t deferred[MAX_COLS];
+};
+
+// Allocates a block of capacity rows. Returns 0 on success and 2 on error (with a message).
+int row_block_open(struct RowBlock *block, size_t capacity, size_t accumulated_count, size_t predict_count);
+void row_block_free(struct RowBlock *block);
+
+// Whether the cells of a column are left for row_block_resolve instead of being handled row by
+// row: automatic columns accumulated through row blocks whose mhash outgrew the cache, so that
+// most lookups would wait for memory one after the other. Once a column defers, it keeps
+// deferring until the block is accumulated, as only resolving its cells grows its mhash.
+int column_defers(const struct Column *column);
+
+// Copies the cell of row r for code column k of the block, to be resolved with the others.
+// Returns 0 on success and 2 on error (with a message).
+int row_block_defer(struct RowBlock *block, size_t k, size_t r, const char *cell, size_t len);
+
+// Resolves the deferred cells of each code column into group codes, looked up MHASH_BATCH at a
+// time so that the cache misses of a batch overlap. Cells that are not found are registered in
+// row order, as handling them row by row would. Returns 0 on success and 2 on error (with a
+// message).
+int row_block_resolve(struct RowBlock *block, struct Column *columns, const size_t *accumulated, size_t accumulated_count);
+
+// accumulates and empties the block, with rows split by partition_dims if partition_dict is not NULL
+static inline int row_block_push(struct RowBlock *block, fbt ***partitions, size_t *partition_count, const struct Column *partition_dict,
+                                 struct Column *columns, const size_t *accumulated, size_t accumulated_count, size_t predict_count, double forget) {
+    if (row_block_resolve(block, columns, accumulated, accumulated_count))
+        return 2;
+    size_t n = block->n;
+    block->n = 0;
+    return partitions_push_columns(partitions, partition_count, partition_dict, partition_dict ? block->partition_dims : NULL,
+                                   columns, accumulated, accumulated_count, (const uint32_t *const *)block->codes, block->y,
+                                   (const double *const *)block->p, predict_count, n, forget);
+}
+
+// position of column i among the predict columns, or predict_count if it is not one of them
+static inline size_t predict_position(size_t i, const MHASH_INDEX_UINT *predict_indexes, size_t predict_count) {
+    size_t k = 0;
+    while (k < predict_count && predict_indexes[k] != i)
+        ++k;
+    return k;
+}
+
+// distinct cells of a column in a columnar input (e.g., dictionary entries), each resolved
+// through the column's handler the first time a cell refers to it
+struct ValueCache {
+    struct Column *column;      // whose handler resolves cells, or the --partition dictionary
+    const char *name;
+    int is_partition;
+    int value_only;             // of the label and predict columns, whose dimensions are never read
+    MHASH_INDEX_UINT *entry_dims;
+    double *entry_values;
+    const char **entry_texts;
+    size_t *entry_lens;
+    size_t entries;
+    size_t capacity;
 };
 
-int print_report(
-    const struct Column *columns,
-    const char **col_names,
-    size_t col_count, 
-    MHASH_INDEX_UINT predict_index, 
+int value_cache_text(struct ValueCache *cache, const char *text, size_t len, MHASH_INDEX_UINT *dim, double *value, int *stable);
+int value_cache_miss(struct ValueCache *cache, size_t entry, const char *text, size_t len, MHASH_INDEX_UINT *dim, double *value);
+int value_cache_reserve(struct ValueCache *cache, size_t count);
+void value_cache_free(struct ValueCache *cache);
+
+// resolves an entry, whose text is only read the first time
+static inline int value_cache_entry(struct ValueCache *cache, size_t entry, MHASH_INDEX_UINT *dim, double *value) {
+    if (cache->entry_dims[entry] != MHASH_EMPTY_SLOT) {
+        *dim = cache->entry_dims[entry];
+        *value = cache->entry_values[entry];
+        return 0;
+    }
+    return value_cache_miss(cache, entry, cache->entry_texts[entry], cache->entry_lens[entry], dim, value);
+}
+
+// reads a mapped Arrow IPC input to its end, resolving cells through the columns into the partitions
+struct ArrowFile;
+int accumulate_arrow(
+    struct ArrowFile *file,
+    struct Column *columns,
+    const size_t *handled,
+    size_t handled_count,
+    const size_t *accumulated,
+    size_t accumulated_count,
+    MHASH_INDEX_UINT label_index,
+    const MHASH_INDEX_UINT *predict_indexes,
+    size_t predict_count,
+    MHASH_INDEX_UINT partition_index,
+    struct Column *partition_dict,
+    const char *partition_col,
+    fbt ***partitions,
+    size_t *partition_count,
+    double forget,
+    unsigned long *total_rows
+);
+
+// reads all blocks of a mapped --cache, resolving each distinct cell once through the columns
+struct CacheFile;
+int accumulate_cache(
+    struct CacheFile *file,
+    struct Column *columns,
+    const size_t *handled,
+    size_t handled_count,
+    const size_t *accumulated,
+    size_t accumulated_count,
     MHASH_INDEX_UINT label_index,
-    size_t min_samples,
-    size_t total_rows,
-    double threshold,
-    int show_bars,
-    int show_details
+    const MHASH_INDEX_UINT *predict_indexes,
+    size_t predict_count,
+    MHASH_INDEX_UINT partition_index,
+    struct Column *partition_dict,
+    const char *partition_col,
+    fbt ***partitions,
+    size_t *partition_count,
+    double forget,
+    unsigned long *total_rows
 );
 
 
@@ -0,0 +1,105 @@
+#include "data.h"
+#include "numeric.h"
+
+/*
+ * --dict file: the categories of automatic columns, saved at the end of a run and registered
+ * at the start of the next one, so that each column's mhash is built once with its final size
+ * and groups keep their order across runs. Each line holds a column name, a tab, and one of
+ * its values, in the order the values were first met. Values that span lines are not saved,
+ * and neither are the numbers of columns with --numbers groups or more, since preloading them
+ * would send every number of the next run to the numeric bucket from its first row on.
+ */
+
+// collected values of one column while loading
+struct DictValues {
+    char **names;
+    size_t count;
+    size_t capacity;
+};
+
+int dict_load(const char *path, struct Column *columns, size_t col_count) {
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return 0;  // the first run creates the dictionary
+    struct DictValues loaded[MAX_COLS];
+    memset(loaded, 0, sizeof(loaded));
+    char line[MAX_LINE_SIZE];
+    int failed = 0;
+    while (!failed && fgets(line, sizeof(line), f)) {
+        size_t len = strlen(line);
+        if (len && line[len - 1] == '\n')
+            line[--len] = '\0';
+        char *tab = strchr(line, '\t');
+        if (!tab || tab[1] == '\0')
+            continue;
+        *tab = '\0';
+        size_t i = 0;
+        while (i < col_count && strcmp(columns[i].name, line))
+            ++i;
+        if (i == col_count)
+            continue;  // the column is no longer in the header
+        struct DictValues *values = &loaded[i];
+        if (values->count == values->capacity) {
+            size_t capacity = values->capacity ? values->capacity * 2 : 16;
+            char **names = realloc(values->names, sizeof(char*) * capacity);
+            if (!names) {
+                fprintf(stderr, "Error: out of memory loading dictionary %s\n", path);
+                failed = 1;
+                break;
+            }
+            values->names = names;
+            values->capacity = capacity;
+        }
+        values->names[values->count++] = xstrdup(tab + 1);
+    }
+    fclose(f);
+    for (size_t i = 0; i < col_count; ++i) {
+        if (!failed && loaded[i].count && column_preload(&columns[i], loaded[i].names, loaded[i].count))
+            failed = 1;
+        else if (failed || !loaded[i].count || columns[i].dimension_names != loaded[i].names) {
+            for (size_t v = 0; v < loaded[i].count; ++v)
+                free(loaded[i].names[v]);
+            free(loaded[i].names);
+        }
+    }
+    return failed ? 2 : 0;
+}
+
+int dict_save(const char *path, const struct Column *columns, size_t col_count) {
+    size_t len = strlen(path);
+    char *tmp_path = malloc(len + 5);
+    if (!tmp_path) {
+        fprintf(stderr, "Error: out of memory\n");
+        return 2;
+    }
+    memcpy(tmp_path, path, len);
+    memcpy(tmp_path + len, ".tmp", 5);
+    FILE *f = fopen(tmp_path, "w");
+    int failed = !f;
+    for (size_t i = 0; i < col_count && !failed; ++i) {
+        const struct Column *column = &columns[i];
+        if (!column_is_automatic(column))
+            continue;
+        int numeric = column->num_dimensions >= column->categorical_dimensions;
+        for (size_t d = 0; d < column->num_dimensions; ++d) {
+            const char *name = column->dimension_names[d];
+            int is_number = 0;
+            if (numeric)
+                parse_number(name, strlen(name), &is_number);
+            if (d != column->other_dim && !is_number && !strchr(name, '\n'))
+                fprintf(f, "%s\t%s\n", column->name, name);
+        }
+    }
+    if (f && (ferror(f) | fclose(f)))
+        failed = 1;
+    if (!failed) {
+        remove(path);  // rename does not replace existing files on Windows
+        failed = rename(tmp_path, path) != 0;
+    }
+    if (failed) {
+        fprintf(stderr, "Error: could not write dictionary %s\n", path);
+        remove(tmp_path);
+    }
+    free(tmp_path);
+    return failed ? 2 : 0;
+}
@@ -0,0 +1,138 @@
+#ifndef FBT_H
+#define FBT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * libfbt holds the accumulators and report of fbt, so that programs can update fairness
+ * stats in-process instead of formatting CSV rows for the command line tool. Each pushed
+ * sample carries one group id per attribute (e.g., the index of its gender and of its age
+ * range) together with its label y and prediction p, both in [0,1]. Group ids are small
+ * dense integers chosen by the caller, and the accumulators of an attribute grow to fit
+ * the largest id pushed so far.
+ */
+
+#define FBT_METRIC_ACC 0
+#define FBT_METRIC_TPR 1
+#define FBT_METRIC_TNR 2
+#define FBT_METRIC_PR 3
+#define FBT_NUM_METRICS 4
+
+struct fbt_config {
+    size_t attribute_count;             // group ids per pushed sample
+    const char *const *attribute_names; // optional, one per attribute (copied)
+    double forget;                      // forget rate in (0,1] applied per sample, or 0 to weigh all samples equally
+};
+
+struct fbt_stats {
+    double tp;
+    double tn;
+    double positives;
+    double labels;
+    double count;
+};
+
+struct fbt_summary {
+    double min[FBT_NUM_METRICS];
+    double max[FBT_NUM_METRICS];
+    double wmean[FBT_NUM_METRICS];
+    double diff_fair[FBT_NUM_METRICS];
+    double abs_fair[FBT_NUM_METRICS];
+};
+
+struct fbt_report_options {
+    size_t min_samples;  // groups with fewer samples are left out
+    double threshold;    // values below it are violations (and red), values above 1-threshold are green
+    int show_bars;
+    int show_details;    // also print the metrics of each group
+    const char *const *const *group_names; // optional, group_names[attribute][group id]; groups are otherwise shown by id
+    size_t worst;        // if not 0, only the groups furthest below the weighted mean of each metric are shown, at most this many
+};
+
+typedef struct fbt fbt;
+
+// Returns a new accumulator set, or NULL if out of memory.
+fbt *fbt_open(const struct fbt_config *config);
+void fbt_close(fbt *state);
+
+// Makes room for group ids 0..group_count-1 of an attribute, so that they are reported
+// (with --members 0) even before any of their samples are pushed. Returns 0 on success.
+int fbt_reserve(fbt *state, size_t attribute, size_t group_count);
+
+// Moves the stats of each group g of an attribute into group mapping[g], summing the groups
+// that are mapped together, so that the attribute is left with group_count groups (e.g., to
+// fold rare groups into one). Returns 0 on success.
+int fbt_regroup(fbt *state, size_t attribute, const size_t *mapping, size_t group_count);
+
+// Accumulates one sample, given its group id for each attribute. Returns 0 on success.
+int fbt_push(fbt *state, const size_t *group_ids, double y, double p);
+
+// Accumulates n samples at once, where group_ids holds attribute_count ids per sample
+// (row-major) and y, p hold one value per sample. Returns 0 on success.
+int fbt_push_batch(fbt *state, const size_t *group_ids, const double *y, const double *p, size_t n);
+
+// Accumulates n samples given column-wise, where group_codes[a] holds the n group ids of
+// attribute a. Each attribute is swept in one tight loop, which suits columnar inputs whose
+// group ids are already decoded per column. Returns 0 on success.
+int fbt_push_columns(fbt *state, const uint32_t *const *group_codes, const double *y, const double *p, size_t n);
+
+// Adds the samples of other, which has the same attributes, to the accumulators, moving the stats
+// of each group g of its attribute a into group mappings[a][g] (or g if mappings is NULL), so that
+// accumulators pushed to by separate threads can be combined. Returns 0 on success.
+int fbt_merge(fbt *state, const fbt *other, const size_t *const *mappings);
+
+// Returns an independent copy of the accumulators (e.g., to report while pushing continues
+// elsewhere), to be released with fbt_close, or NULL if out of memory.
+fbt *fbt_snapshot(const fbt *state);
+
+size_t fbt_attribute_count(const fbt *state);
+size_t fbt_group_count(const fbt *state, size_t attribute);
+const struct fbt_stats *fbt_group_stats(const fbt *state, size_t attribute, size_t group);
+unsigned long fbt_samples(const fbt *state);
+
+// Caches the metrics of the groups pushed to since the last call, so that the reports that follow
+// only recompute those (e.g., for each refresh of a stream). Returns 0 on success and 2 if out
+// of memory (with a message), in which case reports compute every group.
+int fbt_refresh(fbt *state);
+
+// Returns the bytes held by the accumulators.
+size_t fbt_memory(const fbt *state);
+
+// Computes the metrics of one group, indexed by FBT_METRIC_*.
+void fbt_metrics(const struct fbt_stats *stats, double values[FBT_NUM_METRICS]);
+
+// Computes the summary over the groups of all attributes with at least min_samples samples.
+void fbt_summary(const fbt *state, size_t min_samples, struct fbt_summary *summary);
+
+// Returns the widest 95% confidence half-width (Wilson score interval) over the metrics of the
+// groups with at least min_samples samples, treating samples as independent, or 1 if no group
+// has enough samples. Metrics without samples in their denominator (e.g., the tpr of a group
+// without positive labels) are left out.
+double fbt_bound(const fbt *state, size_t min_samples);
+
+// Returns whether any summary value falls below the threshold.
+int fbt_violations(const struct fbt_summary *summary, double threshold);
+
+#define FBT_UNDECIDED -1
+
+// Decides whether fbt_violations would hold for all future samples too, using confidence
+// sequences of the metrics of the groups with at least min_samples samples that hold jointly
+// at any sample count with probability 1-alpha, so that it can be called as often as desired
+// while samples are pushed. Returns 1 if the threshold is certainly violated, 0 if it is
+// certainly met, and FBT_UNDECIDED otherwise. Samples are treated as independent and unweighted.
+int fbt_verdict(const fbt *state, size_t min_samples, double threshold, double alpha);
+
+// Prints the report to stdout and returns 1 if the threshold is violated, 0 otherwise, and 2
+// if out of memory (with a message).
+int fbt_report(const fbt *state, const struct fbt_report_options *options);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FBT_H
@@ -0,0 +1,131 @@
+#ifndef FBT_CPP_H
+#define FBT_CPP_H
+
+#include "fbt.h"
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <initializer_list>
+#include <cstddef>
+#include <utility>
+
+// Owning C++ handle of libfbt accumulators. Group names given per attribute are only used
+// by report(), so pushing stays a plain function call on integer ids.
+class Fbt {
+    fbt *state_ = nullptr;
+    std::vector<std::vector<std::string>> group_names_;
+    explicit Fbt(fbt *state, std::vector<std::vector<std::string>> group_names)
+        : state_(state), group_names_(std::move(group_names)) {}
+public:
+    explicit Fbt(const std::vector<std::string>& attribute_names, double forget = 0.0)
+        : group_names_(attribute_names.size()) {
+        std::vector<const char*> names(attribute_names.size());
+        for (size_t a = 0; a < names.size(); ++a)
+            names[a] = attribute_names[a].c_str();
+        fbt_config config{names.size(), names.data(), forget};
+        state_ = fbt_open(&config);
+        if (!state_)
+            throw std::runtime_error("Failed to allocate fairness accumulators.");
+    }
+    Fbt(const Fbt&) = delete;
+    Fbt& operator=(const Fbt&) = delete;
+    Fbt(Fbt&& o) noexcept : state_(o.state_), group_names_(std::move(o.group_names_)) { o.state_ = nullptr; }
+    Fbt& operator=(Fbt&& o) noexcept {
+        if (this != &o) {
+            fbt_close(state_);
+            state_ = o.state_;
+            group_names_ = std::move(o.group_names_);
+            o.state_ = nullptr;
+        }
+        return *this;
+    }
+    ~Fbt() { fbt_close(state_); }
+
+    // Names the groups of an attribute by id, and reserves them so that they are all reported.
+    void set_groups(size_t attribute, std::vector<std::string> names) {
+        if (fbt_reserve(state_, attribute, names.size()))
+            throw std::runtime_error("Failed to allocate fairness accumulators.");
+        group_names_.at(attribute) = std::move(names);
+    }
+
+    inline void push(const size_t *group_ids, double y, double p) {
+        if (fbt_push(state_, group_ids, y, p)) [[unlikely]]
+            throw std::runtime_error("Failed to allocate fairness accumulators.");
+    }
+
+    inline void push(std::initializer_list<size_t> group_ids, double y, double p) {
+        if (group_ids.size() != attribute_count()) [[unlikely]]
+            throw std::invalid_argument("One group id is needed per attribute.");
+        push(group_ids.begin(), y, p);
+    }
+
+    // group_ids holds attribute_count() ids per sample, followed by the next sample's ids
+    inline void push_batch(const size_t *group_ids, const double *y, const double *p, size_t n) {
+        if (fbt_push_batch(state_, group_ids, y, p, n)) [[unlikely]]
+            throw std::runtime_error("Failed to allocate fairness accumulators.");
+    }
+
+    // Adds the samples of other (with the same attributes and group ids), e.g., pushed by another thread.
+    void merge(const Fbt& other) {
+        if (other.attribute_count() != attribute_count())
+            throw std::invalid_argument("Merged accumulators need the same attributes.");
+        if (fbt_merge(state_, other.state_, nullptr))
+            throw std::runtime_error("Failed to allocate fairness accumulators.");
+    }
+
+    // Caches the metrics of the groups pushed to since the last call, so that the next reports only recompute those.
+    void refresh() {
+        if (fbt_refresh(state_))
+            throw std::runtime_error("Failed to allocate the metrics cache.");
+    }
+
+    Fbt snapshot() const {
+        fbt *copy = fbt_snapshot(state_);
+        if (!copy)
+            throw std::runtime_error("Failed to allocate fairness accumulators.");
+        return Fbt(copy, group_names_);
+    }
+
+    inline size_t attribute_count() const noexcept { return fbt_attribute_count(state_); }
+    inline size_t group_count(size_t attribute) const noexcept { return fbt_group_count(state_, attribute); }
+    inline const struct fbt_stats* group_stats(size_t attribute, size_t group) const noexcept { return fbt_group_stats(state_, attribute, group); }
+    inline unsigned long samples() const noexcept { return fbt_samples(state_); }
+    inline size_t memory() const noexcept { return fbt_memory(state_); }
+
+    struct fbt_summary summary(size_t min_samples = 1) const {
+        struct fbt_summary result;
+        fbt_summary(state_, min_samples, &result);
+        return result;
+    }
+
+    // Widest 95% confidence half-width over the metrics of groups with at least min_samples samples.
+    double bound(size_t min_samples = 1) const {
+        return fbt_bound(state_, min_samples);
+    }
+
+    // 1 if the threshold is certainly violated, 0 if it is certainly met, FBT_UNDECIDED otherwise.
+    int verdict(size_t min_samples = 1, double threshold = 0.0, double alpha = 0.05) const {
+        return fbt_verdict(state_, min_samples, threshold, alpha);
+    }
+
+    // Prints the report to stdout and returns whether the threshold is violated.
+    bool report(size_t min_samples = 1, double threshold = 0.0, bool show_details = false, bool show_bars = false) const {
+        std::vector<std::vector<const char*>> names(group_names_.size());
+        std::vector<const char *const *> group_names(group_names_.size());
+        for (size_t a = 0; a < names.size(); ++a) {
+            for (const std::string& name : group_names_[a])
+                names[a].push_back(name.c_str());
+            names[a].resize(group_count(a), nullptr); // unnamed groups are shown by id
+            group_names[a] = names[a].data();
+        }
+        fbt_report_options options{min_samples, threshold, show_bars, show_details, group_names.data(), 0};
+        const int code = fbt_report(state_, &options);
+        if (code == 2)
+            throw std::runtime_error("Failed to allocate the report.");
+        return code != 0;
+    }
+
+    inline fbt* handle() noexcept { return state_; }
+};
+
+#endif // FBT_CPP_H
@@ -0,0 +1,90 @@
+#ifndef FBT_INTERNAL_H
+#define FBT_INTERNAL_H
+
+#include <stdlib.h>
+#include <string.h>
+#include "fbt.h"
+
+/*
+ * Layout of the libfbt accumulators, which fbt.h keeps opaque, and the reports of several
+ * accumulators that the fbt front-end prints. Only the library and the front-end include this.
+ */
+
+// accumulators of one attribute, indexed by group id
+struct Attribute {
+    struct fbt_stats *stats;
+    size_t num_groups;
+    size_t capacity;
+    char *name;
+    // metrics of the first refreshed groups as of the last fbt_refresh, and which of them were
+    // pushed to since (none before the first refresh)
+    double (*metrics)[FBT_NUM_METRICS];
+    unsigned char *dirty;
+    size_t refreshed;
+};
+
+// marks a group whose cached metrics no longer match its stats
+static inline void fbt_touch(struct Attribute *attr, size_t group) {
+    if (group < attr->refreshed)
+        attr->dirty[group] = 1;
+}
+
+// drops the cached metrics of an attribute whose groups were rewritten or renumbered
+static inline void fbt_uncache(struct Attribute *attr) {
+    free(attr->metrics);
+    free(attr->dirty);
+    attr->metrics = NULL;
+    attr->dirty = NULL;
+    attr->refreshed = 0;
+}
+
+struct fbt {
+    struct Attribute *attributes;
+    size_t attribute_count;
+    double forget;
+    unsigned long total_rows;
+};
+
+// Reports each --partition, or ranks them by absolute fairness. Returns 1 if the threshold is
+// violated, 0 otherwise, and 2 on error (with a message).
+int print_partitions(
+    fbt *const *partitions,
+    const char *const *partition_names,
+    size_t partition_count,
+    const struct fbt_report_options *options,
+    int rank
+);
+
+// Reports the --time-col buckets in time order, one row of absolutely fair values each.
+// Returns like print_partitions.
+int print_trend(
+    fbt *const *buckets,
+    const char *const *bucket_names,
+    size_t bucket_count,
+    const struct fbt_report_options *options
+);
+
+// Writes every summary of each --time-col bucket to a CSV file, in time order. Returns 0 on
+// success and 2 on error (with a message).
+int trend_save(const char *path, fbt *const *buckets, const char *const *bucket_names, size_t bucket_count, size_t min_samples);
+
+// Reports the accumulators of several predictors (or of the classes of --multiclass, as kind
+// tells) of the same rows side by side. Returns like print_partitions.
+int print_predictors(
+    fbt *const *predictors,
+    const char *const *predictor_names,
+    size_t predictor_count,
+    const struct fbt_report_options *options,
+    const char *kind
+);
+
+// copies a string, or returns NULL if out of memory, which the library leaves to its caller
+static inline char *fbt_strdup(const char *s) {
+    size_t n = strlen(s) + 1;
+    char *p = (char *)malloc(n);
+    if (p)
+        memcpy(p, s, n);
+    return p;
+}
+
+#endif // FBT_INTERNAL_H
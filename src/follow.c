@@ -0,0 +1,239 @@
+#include "follow.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <sys/epoll.h>
+
+// length of a line without its line ending
+static size_t line_body(const char *line, size_t len) {
+    while (len && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+        --len;
+    return len;
+}
+
+// opens the file the path names now, if any, to be read from its start
+static void file_open(struct FollowFile *file) {
+    struct stat st;
+    file->fd = open(file->path, O_RDONLY | O_CLOEXEC);
+    if (file->fd >= 0 && fstat(file->fd, &st) < 0) {
+        close(file->fd);
+        file->fd = -1;
+    }
+    file->offset = 0;
+    file->start = file->end = 0;
+    file->rotated = 0;
+    if (file->fd < 0)
+        return;
+    file->device = (uint64_t)st.st_dev;
+    file->inode = (uint64_t)st.st_ino;
+}
+
+// notices files that appeared, were rotated or were truncated since the last check
+static void file_check(struct FollowFile *file) {
+    struct stat st;
+    if (file->fd < 0) {
+        file_open(file);
+        return;
+    }
+    if (file->rotated)
+        return;
+    // a path that no longer exists keeps its file, until a new one takes its name
+    if (stat(file->path, &st) == 0 && ((uint64_t)st.st_ino != file->inode || (uint64_t)st.st_dev != file->device))
+        file->rotated = 1;
+    else if (fstat(file->fd, &st) == 0 && (uint64_t)st.st_size < file->offset) {
+        // rewritten in place: its partial last line is gone as well
+        file->offset = 0;
+        file->start = file->end = 0;
+    }
+}
+
+// drains the events that woke the epoll descriptor and checks every file
+static void refresh(struct Follow *follow) {
+    char events[4096];  // only drained, since every file is checked anyway
+    while (read(follow->inotify_fd, events, sizeof(events)) > 0)
+        ;
+    for (size_t i = 0; i < follow->count; ++i)
+        file_check(&follow->files[i]);
+}
+
+// Reads the next complete line of a file, moving on to the new file of a rotated path once the
+// old one is drained. Returns 0 if no line is complete yet.
+static int file_line(struct FollowFile *file, char *line, size_t size) {
+    while (file->fd >= 0) {
+        const char *data = file->buffer + file->start;
+        size_t available = file->end - file->start;
+        size_t take = available < size - 1 ? available : size - 1;
+        const char *newline = (const char *)memchr(data, '\n', take);
+        if (newline || available >= size - 1) {
+            if (newline)
+                take = (size_t)(newline - data) + 1;
+            memcpy(line, data, take);
+            line[take] = '\0';
+            file->start += take;
+            return 1;
+        }
+        if (file->start) {
+            memmove(file->buffer, data, available);
+            file->start = 0;
+            file->end = available;
+        }
+        ssize_t n = pread(file->fd, file->buffer + file->end, FOLLOW_BUFFER_SIZE - file->end, (off_t)file->offset);
+        if (n > 0) {
+            file->offset += (uint64_t)n;
+            file->end += (size_t)n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (!file->rotated)
+            return 0;
+        // the old file is drained (its writer has moved on to the new one), and a last line that
+        // never got its newline is dropped like the partial line of a truncated file
+        close(file->fd);
+        file_open(file);
+    }
+    return 0;
+}
+
+int follow_open(struct Follow *follow, const char *const *paths, size_t count) {
+    memset(follow, 0, sizeof(struct Follow));
+    follow->inotify_fd = follow->epoll_fd = -1;
+    for (size_t i = 0; i < FOLLOW_MAX_FILES; ++i)
+        follow->files[i].fd = -1;
+    if (count > FOLLOW_MAX_FILES) {
+        fprintf(stderr, "Error: at most %d files can be followed\n", FOLLOW_MAX_FILES);
+        return 2;
+    }
+    follow->count = count;
+    follow->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    follow->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event event = {.events = EPOLLIN};
+    if (follow->inotify_fd < 0 || follow->epoll_fd < 0
+        || epoll_ctl(follow->epoll_fd, EPOLL_CTL_ADD, follow->inotify_fd, &event) < 0) {
+        fprintf(stderr, "Error: could not watch the followed files\n");
+        return 2;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        struct FollowFile *file = &follow->files[i];
+        file->path = paths[i];
+        if (!(file->buffer = malloc(FOLLOW_BUFFER_SIZE))) {
+            fprintf(stderr, "Error: out of memory allocating read buffers\n");
+            return 2;
+        }
+        // the directory is watched rather than the file, so that its new files are noticed too
+        char dir[4096] = ".";
+        const char *slash = strrchr(paths[i], '/');
+        if (slash) {
+            size_t len = slash == paths[i] ? 1 : (size_t)(slash - paths[i]);
+            if (len >= sizeof(dir)) {
+                fprintf(stderr, "Error: path too long: %s\n", paths[i]);
+                return 2;
+            }
+            memcpy(dir, paths[i], len);
+            dir[len] = '\0';
+        }
+        // watches of the same directory are merged by inotify
+        if (inotify_add_watch(follow->inotify_fd, dir, IN_MODIFY | IN_CREATE | IN_MOVED_TO | IN_CLOSE_WRITE) < 0) {
+            fprintf(stderr, "Error: could not watch the directory of %s\n", paths[i]);
+            return 2;
+        }
+        file_open(file);
+    }
+    return 0;
+}
+
+char *follow_gets(struct Follow *follow, char *line, size_t size, int in_row) {
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        if (attempt)
+            refresh(follow);
+        if (in_row) {
+            if (file_line(&follow->files[follow->current], line, size))
+                return line;
+            continue;
+        }
+        // the file of the last line goes on first, so that files are read in long runs
+        for (size_t k = 0; k < follow->count; ++k) {
+            size_t i = (follow->current + k) % follow->count;
+            while (file_line(&follow->files[i], line, size)) {
+                size_t len = line_body(line, strlen(line));
+                if (follow->header && len == follow->header_len && !memcmp(line, follow->header, len))
+                    continue;
+                if (!follow->header) {
+                    if (!(follow->header = malloc(len + 1)))
+                        return NULL;
+                    memcpy(follow->header, line, len);
+                    follow->header[len] = '\0';
+                    follow->header_len = len;
+                }
+                follow->current = i;
+                return line;
+            }
+        }
+    }
+    return NULL;
+}
+
+int follow_fd(const struct Follow *follow) {
+    return follow->epoll_fd;
+}
+
+void follow_wait(struct Follow *follow, int timeout_ms) {
+    struct epoll_event event;
+    epoll_wait(follow->epoll_fd, &event, 1, timeout_ms);
+}
+
+void follow_close(struct Follow *follow) {
+    for (size_t i = 0; i < follow->count; ++i) {
+        if (follow->files[i].fd >= 0)
+            close(follow->files[i].fd);
+        free(follow->files[i].buffer);
+    }
+    if (follow->inotify_fd >= 0)
+        close(follow->inotify_fd);
+    if (follow->epoll_fd >= 0)
+        close(follow->epoll_fd);
+    free(follow->header);
+    memset(follow, 0, sizeof(struct Follow));
+}
+
+#else
+
+int follow_open(struct Follow *follow, const char *const *paths, size_t count) {
+    (void)paths;
+    memset(follow, 0, sizeof(struct Follow));
+    follow->count = count;
+    fprintf(stderr, "Error: --follow needs Linux (inotify)\n");
+    return 2;
+}
+
+char *follow_gets(struct Follow *follow, char *line, size_t size, int in_row) {
+    (void)follow;
+    (void)line;
+    (void)size;
+    (void)in_row;
+    return NULL;
+}
+
+int follow_fd(const struct Follow *follow) {
+    (void)follow;
+    return -1;
+}
+
+void follow_wait(struct Follow *follow, int timeout_ms) {
+    (void)follow;
+    (void)timeout_ms;
+}
+
+void follow_close(struct Follow *follow) {
+    (void)follow;
+}
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef FOLLOW_H
+#define FOLLOW_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * --follow: rows appended to log files, read in place instead of through `tail -F` and a pipe.
+ * Each file is read with pread from its own offset, and lines are only returned once their
+ * newline has been written. The directories of the files are watched with inotify, whose events
+ * wake an epoll descriptor that the stream loop waits on. A path that names a new file (by
+ * inode, e.g., after logrotate renames the old one) is switched to once the old file is drained,
+ * so that rows written just before the rotation are kept, and a file that shrinks below its
+ * offset (e.g., copytruncate) is read again from its start. The first line is the header, and
+ * later lines equal to it (e.g., at the top of each new file) are skipped. Files are read from
+ * their start, and may not exist yet. Only available on Linux.
+ */
+
+#define FOLLOW_MAX_FILES 64
+#define FOLLOW_BUFFER_SIZE (1 << 16)    // per file, at least MAX_LINE_SIZE
+
+struct FollowFile {
+    const char *path;
+    int fd;                 // -1 while the path does not exist
+    uint64_t device;        // of the open file, to notice when the path names another one
+    uint64_t inode;
+    uint64_t offset;        // of the next byte to read
+    int rotated;            // the path names a new file, which is opened once this one is drained
+    char *buffer;           // bytes read but not returned yet, at [start,end)
+    size_t start;
+    size_t end;
+};
+
+struct Follow {
+    struct FollowFile files[FOLLOW_MAX_FILES];
+    size_t count;
+    size_t current;         // file of the last line, where the lines of a row continue
+    int inotify_fd;
+    int epoll_fd;
+    char *header;           // the first line (without its line ending), or NULL until it is read
+    size_t header_len;
+};
+
+// Starts following the files at the given paths. Returns 0 on success and 2 on error (with a message).
+int follow_open(struct Follow *follow, const char *const *paths, size_t count);
+
+// Reads the next complete line of any file like fgets, skipping repeated headers, or with in_row
+// the next line of the file of the last line. Returns NULL if no such line has been written yet.
+char *follow_gets(struct Follow *follow, char *line, size_t size, int in_row);
+
+// a descriptor that becomes readable when the files change, for poll or select
+int follow_fd(const struct Follow *follow);
+
+// waits up to timeout_ms for the files to change
+void follow_wait(struct Follow *follow, int timeout_ms);
+
+void follow_close(struct Follow *follow);
+
+#endif // FOLLOW_H
@@ -3,6 +3,16 @@
 #include <string.h>
 #include <ctype.h>
 #include "data.h"
+#include "arrow.h"
+#include "cache.h"
+#include "reader.h"
+#include "metrics.h"
+#include "shards.h"
+#include "follow.h"
+#include "timestamp.h"
+#include "multiclass.h"
+#include "mapping.h"
+#include "state.h"
 #include <time.h>
 
 
@@ -19,14 +29,14 @@ static const char* GREEN  = "\033[32m";
   #include <unistd.h>
   #include <poll.h>
 #endif
-static void poll_for_data(FILE *f) {
+static void poll_for_data(int fd) {
 #ifdef _WIN32
     // Windows version — no POSIX poll, just sleep briefly.
     // stdin and pipes usually block automatically anyway.
+    (void)fd;
     Sleep(100); // milliseconds
 #else
     // Unix-like version — efficiently waits until input becomes available.
-    int fd = fileno(f);
     struct pollfd pfd;
     pfd.fd = fd;
     pfd.events = POLLIN; // wait for readable data
@@ -39,20 +49,249 @@ static void poll_for_data(FILE *f) {
 #endif
 }
 
+static inline MHASH_INDEX_UINT header_index(const MHashCompact *map, const char **col_ptrs, const char *name) {
+    return mhash_compact_find(map, name, strlen(name), col_ptrs);
+}
+
+// splits a line that was just read, reading the lines that its quoted cells continue on
+static int split_row(char *line, size_t size, struct Reader *reader, char delimiter, size_t *cell_start, size_t *cell_len, size_t *cell_count) {
+    size_t len = strlen(line);
+    int status;
+    while ((status = csv_split(line, len, delimiter, cell_start, cell_len, MAX_COLS, cell_count)) == CSV_OPEN_QUOTE) {
+        if (len + 1 >= size || !reader_gets_rest(reader, line + len, size - len)) {
+            fprintf(stderr, "Error: unterminated quoted value\n");
+            return 2;
+        }
+        len += strlen(line + len);
+    }
+    return status;
+}
+
+static const char *const number_group_names[] = {"[number]"};
+
+// reads a byte count with an optional k, M or G suffix (powers of 1024)
+static size_t parse_bytes(const char *text) {
+    char *end;
+    double bytes = strtod(text, &end);
+    if (*end == 'k' || *end == 'K') bytes *= 1024.0;
+    else if (*end == 'm' || *end == 'M') bytes *= 1024.0 * 1024.0;
+    else if (*end == 'g' || *end == 'G') bytes *= 1024.0 * 1024.0 * 1024.0;
+    return bytes > 0.0 ? (size_t)bytes : 0;
+}
+
+#define SAMPLE_SEED 1              // sampled blocks are the same across runs
+#define BOUND_CHECK_ROWS 4096      // rows between checks of the bounds against --tolerance and --early-exit
+#define MEMORY_CHECK_ROWS 64       // rows between checks of --max-memory
+#define EARLY_EXIT_ALPHA 0.05      // chance that --early-exit decides differently than the whole data would
+
+// widest confidence bound over the groups of all partitions
+static double widest_bound(fbt *const *partitions, size_t partition_count, size_t min_samples) {
+    double widest = partition_count ? 0.0 : 1.0;
+    for (size_t p = 0; p < partition_count; ++p) {
+        double bound = fbt_bound(partitions[p], min_samples);
+        widest = bound > widest ? bound : widest;
+    }
+    return widest;
+}
+
+// verdict of the threshold over all partitions, each of which gets an equal share of alpha
+static int partitions_verdict(fbt *const *partitions, size_t partition_count, size_t min_samples, double threshold) {
+    int verdict = 0;
+    for (size_t p = 0; p < partition_count && verdict != 1; ++p) {
+        int partition_verdict = fbt_verdict(partitions[p], min_samples, threshold, EARLY_EXIT_ALPHA / (double)partition_count);
+        if (partition_verdict)
+            verdict = partition_verdict;
+    }
+    return partition_count ? verdict : FBT_UNDECIDED;
+}
+
+// bytes of the groups of all columns and of the accumulators of all partitions
+static size_t memory_used(const struct Column *columns, size_t col_count, const struct Column *partition_dict,
+                          fbt *const *partitions, size_t partition_count) {
+    size_t bytes = column_memory(partition_dict) + sizeof(fbt*) * partition_count;
+    for (size_t i = 0; i < col_count; ++i)
+        bytes += column_memory(&columns[i]);
+    for (size_t p = 0; p < partition_count; ++p)
+        bytes += fbt_memory(partitions[p]);
+    return bytes;
+}
+
+// keeps the memory of groups within max_memory, folding the rare groups of the columns with the
+// most groups into [other] once 7/8 of it is used, and sending new values to [other] if that
+// does not free enough
+static int fit_memory(size_t max_memory, struct Column *columns, size_t col_count, const size_t *accumulated, size_t accumulated_count,
+                      const struct Column *partition_dict, fbt *const *partitions, size_t partition_count) {
+    size_t used = memory_used(columns, col_count, partition_dict, partitions, partition_count);
+    int exhausted[MAX_COLS] = {0};  // columns with too few groups to evict
+    while (used > max_memory / 8 * 7) {
+        size_t largest = accumulated_count;
+        for (size_t k = 0; k < accumulated_count; ++k)
+            if (!exhausted[k]
+                && (largest == accumulated_count || columns[accumulated[k]].num_dimensions > columns[accumulated[largest]].num_dimensions))
+                largest = k;
+        if (largest == accumulated_count)
+            break;
+        size_t evicted;
+        if (column_evict(&columns[accumulated[largest]], largest, partitions, partition_count, &evicted))
+            return 2;
+        if (evicted)
+            used = memory_used(columns, col_count, partition_dict, partitions, partition_count);
+        else
+            exhausted[largest] = 1;
+    }
+    for (size_t k = 0; k < accumulated_count; ++k)
+        columns[accumulated[k]].full = used > max_memory / 8 * 7;
+    return 0;
+}
+
+// the options that decide how rows accumulate, which --incremental only resumes with if unchanged
+static void incremental_signature(char *signature, size_t size, const char *label_col, const char *predict_col, const char *partition_col,
+                                  int64_t time_bucket, MHASH_INDEX_UINT categorical_dimensions, double forget,
+                                  const struct Config *configs, int config_count) {
+    int written = snprintf(signature, size, "label=%s predict=%s partition=%s bucket=%lld numbers=%llu forget=%.17g",
+                           label_col ? label_col : "label", predict_col ? predict_col : "predict", partition_col ? partition_col : "",
+                           (long long)time_bucket, (unsigned long long)categorical_dimensions, forget);
+    for (int i = 0; i < config_count && written >= 0 && (size_t)written < size; ++i) {
+        char range[3] = {configs[i].range[0], configs[i].range[1], '\0'};
+        const char *detail = configs[i].status == CONFIG_STATUS_BINARY ? configs[i].binary
+                           : configs[i].status == CONFIG_STATUS_RANGE ? range : "";
+        int more = snprintf(signature + written, size - (size_t)written, " @%s=%d:%s", configs[i].name, configs[i].status, detail);
+        written = more < 0 ? more : written + more;
+    }
+}
+
+static int report(
+    fbt *const *partitions,
+    const struct Column *partition_dict,
+    size_t partition_count,
+    const struct Column *columns,
+    size_t col_count,
+    const size_t *accumulated,
+    size_t accumulated_count,
+    struct fbt_report_options *options,
+    int rank,
+    double fraction_read,
+    const char *const *predict_names,
+    size_t predict_count,
+    const char *trend_path,
+    const struct Multiclass *multi
+) {
+    // dimension names are looked up now, as they are reallocated whenever new values are met
+    const char *const *group_names[MAX_COLS];
+    for (size_t k = 0; k < accumulated_count; ++k) {
+        const struct Column *column = &columns[accumulated[k]];
+        group_names[k] = column->num_dimensions == 1 ? number_group_names : (const char *const *)column->dimension_names;
+    }
+    options->group_names = group_names;
+    const char *const *partition_names = partition_dict ? (const char *const *)partition_dict->dimension_names : NULL;
+    fbt **classes = multi ? multiclass_split(multi, columns, accumulated, accumulated_count) : NULL;
+    int return_code = multi
+        ? print_predictors(classes, (const char *const *)multi->classes.dimension_names, multi->classes.num_dimensions, options, "Classes")
+        : partition_dict
+        ? partition_dict->time_bucket && !rank
+            ? print_trend(partitions, partition_names, partition_count, options)
+            : print_partitions(partitions, partition_names, partition_count, options, rank)
+        : predict_count > 1 ? print_predictors(partitions, predict_names, predict_count, options, "Predictors")
+        : fbt_report(partitions[0], options);
+    options->group_names = NULL;
+    for (size_t c = 0; multi && c < multi->classes.num_dimensions; ++c)
+        fbt_close(classes[c]);
+    free(classes);
+    if (trend_path && trend_save(trend_path, partitions, partition_names, partition_count, options->min_samples))
+        return 2;
+    for (size_t i = 0; i < col_count; ++i)
+        if (columns[i].malformed)
+            printf("%sMalformed numbers:%s %zu in %s\n", RED, RESET, columns[i].malformed, columns[i].name);
+    for (size_t i = 0; i < col_count; ++i)
+        if (columns[i].evicted)
+            printf("%sEvicted groups:%s %zu of %s into %s\n", RED, RESET, columns[i].evicted, columns[i].name, OTHER_GROUP);
+    // sampled runs show how far their metrics may be from those of the whole file
+    if (fraction_read >= 0.0)
+        printf("Bounds: ±%.3f at 95%% confidence, from %.1f%% of the data\n",
+               widest_bound(partitions, partition_count, options->min_samples), 100.0 * fraction_read);
+    return return_code;
+}
+
+// caches the metrics of every partition before a refresh of --stream, so that the next one only
+// recomputes the groups pushed to in between
+static int refresh_partitions(fbt *const *partitions, size_t partition_count) {
+    for (size_t p = 0; p < partition_count; ++p)
+        if (fbt_refresh(partitions[p]))
+            return 2;
+    return 0;
+}
+
+// --metrics state, with the accumulators it reports on (which are reallocated as partitions are met)
+// and the block of rows that are decoded but not yet accumulated
+struct LiveMetrics {
+    struct Metrics metrics;
+    struct RowBlock *block;
+    double forget;
+    fbt ***partitions;
+    size_t *partition_count;
+    const struct Column *partition_dict;    // NULL without --partition
+    struct Column *columns;
+    size_t col_count;
+    const size_t *accumulated;
+    size_t accumulated_count;
+    size_t min_samples;
+    const char *const *predict_names;
+    size_t predict_count;
+};
+
+// answers --metrics requests on the current accumulators, waiting up to timeout_ms for them or for wait_fd
+static void serve_metrics(struct LiveMetrics *live, int wait_fd, int timeout_ms) {
+    struct MetricsSource source;
+    source.partitions = *live->partitions;
+    source.partition_count = *live->partition_count;
+    source.partition_label = live->partition_dict ? "partition" : "predict";
+    source.partition_names = live->partition_dict ? (const char *const *)live->partition_dict->dimension_names
+                           : live->predict_count > 1 ? live->predict_names : NULL;
+    source.columns = live->columns;
+    source.col_count = live->col_count;
+    source.accumulated = live->accumulated;
+    source.accumulated_count = live->accumulated_count;
+    source.min_samples = live->min_samples;
+    metrics_serve(&live->metrics, &source, wait_fd, timeout_ms);
+}
+
+// waits for the rest of a line of stdin while answering --metrics requests on all rows so far
+static void wait_serving_metrics(void *context, int fd) {
+    struct LiveMetrics *live = (struct LiveMetrics *)context;
+    if (live->block->n && row_block_push(live->block, live->partitions, live->partition_count, live->partition_dict,
+                                         live->columns, live->accumulated, live->accumulated_count, live->predict_count, live->forget)) {
+        fprintf(stderr, "Error: out of memory allocating accumulators\n");
+        exit(2);
+    }
+    ++live->metrics.idle_polls;
+    serve_metrics(live, fd, 100);
+}
+
 
 int main(int argc, char *argv[]) {
     if (argc < 2) {
-        fprintf(stderr, "Usage: %s <file.csv|script.fb> [--label colname] [--predict colname] [--threshold value] [--stream refresh_seconds] [--forget rate] [--bars] [--details]\n", argv[0]);
+        fprintf(stderr, "Usage: %s <file.csv|script.fb> [--label colname] [--predict colname[,colname...]] [--threshold value] [--stream refresh_seconds] [--forget rate] [--partition colname] [--rank] [--bars] [--details] [--worst count] [--cache] [--sample rate] [--tolerance eps] [--early-exit] [--max-memory bytes] [--dict file] [--metrics port] [--threads count] [--follow file...] [--time-col colname] [--bucket width] [--trend-csv file] [--multiclass] [--incremental state-file]\n", argv[0]);
         return 0;
     }
 
     const char *filepath = NULL;
     const char *label_col = NULL;
     const char *predict_col = NULL;
+    const char *partition_col = NULL;
+    const char *dict_path = NULL;
+    const char *time_col = NULL;
+    const char *bucket_width = NULL;
+    const char *trend_path = NULL;
+    const char *incremental_path = NULL;
     int show_bars = 0;
+    int rank_partitions = 0;
     int show_details = 0;
+    int use_cache = 0;
+    int early_exit = 0;
+    int multiclass = 0;
     double threshold = 0.0;
     size_t min_samples = 1;
+    size_t worst = 0;
     MHASH_INDEX_UINT categorical_dimensions = 10;
 
     struct Config configs[MAX_COLS];
@@ -60,6 +299,13 @@ int main(int argc, char *argv[]) {
 
     double stream_interval = 0;
     double forget = 0;
+    double sample_rate = 1.0;
+    double tolerance = 0.0;
+    size_t max_memory = 0;
+    int metrics_port = 0;
+    long threads = 1;
+    const char *follow_paths[FOLLOW_MAX_FILES];
+    size_t follow_count = 0;
 
     // Parse CLI args
     int in_comments = 0;
@@ -78,20 +324,62 @@ int main(int argc, char *argv[]) {
             label_col = argv[++i];
         else if (strcmp(argv[i], "--predict") == 0 && i + 1 < argc)
             predict_col = argv[++i];
+        else if (strcmp(argv[i], "--partition") == 0 && i + 1 < argc)
+            partition_col = argv[++i];
+        else if (strcmp(argv[i], "--dict") == 0 && i + 1 < argc)
+            dict_path = argv[++i];
+        else if (strcmp(argv[i], "--time-col") == 0 && i + 1 < argc)
+            time_col = argv[++i];
+        else if (strcmp(argv[i], "--bucket") == 0 && i + 1 < argc)
+            bucket_width = argv[++i];
+        else if (strcmp(argv[i], "--trend-csv") == 0 && i + 1 < argc)
+            trend_path = argv[++i];
+        else if (strcmp(argv[i], "--incremental") == 0 && i + 1 < argc)
+            incremental_path = argv[++i];
         else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc)
             threshold = atof(argv[++i]);
         else if (strcmp(argv[i], "--members") == 0 && i + 1 < argc)
             min_samples = (unsigned long)atol(argv[++i]);
+        else if (strcmp(argv[i], "--worst") == 0 && i + 1 < argc)
+            worst = (unsigned long)atol(argv[++i]);
         else if (strcmp(argv[i], "--numbers") == 0 && i + 1 < argc)
             categorical_dimensions = (unsigned long)atol(argv[++i]);
         else if (strcmp(argv[i], "--stream") == 0 && i + 1 < argc) 
             stream_interval = (double)atof(argv[++i]);
         else if (strcmp(argv[i], "--forget") == 0 && i + 1 < argc) 
             forget = (double)atof(argv[++i]);
+        else if (strcmp(argv[i], "--sample") == 0 && i + 1 < argc) 
+            sample_rate = (double)atof(argv[++i]);
+        else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc) 
+            tolerance = (double)atof(argv[++i]);
+        else if (strcmp(argv[i], "--max-memory") == 0 && i + 1 < argc) 
+            max_memory = parse_bytes(argv[++i]);
+        else if (strcmp(argv[i], "--metrics") == 0 && i + 1 < argc) 
+            metrics_port = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) 
+            threads = atol(argv[++i]);
+        else if (strcmp(argv[i], "--follow") == 0 && i + 1 < argc) {
+            // every path up to the next option is followed
+            while (i + 1 < argc && argv[i + 1][0] && argv[i + 1][0] != '-' && argv[i + 1][0] != '#') {
+                if (follow_count == FOLLOW_MAX_FILES) {
+                    fprintf(stderr, "Error: at most %d files can be followed\n", FOLLOW_MAX_FILES);
+                    return 2;
+                }
+                follow_paths[follow_count++] = argv[++i];
+            }
+        }
         else if (strcmp(argv[i], "--bars") == 0) 
             show_bars = 1;
         else if (strcmp(argv[i], "--details") == 0) 
             show_details = 1;
+        else if (strcmp(argv[i], "--rank") == 0) 
+            rank_partitions = 1;
+        else if (strcmp(argv[i], "--cache") == 0) 
+            use_cache = 1;
+        else if (strcmp(argv[i], "--early-exit") == 0) 
+            early_exit = 1;
+        else if (strcmp(argv[i], "--multiclass") == 0) 
+            multiclass = 1;
         else if (argv[i][0]!='-') 
             filepath = argv[i];
     }
@@ -167,6 +455,34 @@ int main(int argc, char *argv[]) {
                     }
                     show_details = 1;
                 } 
+                if(!strcmp(arg, "--rank")) {
+                    if (current_config != -1) {
+                        fprintf(stderr, "Error: can only set %s before a @column\n", arg);
+                        return 2;
+                    }
+                    rank_partitions = 1;
+                } 
+                if(!strcmp(arg, "--cache")) {
+                    if (current_config != -1) {
+                        fprintf(stderr, "Error: can only set %s before a @column\n", arg);
+                        return 2;
+                    }
+                    use_cache = 1;
+                } 
+                if(!strcmp(arg, "--early-exit")) {
+                    if (current_config != -1) {
+                        fprintf(stderr, "Error: can only set %s before a @column\n", arg);
+                        return 2;
+                    }
+                    early_exit = 1;
+                } 
+                if(!strcmp(arg, "--multiclass")) {
+                    if (current_config != -1) {
+                        fprintf(stderr, "Error: can only set %s before a @column\n", arg);
+                        return 2;
+                    }
+                    multiclass = 1;
+                } 
                 if(!strcmp(arg, "--label")) {
                     if (current_config != -1) {
                         fprintf(stderr, "Error: can only set %s before a @column\n", arg);
@@ -185,6 +501,60 @@ int main(int argc, char *argv[]) {
                     if (next)
                         predict_col = xstrdup(next);
                 } 
+                else if(!strcmp(arg, "--partition")) {
+                    if (current_config != -1) {
+                        fprintf(stderr, "Error: can only set %s before a @column\n", arg);
+                        return 2;
+                    }
+                    char *next = strtok(NULL, " \t\r\n");
+                    if (next)
+                        partition_col = xstrdup(next);
+                } 
+                else if(!strcmp(arg, "--dict")) {
+                    if (current_config != -1) {
+                        fprintf(stderr, "Error: can only set %s before a @column\n", arg);
+                        return 2;
+                    }
+                    char *next = strtok(NULL, " \t\r\n");
+                    if (next)
+                        dict_path = xstrdup(next);
+                } 
+                else if(!strcmp(arg, "--time-col")) {
+                    if (current_config != -1) {
+                        fprintf(stderr, "Error: can only set %s before a @column\n", arg);
+                        return 2;
+                    }
+                    char *next = strtok(NULL, " \t\r\n");
+                    if (next)
+                        time_col = xstrdup(next);
+                } 
+                else if(!strcmp(arg, "--bucket")) {
+                    if (current_config != -1) {
+                        fprintf(stderr, "Error: can only set %s before a @column\n", arg);
+                        return 2;
+                    }
+                    char *next = strtok(NULL, " \t\r\n");
+                    if (next)
+                        bucket_width = xstrdup(next);
+                } 
+                else if(!strcmp(arg, "--trend-csv")) {
+                    if (current_config != -1) {
+                        fprintf(stderr, "Error: can only set %s before a @column\n", arg);
+                        return 2;
+                    }
+                    char *next = strtok(NULL, " \t\r\n");
+                    if (next)
+                        trend_path = xstrdup(next);
+                } 
+                else if(!strcmp(arg, "--incremental")) {
+                    if (current_config != -1) {
+                        fprintf(stderr, "Error: can only set %s before a @column\n", arg);
+                        return 2;
+                    }
+                    char *next = strtok(NULL, " \t\r\n");
+                    if (next)
+                        incremental_path = xstrdup(next);
+                } 
                 else if(!strcmp(arg, "--threshold")) {
                     char *next = strtok(NULL, " \t\r\n");
                     if (next) {
@@ -213,6 +583,68 @@ int main(int argc, char *argv[]) {
                     if (next)
                         forget = (double)atof(next);
                 }
+                else if (!strcmp(arg, "--sample")) {
+                    char *next = strtok(NULL, " \t\r\n");
+                    if (current_config != -1) {
+                        fprintf(stderr, "Error: can only set %s before a @column\n", arg);
+                        return 2;
+                    }
+                    if (next)
+                        sample_rate = (double)atof(next);
+                }
+                else if (!strcmp(arg, "--tolerance")) {
+                    char *next = strtok(NULL, " \t\r\n");
+                    if (current_config != -1) {
+                        fprintf(stderr, "Error: can only set %s before a @column\n", arg);
+                        return 2;
+                    }
+                    if (next)
+                        tolerance = (double)atof(next);
+                }
+                else if (!strcmp(arg, "--max-memory")) {
+                    char *next = strtok(NULL, " \t\r\n");
+                    if (current_config != -1) {
+                        fprintf(stderr, "Error: can only set %s before a @column\n", arg);
+                        return 2;
+                    }
+                    if (next)
+                        max_memory = parse_bytes(next);
+                }
+                else if (!strcmp(arg, "--metrics")) {
+                    char *next = strtok(NULL, " \t\r\n");
+                    if (current_config != -1) {
+                        fprintf(stderr, "Error: can only set %s before a @column\n", arg);
+                        return 2;
+                    }
+                    if (next)
+                        metrics_port = atoi(next);
+                }
+                else if (!strcmp(arg, "--threads")) {
+                    char *next = strtok(NULL, " \t\r\n");
+                    if (current_config != -1) {
+                        fprintf(stderr, "Error: can only set %s before a @column\n", arg);
+                        return 2;
+                    }
+                    if (next)
+                        threads = atol(next);
+                }
+                else if (!strcmp(arg, "--follow")) {
+                    if (current_config != -1) {
+                        fprintf(stderr, "Error: can only set %s before a @column\n", arg);
+                        return 2;
+                    }
+                    // every path up to the next option is followed, and the option is handled next
+                    char *next = strtok(NULL, " \t\r\n");
+                    for (; next && next[0] != '-' && next[0] != '@'; next = strtok(NULL, " \t\r\n")) {
+                        if (follow_count == FOLLOW_MAX_FILES) {
+                            fprintf(stderr, "Error: at most %d files can be followed\n", FOLLOW_MAX_FILES);
+                            return 2;
+                        }
+                        follow_paths[follow_count++] = xstrdup(next);
+                    }
+                    arg = next;
+                    continue;
+                }
                 else if(!strcmp(arg, "--numbers")) {
                     char *next = strtok(NULL, " \t\r\n");
                     if (current_config != -1) {
@@ -271,6 +703,14 @@ int main(int argc, char *argv[]) {
                     char *next = strtok(NULL, " \t\r\n");
                     if(next) min_samples = (unsigned long)atol(next);
                 } 
+                else if(!strcmp(arg, "--worst")) {
+                    if (current_config != -1) {
+                        fprintf(stderr, "Error: can only set %s before a @column\n", arg);
+                        return 2;
+                    }
+                    char *next = strtok(NULL, " \t\r\n");
+                    if(next) worst = (unsigned long)atol(next);
+                } 
                 else if(arg[0] != '-' && arg[0] != 0) {
                     if (current_config != -1) {
                         fprintf(stderr, "Error: can only set %s after a @column\n", "a file path");
@@ -283,26 +723,132 @@ int main(int argc, char *argv[]) {
             }
         }
         fclose(fb);
-        if (!filepath && !stream_interval) {
+        if (!filepath && !follow_count && !stream_interval) {
             fprintf(stderr, "Error: no data file or --stream specified in .fb script\n");
             return 2;
         }
     }
 
-    if (!filepath && !stream_interval) {
+    if (!filepath && !follow_count && !stream_interval) {
         fprintf(stderr, "Error: no input file or --stream specification provided.\n");
         return 2;
     }
 
+    // --follow reads the rows appended to files, like stdin of --stream but without a pipe
+    if (follow_count && (filepath || !stream_interval || use_cache || sample_rate < 1.0 || tolerance > 0.0 || early_exit)) {
+        fprintf(stderr, "Error: --follow needs --stream instead of a data file (without --cache, --sample, --tolerance or --early-exit)\n");
+        return 2;
+    }
+
+    // --time-col partitions rows by the time bucket of a column, whose partitions are reported as a trend
+    int64_t time_bucket = 0;
+    if (time_col || bucket_width || trend_path) {
+        if (!time_col || partition_col) {
+            fprintf(stderr, "Error: --bucket and --trend-csv need --time-col, which cannot be combined with --partition\n");
+            return 2;
+        }
+        time_bucket = bucket_width ? parse_duration(bucket_width) : 86400;
+        if (!time_bucket) {
+            fprintf(stderr, "Error: --bucket takes a width like 30s, 15m, 1h, 1d or 1w\n");
+            return 2;
+        }
+        partition_col = time_col;
+    }
+
+    // Arrow IPC inputs are recognized from their first bytes and mapped instead of read line by line
+    struct ArrowFile arrow;
+    int is_arrow = filepath && arrow_detect(filepath);
     FILE *f = NULL;
-    if(filepath) {
+
+    // --cache reads a dictionary-encoded sidecar of the CSV instead of its text, and writes
+    // the sidecar while reading the text if it is missing or the CSV has changed since
+    struct CacheFile cached;
+    struct CacheWriter cache_writer;
+    char *cache_path = NULL;
+    int is_cached = 0;
+    if (use_cache) {
+        if (!filepath || is_arrow) {
+            fprintf(stderr, "Error: --cache needs a CSV data file\n");
+            return 2;
+        }
+        cache_path = malloc(strlen(filepath) + 5);
+        if (!cache_path) {
+            fprintf(stderr, "Error: out of memory\n");
+            return 2;
+        }
+        sprintf(cache_path, "%s.fbc", filepath);
+        is_cached = cache_open(&cached, cache_path, filepath) == 0;
+    }
+
+    // --max-memory folds groups of the columns as rows are parsed, which mapped inputs resolve ahead
+    if (max_memory && (is_arrow || use_cache)) {
+        fprintf(stderr, "Error: --max-memory needs a CSV data file or stdin (without --cache)\n");
+        return 2;
+    }
+
+    // --early-exit stops once the verdict on the threshold is certain, and is only sound while
+    // rows arrive in random order, so it also visits random blocks of the file
+    if (early_exit && (!filepath || is_arrow || use_cache || forget)) {
+        fprintf(stderr, "Error: --early-exit needs a CSV data file (without --cache or --forget)\n");
+        return 2;
+    }
+
+    // --sample and --tolerance read random blocks of the file, until the bounds are within tolerance
+    int sampling = sample_rate < 1.0 || tolerance > 0.0 || early_exit;
+    if (sampling) {
+        if (sample_rate <= 0.0 || sample_rate > 1.0 || tolerance < 0.0) {
+            fprintf(stderr, "Error: --sample takes a rate in (0,1] and --tolerance a positive value\n");
+            return 2;
+        }
+        if (!filepath || is_arrow || use_cache) {
+            fprintf(stderr, "Error: --sample and --tolerance need a CSV data file (without --cache)\n");
+            return 2;
+        }
+    }
+
+    // --metrics serves a Prometheus page while rows are streamed, between rows and while waiting for them
+    struct LiveMetrics live;
+    if (metrics_port) {
+        if (!stream_interval || is_arrow || use_cache) {
+            fprintf(stderr, "Error: --metrics needs --stream (without --cache or an Arrow file)\n");
+            return 2;
+        }
+        if (metrics_open(&live.metrics, metrics_port))
+            return 2;
+    }
+
+    // --threads parses rows on other threads, which own their groups until they are merged for reports
+    if (threads != 1) {
+        if (threads < 1 || threads > MAX_SHARDS) {
+            fprintf(stderr, "Error: --threads takes a count from 1 to %d\n", MAX_SHARDS);
+            return 2;
+        }
+        if (is_arrow || use_cache || sampling || max_memory || metrics_port) {
+            fprintf(stderr, "Error: --threads needs a CSV data file or stdin (without --cache, --sample, --tolerance, --early-exit, --max-memory or --metrics)\n");
+            return 2;
+        }
+    }
+
+    // --incremental reads only the rows appended since the last run, which must be of the same
+    // text file, and thus does not sample it or stop early (nor average restored --forget stats
+    // across --threads parsers, which only hold the new rows)
+    if (incremental_path && (!filepath || is_arrow || use_cache || sampling || max_memory || multiclass || (threads > 1 && forget))) {
+        fprintf(stderr, "Error: --incremental needs a CSV data file (without --cache, --sample, --tolerance, --early-exit, --max-memory, --multiclass, or --forget with --threads)\n");
+        return 2;
+    }
+
+    if (is_arrow) {
+        if (arrow_open(&arrow, filepath))
+            return 2;
+    }
+    else if (filepath && !is_cached && !sampling) {
         f = fopen(filepath, "r");
         if (!f) {
             fprintf(stderr, "Error opening file: %s\n", filepath);
             return 2;
         }
     }
-    else {
+    else if (!filepath && !follow_count) {
         f = stdin;
         if (!f) {
             fprintf(stderr, "Error getting stdin\n");
@@ -310,341 +856,583 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    // --incremental seeks past the rows of the last run, and takes their header from its state
+    struct State state;
+    char signature[MAX_LINE_SIZE];
+    char header_line[MAX_LINE_SIZE];
+    int resumed = 0;
+    uint64_t start_offset = 0;
+    if (incremental_path) {
+        incremental_signature(signature, sizeof(signature), label_col, predict_col, partition_col, time_bucket,
+                              categorical_dimensions, forget, configs, current_config + 1);
+        int loaded = state_load(&state, incremental_path, filepath, signature);
+        if (loaded == 2)
+            return 2;
+        resumed = loaded == 0;
+        start_offset = resumed ? state.offset : 0;
+        if (resumed && file_seek(f, start_offset)) {
+            fprintf(stderr, "Error: could not seek in %s\n", filepath);
+            return 2;
+        }
+    }
+
+    // data files are read ahead on another thread while rows are parsed
+    struct Reader reader;
+    if (sampling ? reader_open_sampled(&reader, filepath, sample_rate, SAMPLE_SEED)
+        : follow_count ? reader_open_followed(&reader, follow_paths, follow_count)
+                 : f && reader_open(&reader, f, filepath != NULL))
+        return 2;
+
     // info
     char line[MAX_LINE_SIZE];
     char col_names[MAX_COLS][MAX_STR_LEN];
     size_t col_count = 0, col_pos = 0;
     MHASH_INDEX_UINT label_index = MHASH_EMPTY_SLOT;
-    MHASH_INDEX_UINT predict_index = MHASH_EMPTY_SLOT;
+    MHASH_INDEX_UINT predict_indexes[MAX_COLS];
+    const char *predict_names[MAX_COLS];
+    size_t predict_count = 0;
     
     if(!filepath) {
         printf("\033[2J\033[H\n\n%s----- Live report -----%s\n", GREEN,RESET);
         printf("FairBench-tiny is running in --stream\n");
-        if(!filepath)    
+        if (follow_count)
+            printf("%sFollowing %zu file(s)%s for appended rows\n", RED, follow_count, RESET);
+        else
             printf("%sCurrently waiting on stdin%s because no data file was provided\n", RED,RESET);
         printf("\nWaiting for first header line...\n");
     }
 
-    // Parse header
-    if (!fgets(line, sizeof(line), f)) {
-        fprintf(stderr, "Empty header line\n");
-        return 2;
-    }
-
     char delimiter = 0;
-    for (int i = 0;; ++i) {
-        char c = line[i];
-        if (c == '\0') {
+    if (is_arrow) {
+        for (size_t i = 0; i < arrow.field_count; ++i) {
+            if (arrow.fields[i].name_len >= MAX_STR_LEN) {
+                fprintf(stderr, "Error: column name too large\n");
+                return 2;
+            }
+            memcpy(col_names[i], arrow.fields[i].name, arrow.fields[i].name_len);
+            col_names[i][arrow.fields[i].name_len] = 0;
+        }
+        col_count = arrow.field_count;
+    }
+    else if (is_cached) {
+        for (size_t i = 0; i < cached.col_count; ++i) {
+            if (cached.columns[i].name_len >= MAX_STR_LEN) {
+                fprintf(stderr, "Error: column name too large\n");
+                return 2;
+            }
+            memcpy(col_names[i], cached.columns[i].name, cached.columns[i].name_len);
+            col_names[i][cached.columns[i].name_len] = 0;
+        }
+        col_count = cached.col_count;
+    }
+    else {
+        // Parse header
+        char *header = resumed ? strcpy(line, state.header) : reader_gets(&reader, line, sizeof(line));
+        while (!header && follow_count) {
+            // followed files may not exist or be empty yet
+            poll_for_data(reader_fd(&reader));
+            header = reader_gets(&reader, line, sizeof(line));
+        }
+        if (!header) {
+            fprintf(stderr, "Empty header line\n");
+            return 2;
+        }
+        if (!strchr(line, '\n') && strlen(line) == sizeof(line) - 1) {
             fprintf(stderr, "Header line too large\n");
             return 2;
         }
-        if (c == '\r' || c == ' ' || c=='\'' || c=='"') continue;
-        if (c == '\n') break;
-        if (is_delimiter(c)) {
-            if (delimiter && delimiter != c) {
-                fprintf(stderr, "Header has multiple delimiters\n");
-                return 2;
+        if (incremental_path)
+            strcpy(header_line, line);
+        // the first delimiter outside quotes is used from thereon
+        int quoted = 0;
+        for (const char *c = line; *c; ++c) {
+            if (*c == '"')
+                quoted = !quoted;
+            else if (!quoted && is_delimiter(*c)) {
+                if (delimiter && delimiter != *c) {
+                    fprintf(stderr, "Header has multiple delimiters\n");
+                    return 2;
+                }
+                delimiter = *c;
             }
-            delimiter = c;
-            col_names[col_count][col_pos] = 0;
-            col_count++;
+        }
+        size_t cell_start[MAX_COLS], cell_len[MAX_COLS];
+        if (split_row(line, sizeof(line), &reader, delimiter, cell_start, cell_len, &col_count))
+            return 2;
+        if (col_count >= MAX_COLS) {
+            fprintf(stderr, "Too many columns in header\n");
+            return 2;
+        }
+        // names drop their spaces, so that they can be written in .fb scripts
+        for (size_t i = 0; i < col_count; ++i) {
             col_pos = 0;
-            if(col_count>=MAX_COLS) {
-                fprintf(stderr, "Too many columns in header\n");
-                return 2;
+            for (size_t j = 0; j < cell_len[i]; ++j) {
+                char c = line[cell_start[i] + j];
+                if (c != ' ' && c != '\'')
+                    col_names[i][col_pos++] = c;
             }
-        } 
-        else 
-            col_names[col_count][col_pos++] = c;
-        
+            col_names[i][col_pos] = 0;
+        }
     }
-    col_names[col_count][col_pos] = 0;
-    col_count++;
     printf("Detected %zu columns\n", col_count);
 
     // Init header mhash
-    size_t map_table_size = col_count*col_count + col_count*2 + 1;
-    MHASH_INDEX_UINT map_table[map_table_size];
     const char *col_ptrs[MAX_COLS];
     for (size_t i = 0; i < col_count; ++i)
         col_ptrs[i] = col_names[i];
-    MHash map;
-    if (mhash_init(&map, map_table, map_table_size, (const void **)col_ptrs, col_count, mhash_str_prefix)) {
+    MHashCompact map;
+    memset(&map, 0, sizeof(map));
+    if (mhash_compact_build(&map, col_ptrs, col_count, mhash_strn_word_multi)) {
         fprintf(stderr, "Error: too many columns in header\n");
         return 2;
     }
 
     // Resolve label/predict columns
-    label_index = mhash_entry(&map, label_col ? label_col : "label");
-    predict_index = mhash_entry(&map, predict_col ? predict_col : "predict");
+    label_index = header_index(&map, col_ptrs, label_col ? label_col : "label");
     if (label_index == MHASH_EMPTY_SLOT) {
         fprintf(stderr, "Error: could not find label column\n");
         return 2;
     }
-    if (predict_index == MHASH_EMPTY_SLOT) {
+    // --predict a,b,c compares several predict columns over the same rows
+    char predict_list[MAX_LINE_SIZE];
+    snprintf(predict_list, sizeof(predict_list), "%s", predict_col ? predict_col : "predict");
+    for (char *name = strtok(predict_list, ","); name; name = strtok(NULL, ",")) {
+        MHASH_INDEX_UINT idx = header_index(&map, col_ptrs, name);
+        if (idx == MHASH_EMPTY_SLOT) {
+            fprintf(stderr, "Error: could not find predict column %s\n", name);
+            return 2;
+        }
+        if (predict_position(idx, predict_indexes, predict_count) < predict_count) {
+            fprintf(stderr, "Error: predict column %s given multiple times\n", name);
+            return 2;
+        }
+        predict_indexes[predict_count] = idx;
+        predict_names[predict_count++] = col_ptrs[idx];
+    }
+    if (!predict_count) {
         fprintf(stderr, "Error: could not find predict column\n");
         return 2;
     }
+    if (predict_count > 1 && partition_col) {
+        fprintf(stderr, "Error: --partition and --time-col cannot be combined with multiple predict columns\n");
+        return 2;
+    }
+    if (multiclass && (predict_count > 1 || partition_col || forget || is_arrow || use_cache || sampling || threads > 1 || max_memory || metrics_port)) {
+        fprintf(stderr, "Error: --multiclass needs one predict column of a CSV data file or stdin (without --partition, --time-col, --forget, --cache, --sample, --tolerance, --early-exit, --max-memory, --threads or --metrics)\n");
+        return 2;
+    }
 
     // column info (most of it will be useful later but preallocated anyway
     struct Column columns[MAX_COLS];
     unsigned long total_rows = 0;
-    size_t col_start=0, col_end=0;
+    size_t cell_start[MAX_COLS], cell_len[MAX_COLS];
     double values[MAX_COLS];
     memset(columns, 0, sizeof(columns));
+    memset(values, 0, sizeof(values));
 
     // attach configs to columns
     for (int i = 0; i <= current_config; ++i) {
-        MHASH_UINT pos = mhash_entry_pos(&map, configs[i].name);
-        MHASH_INDEX_UINT idx = map.table[pos];
+        MHASH_INDEX_UINT idx = header_index(&map, col_ptrs, configs[i].name);
         if(idx == MHASH_EMPTY_SLOT) {
             fprintf(stderr, "Error: configured column '%s' not found in header\n", configs[i].name);
             return 2;
         }
-        if(strcmp(col_ptrs[idx], configs[i].name)) {
-            fprintf(stderr, "Error: configured column '%s' not found in header\n", configs[i].name);
-            return 2;
-        }
         if(columns[idx].config) {
             fprintf(stderr, "Error: configured column '%s' multiple times\n", configs[i].name);
             return 2;
         }
         columns[idx].config = &configs[i];
 
-        if (configs[i].status == CONFIG_STATUS_RANGE) {
-            char start = configs[i].range[0];
-            char end   = configs[i].range[1];
-            size_t range_len = (size_t)(end - start + 1);
-            if (range_len <= 0) {
-                fprintf(stderr, "Error: invalid --char range for column '%s'\n", configs[i].name);
+        if (configs[i].status == CONFIG_STATUS_RANGE && configs[i].range[1] < configs[i].range[0]) {
+            fprintf(stderr, "Error: invalid --char range for column '%s'\n", configs[i].name);
+            return 2;
+        }
+    }
+
+    // --partition keeps independent accumulators per distinct value of a column, whose
+    // own values are only used as keys and are therefore skipped within each partition
+    MHASH_INDEX_UINT partition_index = MHASH_EMPTY_SLOT;
+    struct Config partition_config;
+    struct Column partition_dict;
+    memset(&partition_dict, 0, sizeof(partition_dict));
+    if (time_bucket)
+        partition_buckets(&partition_dict, time_bucket);
+    if (partition_col) {
+        partition_index = header_index(&map, col_ptrs, partition_col);
+        if (partition_index == MHASH_EMPTY_SLOT) {
+            fprintf(stderr, "Error: could not find partition column\n");
+            return 2;
+        }
+        if (partition_index == label_index || predict_position(partition_index, predict_indexes, predict_count) < predict_count) {
+            fprintf(stderr, "Error: the partition column cannot be the label or predict column\n");
+            return 2;
+        }
+        if (!columns[partition_index].config) {
+            memset(&partition_config, 0, sizeof(partition_config));
+            partition_config.name = (char *)partition_col;
+            partition_config.threshold = threshold;
+            columns[partition_index].config = &partition_config;
+        }
+        columns[partition_index].config->status = CONFIG_STATUS_SKIP;
+    }
+    for (size_t i = 0; i < col_count; ++i)
+        if (column_init(&columns[i], columns[i].config, col_ptrs[i], categorical_dimensions))
+            return 2;
+    // --incremental restores the groups of the last run, which --dict would only preload
+    if (resumed && state_restore_columns(&state, columns, col_count, partition_col ? &partition_dict : NULL))
+        return 2;
+    // --dict registers the values of earlier runs up front, in the same order
+    if (dict_path && !resumed && dict_load(dict_path, columns, col_count))
+        return 2;
+    // the config is compiled once into the columns whose cells need handling and the
+    // columns whose stats are reported, so that the row loop never inspects it again
+    size_t handled[MAX_COLS], accumulated[MAX_COLS];
+    size_t handled_count = 0, accumulated_count = 0;
+    for (size_t i = 0; i < col_count; ++i) {
+        if (columns[i].config && columns[i].config->status == CONFIG_STATUS_SKIP)
+            continue;
+        int outcome = i == label_index || predict_position(i, predict_indexes, predict_count) < predict_count;
+        if (multiclass && outcome)
+            continue;  // read as class names instead
+        handled[handled_count++] = i;
+        if (!outcome) {
+            accumulated[accumulated_count++] = i;
+            columns[i].batched = !multiclass;  // multiclass reads the groups of each row at once
+        }
+    }
+    size_t partition_count = 0;
+    fbt **partitions = malloc(sizeof(fbt*) * predict_count);
+    if (!partitions) {
+        fprintf(stderr, "Error: out of memory allocating accumulators\n");
+        return 2;
+    }
+    // without --partition, each predict column gets its own accumulators
+    if (!partition_col) {
+        for (; partition_count < predict_count; ++partition_count) {
+            partitions[partition_count] = partition_open(columns, accumulated, accumulated_count, forget);
+            if (!partitions[partition_count])
                 return 2;
-            }
-            size_t num_dims = range_len + 1; // start..end (inclusive) + 1 for other
-            columns[idx].num_dimensions = num_dims;
-            columns[idx].stats = calloc(num_dims, sizeof(struct Stats));
-            columns[idx].dimension_names = NULL; // dimension names are explicitly known already
         }
     }
+    if (resumed) {
+        if (state_restore_partitions(&state, &partitions, &partition_count, partition_col ? &partition_dict : NULL,
+                                     columns, accumulated, accumulated_count, forget))
+            return 2;
+        total_rows = state.total_rows;
+        state_free(&state);
+    }
+    struct fbt_report_options options;
+    memset(&options, 0, sizeof(options));
+    options.min_samples = min_samples;
+    options.threshold = threshold;
+    options.show_bars = show_bars;
+    options.show_details = show_details;
+    options.worst = worst;
+
+    if (is_arrow) {
+        int failed = accumulate_arrow(&arrow, columns, handled, handled_count, accumulated, accumulated_count,
+                                      label_index, predict_indexes, predict_count, partition_index, &partition_dict, partition_col,
+                                      &partitions, &partition_count, forget, &total_rows);
+        arrow_close(&arrow);
+        if (failed)
+            return 2;
+    }
+    else if (is_cached) {
+        int failed = accumulate_cache(&cached, columns, handled, handled_count, accumulated, accumulated_count,
+                                      label_index, predict_indexes, predict_count, partition_index, &partition_dict, partition_col,
+                                      &partitions, &partition_count, forget, &total_rows);
+        cache_close(&cached);
+        if (failed)
+            return 2;
+    }
+    else if (use_cache && cache_writer_open(&cache_writer, cache_path, filepath, col_ptrs, col_count))
+        return 2;
+
+    struct RowBlock block;
+    memset(&block, 0, sizeof(block));
+    if (!is_arrow && !is_cached && row_block_open(&block, ROW_BLOCK_ROWS, accumulated_count, predict_count))
+        return 2;
+
+    // --multiclass counts rows in the confusion matrices of their groups instead of in blocks
+    struct Multiclass multi;
+    if (multiclass)
+        multiclass_open(&multi, accumulated_count);
+
+    struct Shards shards;
+    memset(&shards, 0, sizeof(shards));
+    if (threads > 1) {
+        struct ShardLayout layout;
+        layout.delimiter = delimiter;
+        layout.col_count = col_count;
+        layout.handled = handled;
+        layout.handled_count = handled_count;
+        layout.accumulated = accumulated;
+        layout.accumulated_count = accumulated_count;
+        layout.label_index = label_index;
+        layout.predict_indexes = predict_indexes;
+        layout.predict_count = predict_count;
+        layout.partition_index = partition_index;
+        layout.partition_col = partition_col;
+        layout.categorical_dimensions = categorical_dimensions;
+        layout.forget = forget;
+        if (shards_open(&shards, (size_t)threads, &layout, columns, partition_col ? &partition_dict : NULL, &partitions, &partition_count))
+            return 2;
+    }
+
+    if (metrics_port) {
+        live.block = &block;
+        live.forget = forget;
+        live.partitions = &partitions;
+        live.partition_count = &partition_count;
+        live.partition_dict = partition_col ? &partition_dict : NULL;
+        live.columns = columns;
+        live.col_count = col_count;
+        live.accumulated = accumulated;
+        live.accumulated_count = accumulated_count;
+        live.min_samples = min_samples;
+        live.predict_names = predict_names;
+        live.predict_count = predict_count;
+        if (!filepath)
+            reader_set_wait(&reader, wait_serving_metrics, &live);
+    }
 
     // Process data
+    int verdict = FBT_UNDECIDED;
     time_t start_time = time(NULL);
     if(stream_interval<0) stream_interval = 0;
     time_t last_report_print = start_time-(long int)stream_interval-1;
-    while (1) {
-        if (!fgets(line, sizeof(line), f)) {
+    size_t unfinished = 0;  // bytes of a last line that --incremental leaves for the next run
+    while (!is_arrow && !is_cached) {
+        if (!reader_gets(&reader, line, sizeof(line))) {
             if(filepath) break;  // normal batch exit
+            if (block.n && row_block_push(&block, &partitions, &partition_count, partition_col ? &partition_dict : NULL,
+                                          columns, accumulated, accumulated_count, predict_count, forget))
+                return 2;
             time_t now = time(NULL);
             if(difftime(now, last_report_print)>=stream_interval) {
                 last_report_print = now;
                 printf("\033[2J\033[H\n\n%s----- Live report (%.0f sec) -----%s\n", GREEN, difftime(now, start_time), RESET);
                 printf("FairBench-tiny is running in --stream mode\n");
-                if(!filepath)    
+                if (follow_count)
+                    printf("%sFollowing %zu file(s)%s for appended rows\n", RED, follow_count, RESET);
+                else if(!filepath)    
                     printf("%sCurrently waiting on stdin%s because no data file was provided\n", RED,RESET);
+                double render_start = metrics_port ? metrics_now() : 0.0;
+                if (shards.count && shards_merge(&shards))
+                    return 2;
+                if (refresh_partitions(partitions, partition_count))
+                    return 2;
                 if(!total_rows)
                     printf("\nWaiting for first data line...\n");
                 else
-                    print_report(
+                    report(
+                        partitions,
+                        partition_col ? &partition_dict : NULL,
+                        partition_count,
                         columns,
-                        col_ptrs,
-                        col_count, 
-                        predict_index, 
-                        label_index,
-                        min_samples,
-                        total_rows,
-                        threshold,
-                        show_bars,
-                        show_details
+                        col_count,
+                        accumulated,
+                        accumulated_count,
+                        &options,
+                        rank_partitions,
+                        sampling ? reader_fraction(&reader) : -1.0,
+                        predict_names,
+                        predict_count,
+                        trend_path,
+                        multiclass ? &multi : NULL
                     );
+                if (metrics_port)
+                    metrics_reported(&live.metrics, render_start);
             }
-            clearerr(f);          // EOF reached, wait for more
-            poll_for_data(f);     // e.g. select(), poll(), or sleep()
+            if (f)
+                clearerr(f);      // EOF reached, wait for more
+            if (metrics_port)
+                wait_serving_metrics(&live, reader_fd(&reader));
+            else
+                poll_for_data(reader_fd(&reader));     // e.g. select(), poll(), or sleep()
             continue;
         }
 
-        col_pos = 0;
+        // a last line without a newline may still be being written
+        if (incremental_path && !strchr(line, '\n') && strlen(line) + 1 < sizeof(line)) {
+            unfinished = strlen(line);
+            break;
+        }
+
+        // tokenize the whole row first, so that the partition is known before accumulating
         total_rows++;
-        col_start = 0;
-        col_end = 0;
-        memset(values, 0, sizeof(values));
-        for (size_t i = 0;; ++i) {
-            char c = line[i];
-            if (c == '\r' || c == ' ' || c=='\'' || c=='"') {
-                if(col_start>=col_end)
-                    col_start = i+1;
-                continue;
+        if (metrics_port) {
+            ++live.metrics.rows;
+            live.metrics.bytes += strlen(line);
+            live.metrics.last_row = metrics_now();
+            if (!live.metrics.pending_since)
+                live.metrics.pending_since = live.metrics.last_row;
+        }
+        // with --threads, rows are only framed here and parsed by the shards
+        if (shards.count) {
+            if (shards_row(&shards, line, sizeof(line), &reader))
+                return 2;
+        }
+        else {
+            if (split_row(line, sizeof(line), &reader, delimiter, cell_start, cell_len, &col_pos))
+                return 2;
+            if (col_pos < col_count) {
+                fprintf(stderr, "Error: row has fewer columns than the header\n");
+                return 2;
             }
-            if (c == delimiter || c == '\0' || c == '\n') {
-                size_t current_col = col_pos;
-                if (++col_pos >= MAX_COLS) 
-                    break;
-                // process column
-                if (col_end <= col_start) {
-                    fprintf(stderr, "Error: empty_column\n");
+            if (use_cache && cache_writer_row(&cache_writer, line, cell_start, cell_len))
+                return 2;
+
+            // rows are decoded into a block, whose partitions are opened when it is accumulated
+            size_t r = block.n;
+            if (partition_col) {
+                MHASH_INDEX_UINT partition_pos;
+                if (partition_find(&partition_dict, partition_col, &line[cell_start[partition_index]], cell_len[partition_index], &partition_pos))
                     return 2;
+                block.partition_dims[r] = (uint32_t)partition_pos;
+            }
+
+            for (size_t k = 0; k < handled_count; ++k) {
+                size_t i = handled[k];
+                struct Column *column = &columns[i];
+                if (column_defers(column)) {
+                    column->active_dim = MHASH_EMPTY_SLOT;  // looked up with the rest of the block
+                    continue;
                 }
-                if(col_end-col_start>=MAX_STR_LEN-1) {
-                    fprintf(stderr, "Error: column value too large\n");
+                if (column->handle(column, &line[cell_start[i]], cell_len[i], &values[i]))
                     return 2;
-                }
-                line[col_end] = '\0'; // we will never go back
-                // initialize mhash for the column
-                int col_strategy = columns[current_col].config?columns[current_col].config->status:0;
-                if(columns[current_col].num_dimensions==0) {
-                    size_t table_size = 1;
-                    columns[current_col].dimension_names = malloc(sizeof(char**));
-                    columns[current_col].stats = malloc(sizeof(struct Stats));
-                    memset(columns[current_col].stats, 0, sizeof(struct Stats));
-                    columns[current_col].num_dimensions = 1;
-                    columns[current_col].dimension_names[0] = malloc(col_end - col_start + 1);
-                    memcpy(columns[current_col].dimension_names[0], &line[col_start], col_end - col_start);
-                    columns[current_col].dimension_names[0][col_end - col_start] = '\0';
-                    if (mhash_init(&columns[current_col].map, 
-                        malloc(sizeof(MHASH_INDEX_UINT)*table_size), 
-                        table_size, 
-                        (const void**) columns[current_col].dimension_names, 
-                        1, 
-                        mhash_str_prefix
-                    )) {
-                        fprintf(stderr, "Error: too many categorical values during column %s\n", col_names[current_col]);
-                        return 2;
-                    }
-                    //printf("Initialized column %s with first dimension %s\n", col_names[current_col], columns[current_col].dimension_names[0]);
-                }
-                // each column also has some explicit boolean value
-                int has_been_processed = 0;
-                int is_number = isdigit(line[col_start]) || line[col_start]=='-' || line[col_start]=='+';
-
-                if(col_strategy) {
-                    has_been_processed = 1;
-                    if(col_strategy==CONFIG_STATUS_RANGE) {
-                        char c = line[col_start];
-                        char range_start = columns[current_col].config->range[0];
-                        char range_end = columns[current_col].config->range[1];
-                        columns[current_col].active_dim = (c<range_start || c>range_end)?((MHASH_INDEX_UINT)(range_end-range_start+1)):((MHASH_INDEX_UINT)(c-range_start));
-                    }
-                    else if(col_strategy==CONFIG_STATUS_NUMERIC) 
-                        values[current_col] = atof(&line[col_start]);
-                    else if(col_strategy==CONFIG_STATUS_BINARY)
-                         values[current_col] = strcmp(&line[col_start], columns[current_col].config->binary)?0:1;
-                }
-                
-                if(!has_been_processed && (line[col_start]=='y' || line[col_start]=='Y' || line[col_start]=='1')) 
-                    values[current_col] = 1.0;
-                if(has_been_processed) {
-                }
-                else if(is_number && columns[current_col].num_dimensions >= categorical_dimensions) {
-                    columns[current_col].active_dim = 0; // numeric: single global bucket
-                } 
-                else {
-                    MHASH_UINT pos = mhash_entry_pos(&columns[current_col].map, &line[col_start]);
-                    MHASH_INDEX_UINT dim_idx = columns[current_col].map.table[pos];
-                    int match = 0;
-                    if (dim_idx != MHASH_EMPTY_SLOT) {
-                        char *dim_name = columns[current_col].dimension_names[dim_idx];
-                        size_t dim_len = strlen(dim_name);
-                        if (dim_len == (size_t)(col_end - col_start) && memcmp(dim_name, &line[col_start], dim_len) == 0)
-                            match = 1;
-                    }
-                    if (!match) {
-                        size_t old = columns[current_col].num_dimensions++;
-                        columns[current_col].dimension_names = realloc(columns[current_col].dimension_names, sizeof(char*) * columns[current_col].num_dimensions);
-                        columns[current_col].dimension_names[old] = malloc(col_end - col_start + 1);
-                        memcpy(columns[current_col].dimension_names[old], &line[col_start], col_end - col_start);
-                        columns[current_col].dimension_names[old][col_end-col_start] = '\0';
-                        columns[current_col].stats = realloc(columns[current_col].stats, sizeof(struct Stats) * columns[current_col].num_dimensions);
-                        memset(&columns[current_col].stats[old], 0, sizeof(struct Stats));
-                        size_t close_dim = (columns[current_col].num_dimensions/4)*4+4; // reduce the number of reallocs by /4
-                        size_t sz = close_dim * close_dim + close_dim * 2 + 1;
-                        MHASH_INDEX_UINT *new_table = columns[current_col].map.table;
-                        if(sz!=columns[current_col].map.table_size)
-                            new_table = realloc(columns[current_col].map.table, sizeof(MHASH_INDEX_UINT) * sz);
-                        if (mhash_init(&columns[current_col].map,
-                                    new_table,
-                                    sz,
-                                    (const void**)columns[current_col].dimension_names,
-                                    columns[current_col].num_dimensions,
-                                    mhash_str_prefix)) {
-                            fprintf(stderr, "Error: too many categorical values during column %s\n", col_names[current_col]);
-                            return 2;
-                        }
-                        columns[current_col].active_dim = old;
-                    }
-                    else 
-                        columns[current_col].active_dim = dim_idx;
-                }
-                col_start = i+1;
-                if (c == '\0' || c == '\n') 
-                    break;
-                continue;
             }
-            col_end = i+1;
-        }
-
-        double y_true = values[label_index];
-        double y_pred = values[predict_index];
-        if(forget) {
-            for (size_t i = 0; i < col_count; ++i) {
-                struct Stats *st = &columns[i].stats[columns[i].active_dim];
-                st->tp = st->tp*(1-forget) + forget * y_true * y_pred;
-                st->tn = st->tn*(1-forget) + forget * (1.0 - y_true) * (1.0 - y_pred);
-                st->positives = (1-forget)*st->positives + forget*y_pred;
-                st->labels = st->labels*(1-forget) + forget*y_true;
-                st->count = (1-forget)*st->count+forget;
+
+            if (multiclass) {
+                uint32_t groups[MAX_COLS];
+                for (size_t k = 0; k < accumulated_count; ++k)
+                    groups[k] = (uint32_t)columns[accumulated[k]].active_dim;
+                size_t p = predict_indexes[0];
+                if (multiclass_push(&multi, groups, &line[cell_start[label_index]], cell_len[label_index], &line[cell_start[p]], cell_len[p]))
+                    return 2;
             }
-        }
-        else {
-            for (size_t i = 0; i < col_count; ++i) {
-                struct Stats *st = &columns[i].stats[columns[i].active_dim];
-                st->tp += y_true * y_pred;
-                st->tn += (1.0 - y_true) * (1.0 - y_pred);
-                st->positives += y_pred;
-                st->labels += y_true;
-                st->count += 1.0;
+            else {
+                for (size_t k = 0; k < accumulated_count; ++k) {
+                    size_t i = accumulated[k];
+                    if (columns[i].active_dim != MHASH_EMPTY_SLOT)
+                        block.codes[k][r] = (uint32_t)columns[i].active_dim;
+                    else if (row_block_defer(&block, k, r, &line[cell_start[i]], cell_len[i]))
+                        return 2;
+                }
+                block.y[r] = values[label_index];
+                for (size_t k = 0; k < predict_count; ++k)
+                    block.p[k][r] = values[predict_indexes[k]];
+                block.n = r + 1;
             }
         }
 
-        if (stream_interval) {
-            time_t now = time(NULL);
-            if(difftime(now, last_report_print)>=stream_interval) {
-                last_report_print = now;
-                printf("\033[2J\033[H\n\n%s----- Live report (%.0f sec) -----%s\n", GREEN, difftime(now, start_time), RESET);
-                printf("FairBench-tiny is running in --stream mode\n");
-                if(!filepath)    
-                    printf("%sCurrently waiting on stdin%s because no data file was provided\n", RED,RESET);
-                if(!total_rows)
-                    printf("\nWaiting for first data line...\n");
-                else
-                    print_report(
-                        columns,
-                        col_ptrs,
-                        col_count, 
-                        predict_index, 
-                        label_index,
-                        min_samples,
-                        total_rows,
-                        threshold,
-                        show_bars,
-                        show_details
-                    );
-            }
+        // the block is accumulated once full, and before anything reads the accumulators
+        time_t now = stream_interval ? time(NULL) : 0;
+        int memory_check = max_memory && total_rows % MEMORY_CHECK_ROWS == 0;
+        int bound_check = (tolerance || early_exit) && total_rows % BOUND_CHECK_ROWS == 0;
+        int metrics_check = metrics_port && total_rows % METRICS_CHECK_ROWS == 0;
+        int report_due = stream_interval && difftime(now, last_report_print) >= stream_interval;
+        if ((block.n == block.capacity || memory_check || bound_check || metrics_check || report_due)
+            && row_block_push(&block, &partitions, &partition_count, partition_col ? &partition_dict : NULL,
+                              columns, accumulated, accumulated_count, predict_count, forget))
+            return 2;
+        if (memory_check && fit_memory(max_memory, columns, col_count, accumulated, accumulated_count, &partition_dict, partitions, partition_count))
+            return 2;
+        if (bound_check) {
+            if (tolerance && widest_bound(partitions, partition_count, min_samples) < tolerance)
+                break;
+            if (early_exit && (verdict = partitions_verdict(partitions, partition_count, min_samples, threshold)) != FBT_UNDECIDED)
+                break;
         }
+        if (metrics_check)
+            serve_metrics(&live, -1, 0);
+
+        if (report_due) {
+            last_report_print = now;
+            printf("\033[2J\033[H\n\n%s----- Live report (%.0f sec) -----%s\n", GREEN, difftime(now, start_time), RESET);
+            printf("FairBench-tiny is running in --stream mode\n");
+            if (follow_count)
+                printf("%sFollowing %zu file(s)%s for appended rows\n", RED, follow_count, RESET);
+            else if(!filepath)    
+                printf("%sCurrently waiting on stdin%s because no data file was provided\n", RED,RESET);
+            double render_start = metrics_port ? metrics_now() : 0.0;
+            if (shards.count && shards_merge(&shards))
+                return 2;
+            if (refresh_partitions(partitions, partition_count))
+                return 2;
+            if(!total_rows)
+                printf("\nWaiting for first data line...\n");
+            else
+                report(
+                    partitions,
+                    partition_col ? &partition_dict : NULL,
+                    partition_count,
+                    columns,
+                    col_count,
+                    accumulated,
+                    accumulated_count,
+                    &options,
+                    rank_partitions,
+                    sampling ? reader_fraction(&reader) : -1.0,
+                    predict_names,
+                    predict_count,
+                    trend_path,
+                    multiclass ? &multi : NULL
+                );
+            if (metrics_port)
+                metrics_reported(&live.metrics, render_start);
+        }
+    }
+    if (block.n && row_block_push(&block, &partitions, &partition_count, partition_col ? &partition_dict : NULL,
+                                  columns, accumulated, accumulated_count, predict_count, forget))
+        return 2;
+    row_block_free(&block);
+    if (shards.count) {
+        if (shards_merge(&shards))
+            return 2;
+        shards_close(&shards);
     }
-    fclose(f);
+    double fraction_read = sampling ? reader_fraction(&reader) : -1.0;
+    if ((f || sampling || follow_count) && reader_close(&reader))
+        return 2;
+    if (f)
+        fclose(f);
+    if (use_cache && !is_cached && cache_writer_close(&cache_writer))
+        return 2;
+    if (dict_path && dict_save(dict_path, columns, col_count))
+        return 2;
+    if (incremental_path && state_save(incremental_path, filepath, start_offset + reader.offset - unfinished, header_line, signature, total_rows,
+                                       columns, col_count, partition_col ? &partition_dict : NULL, partitions, partition_count))
+        return 2;
+    if (metrics_port)
+        metrics_close(&live.metrics);
+    free(cache_path);
     if (total_rows == 0) {
         fprintf(stderr, "No data rows found (but headers were read)\n");
         return 2;
     }
 
-    return print_report(
+    int return_code = report(
+        partitions,
+        partition_col ? &partition_dict : NULL,
+        partition_count,
         columns,
-        col_ptrs,
-        col_count, 
-        predict_index, 
-        label_index,
-        min_samples,
-        total_rows,
-        threshold,
-        show_bars,
-        show_details
+        col_count,
+        accumulated,
+        accumulated_count,
+        &options,
+        rank_partitions,
+        fraction_read,
+        predict_names,
+        predict_count,
+        trend_path,
+        multiclass ? &multi : NULL
     );
+    if (multiclass)
+        multiclass_close(&multi);
+    if (early_exit && verdict != FBT_UNDECIDED)
+        printf("Early exit: the threshold is %s at %.0f%% confidence\n", verdict ? "violated" : "met", 100.0 * (1.0 - EARLY_EXIT_ALPHA));
+    else if (early_exit)
+        printf("Early exit: undecided until the end of the data\n");
+    return return_code;
 }
@@ -0,0 +1,99 @@
+#include "mapping.h"
+#include <sys/stat.h>
+
+#ifdef _WIN32
+  #include <windows.h>
+#else
+  #include <fcntl.h>
+  #include <unistd.h>
+  #include <sys/mman.h>
+#endif
+
+int map_file(const char *path, const uint8_t **data, size_t *size, void **mapping) {
+#ifdef _WIN32
+    HANDLE handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (handle == INVALID_HANDLE_VALUE)
+        return 2;
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(handle, &file_size) || file_size.QuadPart == 0) {
+        CloseHandle(handle);
+        return 2;
+    }
+    HANDLE map = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(handle);
+    if (!map)
+        return 2;
+    const uint8_t *view = (const uint8_t *)MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0);
+    if (!view) {
+        CloseHandle(map);
+        return 2;
+    }
+    *data = view;
+    *size = (size_t)file_size.QuadPart;
+    *mapping = map;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return 2;
+    struct stat st;
+    if (fstat(fd, &st) || st.st_size <= 0) {
+        close(fd);
+        return 2;
+    }
+    void *view = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (view == MAP_FAILED)
+        return 2;
+    madvise(view, (size_t)st.st_size, MADV_SEQUENTIAL);
+    *data = (const uint8_t *)view;
+    *size = (size_t)st.st_size;
+    *mapping = NULL;
+#endif
+    return 0;
+}
+
+void unmap_file(const uint8_t *data, size_t size, void *mapping) {
+#ifdef _WIN32
+    (void)size;
+    UnmapViewOfFile(data);
+    CloseHandle((HANDLE)mapping);
+#else
+    (void)mapping;
+    munmap((void *)data, size);
+#endif
+}
+
+int file_identity(const char *path, uint64_t *size, int64_t *mtime) {
+    struct stat st;
+    if (stat(path, &st))
+        return 2;
+    *size = (uint64_t)st.st_size;
+#ifdef __linux__
+    *mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + (int64_t)st.st_mtim.tv_nsec;
+#else
+    *mtime = (int64_t)st.st_mtime;
+#endif
+    return 0;
+}
+
+int file_inode(const char *path, uint64_t *device, uint64_t *inode) {
+    struct stat st;
+    if (stat(path, &st))
+        return 2;
+#ifdef _WIN32
+    *device = 0;
+    *inode = 0;
+#else
+    *device = (uint64_t)st.st_dev;
+    *inode = (uint64_t)st.st_ino;
+#endif
+    return 0;
+}
+
+int file_seek(FILE *f, uint64_t offset) {
+#ifdef _WIN32
+    return _fseeki64(f, (__int64)offset, SEEK_SET) ? 2 : 0;
+#else
+    return fseeko(f, (off_t)offset, SEEK_SET) ? 2 : 0;
+#endif
+}
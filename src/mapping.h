@@ -0,0 +1,24 @@
+#ifndef MAPPING_H
+#define MAPPING_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+// Maps a whole file read-only, advising sequential access. Returns 0 on success and 2 if the
+// file cannot be opened, is empty, or cannot be mapped (without a message).
+int map_file(const char *path, const uint8_t **data, size_t *size, void **mapping);
+void unmap_file(const uint8_t *data, size_t size, void *mapping);
+
+// Reads the size and modification time of a file, which tell whether it changed since
+// something was derived from it. Returns 0 on success.
+int file_identity(const char *path, uint64_t *size, int64_t *mtime);
+
+// Reads the device and inode of a file, which tell whether a path still names the same file
+// (both are 0 where the platform has no inodes). Returns 0 on success.
+int file_inode(const char *path, uint64_t *device, uint64_t *inode);
+
+// Moves f to a byte offset, which may lie past 2 GiB. Returns 0 on success.
+int file_seek(FILE *f, uint64_t offset);
+
+#endif // MAPPING_H
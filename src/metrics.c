@@ -0,0 +1,446 @@
+#include "metrics.h"
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+  #include <winsock2.h>
+  #include <windows.h>
+  #define SEND_FLAGS 0
+  #define NATIVE(s) ((SOCKET)(s))
+  typedef int io_len;
+#else
+  #include <sys/types.h>
+  #include <sys/socket.h>
+  #include <netinet/in.h>
+  #include <arpa/inet.h>
+  #include <fcntl.h>
+  #include <poll.h>
+  #include <unistd.h>
+  #include <errno.h>
+  #ifdef MSG_NOSIGNAL
+    #define SEND_FLAGS MSG_NOSIGNAL  // a client that hangs up must not kill the process
+  #else
+    #define SEND_FLAGS 0
+  #endif
+  #define NATIVE(s) ((int)(s))
+  typedef size_t io_len;
+#endif
+
+static const char *const metric_names[FBT_NUM_METRICS] = {"acc", "tpr", "tnr", "pr"};
+
+double metrics_now(void) {
+#ifdef _WIN32
+    LARGE_INTEGER count, frequency;
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&frequency);
+    return (double)count.QuadPart / (double)frequency.QuadPart;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+#endif
+}
+
+static void close_socket(uintptr_t s) {
+#ifdef _WIN32
+    closesocket((SOCKET)s);
+#else
+    close((int)s);
+#endif
+}
+
+static int set_nonblocking(uintptr_t s) {
+#ifdef _WIN32
+    u_long on = 1;
+    return ioctlsocket((SOCKET)s, FIONBIO, &on) != 0;
+#else
+    int flags = fcntl((int)s, F_GETFL, 0);
+    return flags < 0 || fcntl((int)s, F_SETFL, flags | O_NONBLOCK) < 0;
+#endif
+}
+
+int metrics_open(struct Metrics *metrics, int port) {
+    memset(metrics, 0, sizeof(*metrics));
+    metrics->listener = METRICS_NO_SOCKET;
+    for (size_t c = 0; c < METRICS_MAX_CLIENTS; ++c)
+        metrics->clients[c].socket = METRICS_NO_SOCKET;
+    metrics->start = metrics_now();
+    if (port <= 0 || port > 65535) {
+        fprintf(stderr, "Error: --metrics takes a port in 1..65535\n");
+        return 2;
+    }
+#ifdef _WIN32
+    WSADATA wsa;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa)) {
+        fprintf(stderr, "Error: could not start Windows sockets\n");
+        return 2;
+    }
+    SOCKET s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (s == INVALID_SOCKET) {
+#else
+    int s = socket(AF_INET, SOCK_STREAM, 0);
+    if (s < 0) {
+#endif
+        fprintf(stderr, "Error: could not create the --metrics socket\n");
+        return 2;
+    }
+    int reuse = 1;
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char *)&reuse, sizeof(reuse));
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons((unsigned short)port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    metrics->listener = (uintptr_t)s;
+    if (bind(s, (struct sockaddr *)&address, sizeof(address)) || listen(s, METRICS_MAX_CLIENTS) || set_nonblocking(metrics->listener)) {
+        fprintf(stderr, "Error: could not listen on 127.0.0.1:%d for --metrics\n", port);
+        metrics_close(metrics);
+        return 2;
+    }
+    return 0;
+}
+
+static void drop_client(struct MetricsClient *client) {
+    close_socket(client->socket);
+    free(client->response);
+    client->socket = METRICS_NO_SOCKET;
+    client->response = NULL;
+    client->request_len = 0;
+    client->response_len = 0;
+    client->sent = 0;
+}
+
+void metrics_close(struct Metrics *metrics) {
+    for (size_t c = 0; c < METRICS_MAX_CLIENTS; ++c)
+        if (metrics->clients[c].socket != METRICS_NO_SOCKET)
+            drop_client(&metrics->clients[c]);
+    if (metrics->listener != METRICS_NO_SOCKET)
+        close_socket(metrics->listener);
+    metrics->listener = METRICS_NO_SOCKET;
+#ifdef _WIN32
+    WSACleanup();
+#endif
+}
+
+void metrics_reported(struct Metrics *metrics, double started) {
+    double now = metrics_now();
+    ++metrics->reports;
+    metrics->last_report_seconds = now - started;
+    metrics->report_seconds += now - started;
+    metrics->pending_since = 0.0;
+}
+
+// --- pages
+
+struct Page {
+    char *data;
+    size_t len;
+    size_t capacity;
+    int failed;
+};
+
+static void page_printf(struct Page *page, const char *format, ...) {
+    for (;;) {
+        va_list args;
+        va_start(args, format);
+        size_t room = page->capacity - page->len;
+        int written = page->failed ? 0 : vsnprintf(page->data + page->len, room, format, args);
+        va_end(args);
+        if (page->failed || written < 0)
+            return;
+        if ((size_t)written < room) {
+            page->len += (size_t)written;
+            return;
+        }
+        size_t capacity = page->capacity * 2 + (size_t)written;
+        char *data = realloc(page->data, capacity);
+        if (!data) {
+            page->failed = 1;
+            return;
+        }
+        page->data = data;
+        page->capacity = capacity;
+    }
+}
+
+// a label value, with backslashes, quotes and newlines escaped
+static void page_label(struct Page *page, const char *key, const char *value) {
+    page_printf(page, "%s=\"", key);
+    for (const char *c = value; *c; ++c) {
+        if (*c == '\\' || *c == '"')
+            page_printf(page, "\\%c", *c);
+        else if (*c == '\n')
+            page_printf(page, "\\n");
+        else
+            page_printf(page, "%c", *c);
+    }
+    page_printf(page, "\"");
+}
+
+// opens the labels of a series, with the partition (or predictor) first if there are several
+static void page_series(struct Page *page, const char *name, const struct MetricsSource *source, size_t p) {
+    page_printf(page, "%s{", name);
+    if (source->partition_names) {
+        page_label(page, source->partition_label, source->partition_names[p]);
+        page_printf(page, ",");
+    }
+}
+
+static const char *group_name(const struct MetricsSource *source, size_t k, size_t d, char *id, size_t id_size) {
+    const struct Column *column = &source->columns[source->accumulated[k]];
+    if (column->num_dimensions == 1)
+        return "[number]";  // as in the terminal report
+    if (column->dimension_names && d < column->num_dimensions)
+        return column->dimension_names[d];
+    snprintf(id, id_size, "#%zu", d);
+    return id;
+}
+
+static void render(struct Page *page, const struct Metrics *metrics, const struct MetricsSource *source) {
+    double now = metrics_now();
+    char id[32];
+    page_printf(page, "# HELP fbt_group_metric Metric of a group with at least --members samples.\n# TYPE fbt_group_metric gauge\n");
+    for (size_t p = 0; p < source->partition_count; ++p) {
+        const fbt *state = source->partitions[p];
+        for (size_t k = 0; k < state->attribute_count; ++k) {
+            const struct Attribute *attr = &state->attributes[k];
+            for (size_t d = 0; d < attr->num_groups; ++d) {
+                if (attr->stats[d].count < (double)source->min_samples)
+                    continue;
+                double values[FBT_NUM_METRICS];
+                fbt_metrics(&attr->stats[d], values);
+                for (int m = 0; m < FBT_NUM_METRICS; ++m) {
+                    page_series(page, "fbt_group_metric", source, p);
+                    page_label(page, "attribute", attr->name ? attr->name : "");
+                    page_printf(page, ",");
+                    page_label(page, "group", group_name(source, k, d, id, sizeof(id)));
+                    page_printf(page, ",metric=\"%s\"} %.6f\n", metric_names[m], values[m]);
+                }
+            }
+        }
+    }
+    page_printf(page, "# HELP fbt_group_samples Samples of a group (weighted by --forget).\n# TYPE fbt_group_samples gauge\n");
+    for (size_t p = 0; p < source->partition_count; ++p) {
+        const fbt *state = source->partitions[p];
+        for (size_t k = 0; k < state->attribute_count; ++k) {
+            const struct Attribute *attr = &state->attributes[k];
+            for (size_t d = 0; d < attr->num_groups; ++d) {
+                if (attr->stats[d].count < (double)source->min_samples)
+                    continue;
+                page_series(page, "fbt_group_samples", source, p);
+                page_label(page, "attribute", attr->name ? attr->name : "");
+                page_printf(page, ",");
+                page_label(page, "group", group_name(source, k, d, id, sizeof(id)));
+                page_printf(page, "} %.6f\n", attr->stats[d].count);
+            }
+        }
+    }
+    page_printf(page, "# HELP fbt_summary Summary row of the report.\n# TYPE fbt_summary gauge\n");
+    const char *rows[] = {"min", "weighted_mean", "differentially_fair", "absolutely_fair"};
+    for (size_t p = 0; p < source->partition_count; ++p) {
+        struct fbt_summary summary;
+        fbt_summary(source->partitions[p], source->min_samples, &summary);
+        for (int r = 0; r < 4; ++r) {
+            const double *values = r == 0 ? summary.min : r == 1 ? summary.wmean : r == 2 ? summary.diff_fair : summary.abs_fair;
+            for (int m = 0; m < FBT_NUM_METRICS; ++m) {
+                page_series(page, "fbt_summary", source, p);
+                page_printf(page, "row=\"%s\",metric=\"%s\"} %.6f\n", rows[r], metric_names[m], values[m]);
+            }
+        }
+    }
+    page_printf(page, "# HELP fbt_samples Rows accumulated.\n# TYPE fbt_samples gauge\n");
+    for (size_t p = 0; p < source->partition_count; ++p) {
+        page_printf(page, "fbt_samples");
+        if (source->partition_names) {
+            page_printf(page, "{");
+            page_label(page, source->partition_label, source->partition_names[p]);
+            page_printf(page, "}");
+        }
+        page_printf(page, " %lu\n", source->partitions[p]->total_rows);
+    }
+
+    // per-column counters
+    page_printf(page, "# HELP fbt_mhash_rebuilds_total Rebuilds of the hash table of a column's values.\n# TYPE fbt_mhash_rebuilds_total counter\n");
+    for (size_t i = 0; i < source->col_count; ++i) {
+        page_printf(page, "fbt_mhash_rebuilds_total{");
+        page_label(page, "column", source->columns[i].name);
+        page_printf(page, "} %zu\n", source->columns[i].rebuilds);
+    }
+    page_printf(page, "# HELP fbt_malformed_numbers_total Cells of --numeric columns that are not numbers.\n# TYPE fbt_malformed_numbers_total counter\n");
+    for (size_t i = 0; i < source->col_count; ++i) {
+        page_printf(page, "fbt_malformed_numbers_total{");
+        page_label(page, "column", source->columns[i].name);
+        page_printf(page, "} %zu\n", source->columns[i].malformed);
+    }
+    page_printf(page, "# HELP fbt_evicted_groups_total Groups folded into [other] by --max-memory.\n# TYPE fbt_evicted_groups_total counter\n");
+    for (size_t i = 0; i < source->col_count; ++i) {
+        page_printf(page, "fbt_evicted_groups_total{");
+        page_label(page, "column", source->columns[i].name);
+        page_printf(page, "} %zu\n", source->columns[i].evicted);
+    }
+
+    // ingestion
+    double uptime = now - metrics->start;
+    page_printf(page, "# HELP fbt_rows_total Rows read.\n# TYPE fbt_rows_total counter\nfbt_rows_total %llu\n", metrics->rows);
+    page_printf(page, "# HELP fbt_rows_per_second Rows read per second since the start.\n# TYPE fbt_rows_per_second gauge\nfbt_rows_per_second %.3f\n",
+                uptime > 0.0 ? (double)metrics->rows / uptime : 0.0);
+    page_printf(page, "# HELP fbt_bytes_read_total Bytes of the rows read.\n# TYPE fbt_bytes_read_total counter\nfbt_bytes_read_total %llu\n", metrics->bytes);
+    page_printf(page, "# HELP fbt_idle_polls_total Waits for more input.\n# TYPE fbt_idle_polls_total counter\nfbt_idle_polls_total %llu\n", metrics->idle_polls);
+    page_printf(page, "# HELP fbt_last_row_age_seconds Time since the last row was read.\n# TYPE fbt_last_row_age_seconds gauge\nfbt_last_row_age_seconds %.3f\n",
+                metrics->last_row ? now - metrics->last_row : uptime);
+    page_printf(page, "# HELP fbt_report_lag_seconds Time since the oldest row that the terminal report does not show yet was read.\n# TYPE fbt_report_lag_seconds gauge\nfbt_report_lag_seconds %.3f\n",
+                metrics->pending_since ? now - metrics->pending_since : 0.0);
+    page_printf(page, "# HELP fbt_reports_total Terminal reports rendered.\n# TYPE fbt_reports_total counter\nfbt_reports_total %llu\n", metrics->reports);
+    page_printf(page, "# HELP fbt_report_render_seconds_total Time spent rendering terminal reports.\n# TYPE fbt_report_render_seconds_total counter\nfbt_report_render_seconds_total %.6f\n",
+                metrics->report_seconds);
+    page_printf(page, "# HELP fbt_report_render_seconds Time spent rendering the last terminal report.\n# TYPE fbt_report_render_seconds gauge\nfbt_report_render_seconds %.6f\n",
+                metrics->last_report_seconds);
+    page_printf(page, "# HELP fbt_scrapes_total Pages served.\n# TYPE fbt_scrapes_total counter\nfbt_scrapes_total %llu\n", metrics->scrapes);
+    page_printf(page, "# HELP fbt_uptime_seconds Time since the start.\n# TYPE fbt_uptime_seconds gauge\nfbt_uptime_seconds %.3f\n", uptime);
+}
+
+// prepares the response to a complete request
+static void respond(struct Metrics *metrics, struct MetricsClient *client, const struct MetricsSource *source) {
+    struct Page body;
+    memset(&body, 0, sizeof(body));
+    int found = !strncmp(client->request, "GET /metrics ", 13) || !strncmp(client->request, "GET / ", 6);
+    if (found) {
+        render(&body, metrics, source);
+        ++metrics->scrapes;
+    }
+    else
+        page_printf(&body, "Not found: use /metrics\n");
+    struct Page response;
+    memset(&response, 0, sizeof(response));
+    page_printf(&response, "HTTP/1.1 %s\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+                found ? "200 OK" : "404 Not Found", body.len);
+    if (body.len)
+        page_printf(&response, "%.*s", (int)body.len, body.data);
+    free(body.data);
+    if (body.failed || response.failed) {
+        free(response.data);
+        drop_client(client);
+        return;
+    }
+    client->response = response.data;
+    client->response_len = response.len;
+    client->sent = 0;
+}
+
+static int would_block(void) {
+#ifdef _WIN32
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+#endif
+}
+
+// reads what has arrived of a request, and writes what fits of its response
+static void serve_client(struct Metrics *metrics, struct MetricsClient *client, const struct MetricsSource *source) {
+    if (!client->response) {
+        size_t room = METRICS_REQUEST_SIZE - 1 - client->request_len;
+        long got = (long)recv(NATIVE(client->socket), client->request + client->request_len, (io_len)room, 0);
+        if (got == 0 || (got < 0 && !would_block())) {
+            drop_client(client);
+            return;
+        }
+        if (got < 0)
+            return;
+        client->request_len += (size_t)got;
+        client->request[client->request_len] = '\0';
+        if (!strstr(client->request, "\r\n\r\n")) {
+            if (client->request_len == METRICS_REQUEST_SIZE - 1)
+                drop_client(client);
+            return;
+        }
+        respond(metrics, client, source);
+        if (!client->response)
+            return;
+    }
+    long sent = (long)send(NATIVE(client->socket), client->response + client->sent, (io_len)(client->response_len - client->sent), SEND_FLAGS);
+    if (sent < 0 && !would_block()) {
+        drop_client(client);
+        return;
+    }
+    if (sent > 0)
+        client->sent += (size_t)sent;
+    if (client->sent == client->response_len)
+        drop_client(client);
+}
+
+static void accept_clients(struct Metrics *metrics) {
+    for (size_t c = 0; c < METRICS_MAX_CLIENTS; ++c) {
+        struct MetricsClient *client = &metrics->clients[c];
+        if (client->socket != METRICS_NO_SOCKET)
+            continue;
+#ifdef _WIN32
+        SOCKET s = accept((SOCKET)metrics->listener, NULL, NULL);
+        if (s == INVALID_SOCKET)
+            return;
+#else
+        int s = accept((int)metrics->listener, NULL, NULL);
+        if (s < 0)
+            return;
+#endif
+        client->socket = (uintptr_t)s;
+        if (set_nonblocking(client->socket)) {
+            drop_client(client);
+            continue;
+        }
+    }
+}
+
+void metrics_serve(struct Metrics *metrics, const struct MetricsSource *source, int wait_fd, int timeout_ms) {
+#ifdef _WIN32
+    (void)wait_fd;
+    fd_set readable, writable;
+    FD_ZERO(&readable);
+    FD_ZERO(&writable);
+    FD_SET((SOCKET)metrics->listener, &readable);
+    for (size_t c = 0; c < METRICS_MAX_CLIENTS; ++c) {
+        const struct MetricsClient *client = &metrics->clients[c];
+        if (client->socket != METRICS_NO_SOCKET)
+            FD_SET((SOCKET)client->socket, client->response ? &writable : &readable);
+    }
+    struct timeval timeout = {timeout_ms / 1000, (timeout_ms % 1000) * 1000};
+    if (select(0, &readable, &writable, NULL, &timeout) <= 0)
+        return;
+    if (FD_ISSET((SOCKET)metrics->listener, &readable))
+        accept_clients(metrics);
+    for (size_t c = 0; c < METRICS_MAX_CLIENTS; ++c) {
+        struct MetricsClient *client = &metrics->clients[c];
+        if (client->socket != METRICS_NO_SOCKET
+            && (FD_ISSET((SOCKET)client->socket, &readable) || FD_ISSET((SOCKET)client->socket, &writable)))
+            serve_client(metrics, client, source);
+    }
+#else
+    struct pollfd fds[METRICS_MAX_CLIENTS + 2];
+    size_t client_fd[METRICS_MAX_CLIENTS];
+    nfds_t count = 0;
+    if (wait_fd >= 0) {
+        fds[count].fd = wait_fd;
+        fds[count++].events = POLLIN;
+    }
+    nfds_t listener_fd = count;
+    fds[count].fd = (int)metrics->listener;
+    fds[count++].events = POLLIN;
+    for (size_t c = 0; c < METRICS_MAX_CLIENTS; ++c) {
+        const struct MetricsClient *client = &metrics->clients[c];
+        if (client->socket == METRICS_NO_SOCKET)
+            continue;
+        client_fd[c] = count;
+        fds[count].fd = (int)client->socket;
+        fds[count++].events = client->response ? POLLOUT : POLLIN;
+    }
+    if (poll(fds, count, timeout_ms) <= 0)
+        return;
+    for (size_t c = 0; c < METRICS_MAX_CLIENTS; ++c) {
+        struct MetricsClient *client = &metrics->clients[c];
+        if (client->socket != METRICS_NO_SOCKET && fds[client_fd[c]].revents)
+            serve_client(metrics, client, source);
+    }
+    if (fds[listener_fd].revents & POLLIN)
+        accept_clients(metrics);
+#endif
+}
@@ -0,0 +1,75 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "data.h"
+
+/*
+ * Prometheus endpoint of --metrics port in --stream mode. A listening socket on localhost and
+ * its clients are non-blocking and served by the thread that parses rows: between rows every
+ * few thousand rows, and while waiting on stdin otherwise. Pages are only rendered when a
+ * request has arrived, and a client that reads slowly only keeps its own buffer waiting, so
+ * that scrapes never stall ingestion. Each page holds the fairness of every group and summary
+ * row, and the tool's own counters.
+ */
+
+#define METRICS_MAX_CLIENTS 8
+#define METRICS_REQUEST_SIZE 2048
+#define METRICS_CHECK_ROWS 4096    // rows between checks for requests while rows keep coming
+
+struct MetricsClient {
+    uintptr_t socket;           // METRICS_NO_SOCKET if the slot is free
+    char request[METRICS_REQUEST_SIZE];
+    size_t request_len;
+    char *response;             // NULL until the whole request has arrived
+    size_t response_len;
+    size_t sent;
+};
+
+struct Metrics {
+    uintptr_t listener;
+    struct MetricsClient clients[METRICS_MAX_CLIENTS];
+    double start;               // seconds on the monotonic clock of metrics_now
+    unsigned long long rows;
+    unsigned long long bytes;
+    unsigned long long idle_polls;
+    unsigned long long reports;
+    unsigned long long scrapes;
+    double report_seconds;      // spent rendering terminal reports in total
+    double last_report_seconds;
+    double pending_since;       // when the oldest row that no report shows yet was read, or 0
+    double last_row;            // when the last row was read, or 0
+};
+
+// what pages report on, i.e., the accumulators and the columns that name their groups
+struct MetricsSource {
+    fbt *const *partitions;
+    size_t partition_count;
+    const char *partition_label;        // "partition" or "predict", when partitions have names
+    const char *const *partition_names; // NULL for a single set of accumulators
+    const struct Column *columns;
+    size_t col_count;
+    const size_t *accumulated;
+    size_t accumulated_count;
+    size_t min_samples;
+};
+
+#define METRICS_NO_SOCKET ((uintptr_t)-1)
+
+// Listens on 127.0.0.1:port. Returns 0 on success and 2 on error (with a message).
+int metrics_open(struct Metrics *metrics, int port);
+
+// Accepts clients, reads their requests and writes their pages without blocking. Waits up to
+// timeout_ms for a client or (where poll is available) for wait_fd to become readable first.
+void metrics_serve(struct Metrics *metrics, const struct MetricsSource *source, int wait_fd, int timeout_ms);
+
+// records a terminal report that started rendering at the given time, which shows all rows so far
+void metrics_reported(struct Metrics *metrics, double started);
+
+void metrics_close(struct Metrics *metrics);
+
+// seconds on a monotonic clock
+double metrics_now(void);
+
+#endif // METRICS_H
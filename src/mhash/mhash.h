@@ -132,6 +132,51 @@ static inline void *mhash_check_at(const MHash *ph,
     return (char *)values + ((size_t)entry * sizeof_value);
 }
 
+#if defined(__GNUC__) || defined(__clang__)
+#define MHASH_PREFETCH(p) __builtin_prefetch((const void *)(p))
+#else
+#define MHASH_PREFETCH(p) ((void)(p))
+#endif
+
+// keys that batched lookups hash before resolving any of them (bounds their stack use)
+#ifndef MHASH_BATCH
+#define MHASH_BATCH 32
+#endif
+
+// Looks up n keys like mhash_check_at, writing the value of s[i] (or NULL if absent) to
+// out[i]. Up to MHASH_BATCH keys are first all hashed and their table slots prefetched, then
+// the keys of the entries found are prefetched, and only then compared, so that the cache
+// misses of a batch overlap instead of each lookup waiting for its own.
+static inline void mhash_lookup_batch(const MHash *ph,
+                          const void *const *s,
+                          size_t n,
+                          const void **keys,
+                          void *values,
+                          size_t sizeof_value,
+                          int (*cmp_func)(const void *, const void *),
+                          void **out) {
+    MHASH_UINT slots[MHASH_BATCH];
+    MHASH_INDEX_UINT entries[MHASH_BATCH];
+    for (size_t start = 0; start < n; start += MHASH_BATCH) {
+        size_t count = n - start < MHASH_BATCH ? n - start : MHASH_BATCH;
+        const void *const *batch = s + start;
+        for (size_t i = 0; i < count; ++i) {
+            slots[i] = mhash__concat(ph->hash_func, ph->first_hash_id, ph->num_hashes, batch[i]) % (MHASH_UINT)ph->table_size;
+            MHASH_PREFETCH(&ph->table[slots[i]]);
+        }
+        for (size_t i = 0; i < count; ++i) {
+            entries[i] = ph->table[slots[i]];
+            if (entries[i] != MHASH_EMPTY_SLOT)
+                MHASH_PREFETCH(keys[entries[i]]);
+        }
+        for (size_t i = 0; i < count; ++i) {
+            MHASH_INDEX_UINT entry = entries[i];
+            out[start + i] = entry == MHASH_EMPTY_SLOT || cmp_func(keys[entry], batch[i])
+                             ? NULL : (char *)values + ((size_t)entry * sizeof_value);
+        }
+    }
+}
+
 #ifdef __cplusplus
 }
 #endif
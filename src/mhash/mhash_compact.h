@@ -0,0 +1,190 @@
+/*
+ * Copyright 2025 Emmanouil Krasanakis
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef MHASH_COMPACT_H
+#define MHASH_COMPACT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mhash.h"
+
+/*
+ * Compact variant of mhash for string keys of known length. Each slot is 32 bits wide and
+ * packs, from the lowest bits up, the entry index plus one (8 bits for up to 254 keys,
+ * 16 bits for up to 65534 keys), the key length (up to 255 bytes), and a fingerprint
+ * taken from the high bits of the hash in the remaining 16 or 8 bits. Lookups of absent
+ * keys are almost always rejected from the slot alone, and present keys are confirmed
+ * with a single memcmp of known length instead of strlen followed by a comparison.
+ */
+
+#define MHASH_COMPACT_EMPTY_SLOT 0
+#define MHASH_COMPACT_MAX_KEYS 65534
+#define MHASH_COMPACT_MAX_KEY_LEN 255
+#define MHASH_COMPACT_MAX_TABLE_SIZE (1 << 24)
+
+// combines the hashes of seeds first_hash_id..num_hashes of a key in one call, like mhash_strn_word_multi
+typedef MHASH_UINT (*mhash_len_multi_func)(const void *s, size_t len, MHASH_UINT first_hash_id, MHASH_UINT num_hashes);
+
+typedef struct MHashCompact {
+    uint32_t *table;
+    size_t table_size;
+    MHASH_UINT num_hashes;
+    MHASH_UINT first_hash_id;
+    size_t count;
+    unsigned idx_bits;
+    mhash_len_multi_func hash_func;
+} MHashCompact;
+
+static inline uint32_t mhash_compact__tag(MHASH_UINT h, size_t len, unsigned idx_bits) {
+    uint32_t fingerprint = (uint32_t)(h >> (sizeof(MHASH_UINT) * 8 - (24 - idx_bits)));
+    return ((fingerprint << 8) | (uint32_t)(len & 0xFF)) << idx_bits;
+}
+
+static inline unsigned mhash_compact_idx_bits(size_t count) {
+    return count < 255 ? 8u : 16u;
+}
+
+static inline int mhash_compact_init(MHashCompact *ph,
+                        uint32_t *table,
+                        size_t table_size,
+                        const char **keys,
+                        size_t count,
+                        mhash_len_multi_func hash_func) {
+    if (!ph || !table || !keys || table_size == 0 || count > MHASH_COMPACT_MAX_KEYS)
+        return MHASH_FAILED;
+    ph->table      = table;
+    ph->table_size = table_size;
+    ph->count      = count;
+    ph->hash_func  = hash_func;
+    ph->num_hashes = 0;
+    ph->first_hash_id = 1;
+    ph->idx_bits   = mhash_compact_idx_bits(count);
+
+    for (;;) {
+        for (size_t i = 0; i < table_size; ++i)
+            table[i] = MHASH_COMPACT_EMPTY_SLOT;
+        if (ph->num_hashes >= MHASH_MAX_HASHES)
+            return MHASH_FAILED;
+        ph->num_hashes++;
+        int ok = 1;
+        for (size_t i = 0; i < count; ++i) {
+            size_t len = strlen(keys[i]);
+            if (len > MHASH_COMPACT_MAX_KEY_LEN)
+                return MHASH_FAILED;
+            MHASH_UINT h = hash_func(keys[i], len, ph->first_hash_id, ph->num_hashes);
+            MHASH_UINT idx = h % (MHASH_UINT)table_size;
+            if (table[idx] != MHASH_COMPACT_EMPTY_SLOT) {
+                ok = 0;
+                break;
+            }
+            table[idx] = mhash_compact__tag(h, len, ph->idx_bits) | (uint32_t)(i + 1);
+        }
+        if (ok)
+            return MHASH_OK;
+    }
+}
+
+// (Re)builds the table of ph for the given keys, reallocating ph->table and growing it by
+// 25% whenever the maximum number of hashes does not suffice. Zero-initialize ph before the
+// first call.
+static inline int mhash_compact_build(MHashCompact *ph, const char **keys, size_t count, mhash_len_multi_func hash_func) {
+    size_t table_size = count * 2 + 1;
+    if (ph->table && ph->table_size > table_size)
+        table_size = ph->table_size; // tables only grow, so keys added one by one do not retry small sizes
+    for (;;) {
+        uint32_t *table = ph->table;
+        if (table_size != ph->table_size || !table) {
+            table = (uint32_t *)realloc(ph->table, sizeof(uint32_t) * table_size);
+            if (!table)
+                return MHASH_FAILED;
+            ph->table = table;
+            ph->table_size = table_size;
+        }
+        if (mhash_compact_init(ph, table, table_size, keys, count, hash_func) == MHASH_OK)
+            return MHASH_OK;
+        table_size = table_size + table_size / 4 + 1;
+        if (table_size > MHASH_COMPACT_MAX_TABLE_SIZE)
+            return MHASH_FAILED;
+    }
+}
+
+// Returns the index of the key s of length len among keys, or MHASH_EMPTY_SLOT if absent.
+static inline MHASH_INDEX_UINT mhash_compact_find(const MHashCompact *ph, const char *s, size_t len, const char *const *keys) {
+    if (len > MHASH_COMPACT_MAX_KEY_LEN)
+        return MHASH_EMPTY_SLOT;
+    MHASH_UINT h = ph->hash_func(s, len, ph->first_hash_id, ph->num_hashes);
+    uint32_t slot = ph->table[h % (MHASH_UINT)ph->table_size];
+    uint32_t idx_mask = (1u << ph->idx_bits) - 1;
+    if (slot == MHASH_COMPACT_EMPTY_SLOT || (slot & ~idx_mask) != mhash_compact__tag(h, len, ph->idx_bits))
+        return MHASH_EMPTY_SLOT;
+    MHASH_INDEX_UINT entry = (MHASH_INDEX_UINT)((slot & idx_mask) - 1);
+    const char *key = keys[entry];
+    if (memcmp(key, s, len) || key[len])
+        return MHASH_EMPTY_SLOT;
+    return entry;
+}
+
+// Looks up n keys like mhash_compact_find, writing the index of s[i] of length lens[i] (or
+// MHASH_EMPTY_SLOT) to out[i], in the stages of mhash_lookup_batch: hash and prefetch slots,
+// check tags and prefetch keys, then compare.
+static inline void mhash_compact_find_batch(const MHashCompact *ph, const char *const *s, const size_t *lens, size_t n,
+                                            const char *const *keys, MHASH_INDEX_UINT *out) {
+    MHASH_UINT hashes[MHASH_BATCH];
+    uint32_t idx_mask = (1u << ph->idx_bits) - 1;
+    for (size_t start = 0; start < n; start += MHASH_BATCH) {
+        size_t count = n - start < MHASH_BATCH ? n - start : MHASH_BATCH;
+        for (size_t i = 0; i < count; ++i) {
+            size_t len = lens[start + i];
+            hashes[i] = len > MHASH_COMPACT_MAX_KEY_LEN ? 0 : ph->hash_func(s[start + i], len, ph->first_hash_id, ph->num_hashes);
+            MHASH_PREFETCH(&ph->table[hashes[i] % (MHASH_UINT)ph->table_size]);
+        }
+        for (size_t i = 0; i < count; ++i) {
+            size_t len = lens[start + i];
+            uint32_t slot = ph->table[hashes[i] % (MHASH_UINT)ph->table_size];
+            if (len > MHASH_COMPACT_MAX_KEY_LEN || slot == MHASH_COMPACT_EMPTY_SLOT
+                || (slot & ~idx_mask) != mhash_compact__tag(hashes[i], len, ph->idx_bits)) {
+                out[start + i] = MHASH_EMPTY_SLOT;
+                continue;
+            }
+            out[start + i] = (MHASH_INDEX_UINT)((slot & idx_mask) - 1);
+            MHASH_PREFETCH(keys[out[start + i]]);
+        }
+        for (size_t i = 0; i < count; ++i) {
+            MHASH_INDEX_UINT entry = out[start + i];
+            size_t len = lens[start + i];
+            if (entry != MHASH_EMPTY_SLOT && (memcmp(keys[entry], s[start + i], len) || keys[entry][len]))
+                out[start + i] = MHASH_EMPTY_SLOT;
+        }
+    }
+}
+
+static inline void mhash_compact_free(MHashCompact *ph) {
+    free(ph->table);
+    ph->table = NULL;
+    ph->table_size = 0;
+    ph->count = 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // MHASH_COMPACT_H
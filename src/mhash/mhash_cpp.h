@@ -5,7 +5,9 @@
 #include "mhash_str.h"
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <vector>
+#include <algorithm>
 #include <bit>
 #include <cstring>
 #include <cstdlib>
@@ -33,14 +35,15 @@ public:
     }
     ~MHashMap() { cleanup(); }
 
-    inline void insert(const std::string& key, const ValueType& value) {
-        staged_keys_.push_back(key);
+    inline void insert(std::string_view key, const ValueType& value) {
+        staged_keys_.emplace_back(key);
         staged_values_.push_back(value);
     }
 
-    inline ValueType* get(const std::string& key) {
-        const MHASH_UINT pos = mhash_entry_pos(&mhash_, key.c_str());
-        const MHASH_INDEX_UINT entry_idx = mhash_.table[pos];
+    inline ValueType* get(std::string_view key) {
+        if (table_.empty()) [[unlikely]]
+            return nullptr;
+        const MHASH_INDEX_UINT entry_idx = mhash_.table[entry_pos(key)];
         if (entry_idx == MHASH_EMPTY_SLOT) [[unlikely]]
             return nullptr;
         Entry& e = entries_[entry_idx];
@@ -49,19 +52,55 @@ public:
         return &e.value;
     }
 
-    inline ValueType* get_existing(const std::string& key) {
-        const MHASH_UINT pos = mhash_entry_pos(&mhash_, key.c_str());
-        const MHASH_INDEX_UINT entry_idx = mhash_.table[pos];
+    inline ValueType* get_existing(std::string_view key) {
+        const MHASH_INDEX_UINT entry_idx = mhash_.table[entry_pos(key)];
         //if (entry_idx == MHASH_EMPTY_SLOT) [[unlikely]]
         //    return nullptr;
         Entry& e = entries_[entry_idx];
         return &e.value;
     }
 
-    inline const ValueType* get(const std::string& key) const {
+    inline const ValueType* get(std::string_view key) const {
         return const_cast<MHashMap*>(this)->get(key);
     }
 
+    // Looks up n keys at once, writing the value of keys[i] (or nullptr) to out[i]. Like
+    // mhash_lookup_batch, each batch is hashed with its slots prefetched, then its entries and
+    // their key storage are prefetched, and only then are keys compared.
+    void get_batch(const std::string_view* keys, size_t n, ValueType** out) {
+        if (table_.empty()) [[unlikely]] {
+            std::fill(out, out + n, nullptr);
+            return;
+        }
+        MHASH_UINT slots[MHASH_BATCH];
+        MHASH_INDEX_UINT entries[MHASH_BATCH];
+        for (size_t start = 0; start < n; start += MHASH_BATCH) {
+            const size_t count = std::min<size_t>(n - start, MHASH_BATCH);
+            const std::string_view* batch = keys + start;
+            for (size_t i = 0; i < count; ++i) {
+                slots[i] = entry_pos(batch[i]);
+                MHASH_PREFETCH(&mhash_.table[slots[i]]);
+            }
+            for (size_t i = 0; i < count; ++i) {
+                entries[i] = mhash_.table[slots[i]];
+                if (entries[i] != MHASH_EMPTY_SLOT)
+                    MHASH_PREFETCH(&entries_[entries[i]]);
+            }
+            for (size_t i = 0; i < count; ++i)
+                if (entries[i] != MHASH_EMPTY_SLOT)
+                    MHASH_PREFETCH(entries_[entries[i]].key.data());
+            for (size_t i = 0; i < count; ++i) {
+                const MHASH_INDEX_UINT entry_idx = entries[i];
+                out[start + i] = entry_idx == MHASH_EMPTY_SLOT || entries_[entry_idx].key != batch[i]
+                                 ? nullptr : &entries_[entry_idx].value;
+            }
+        }
+    }
+
+    void get_batch(const std::string_view* keys, size_t n, const ValueType** out) const {
+        const_cast<MHashMap*>(this)->get_batch(keys, n, const_cast<ValueType**>(out));
+    }
+
     inline size_t size() const noexcept { return entries_.size(); }
     inline bool empty() const noexcept { return entries_.empty(); }
 
@@ -93,11 +132,14 @@ private:
         const size_t max_hashes = std::bit_width(n) + 2;
         const size_t max_table_size = 128 * n;
         table_.assign(table_size, MHASH_EMPTY_SLOT);
+        std::vector<KeyView> views(n);
         std::vector<const void*> key_ptrs(n);
-        for (size_t i = 0; i < n; ++i)
-            key_ptrs[i] = entries_[i].key.c_str();
+        for (size_t i = 0; i < n; ++i) {
+            views[i] = {entries_[i].key.data(), entries_[i].key.size()};
+            key_ptrs[i] = &views[i];
+        }
         for (;;) {
-            const int success = (mhash_init(&mhash_, table_.data(), table_size, key_ptrs.data(), n, mhash_str_prefix) == MHASH_OK);
+            const int success = (mhash_init(&mhash_, table_.data(), table_size, key_ptrs.data(), n, hash_view) == MHASH_OK);
             if(success && mhash_.num_hashes < max_hashes) break;
             if(table_size < 16) ++table_size;
             else table_size = table_size + table_size / 5 + 1;
@@ -109,8 +151,28 @@ private:
         }
     }
 
-    static inline MHASH_UINT mhash_entry_pos(const MHash *ph, const void *s) {
-        return mhash__concat(ph->hash_func, ph->num_hashes, s) % (MHASH_UINT)ph->table_size;
+    // Keys are hashed through views, with the prefix hashes of mhash_str_prefix over at most
+    // size bytes, so that lookups of a std::string_view need neither a copy nor a terminating NUL.
+    struct KeyView {
+        const char* data;
+        size_t size;
+    };
+
+    static MHASH_UINT hash_view(const void *s, MHASH_UINT id) {
+        const KeyView* view = static_cast<const KeyView*>(s);
+        MHASH_UINT h = 0x9E3779B97F4A7C15ULL * id;
+        const size_t len = std::min<size_t>(view->size, (size_t)(id * id));
+        for (size_t i = 0; i < len; ++i) {
+            unsigned char c = (unsigned char)view->data[i];
+            if (c == 0) break;
+            h ^= (uint64_t)((uint64_t)c + 0x9E3779B97F4A7C15ULL + (h << 6) + (h >> 2));
+        }
+        return h;
+    }
+
+    inline MHASH_UINT entry_pos(std::string_view key) const {
+        const KeyView view{key.data(), key.size()};
+        return mhash_entry_pos(&mhash_, &view);
     }
     void move_from(MHashMap&& o) noexcept {
         mhash_ = o.mhash_;
@@ -53,6 +53,63 @@ static inline MHASH_UINT mhash_str_prefix(const void *_s, MHASH_UINT id) {
     return h;
 }
 
+/*
+ * Word-at-a-time hashing (a versioned alternative to the prefix hashes). mhash__concat
+ * XORs one hash per seed, and the prefix hashes rescan up to id*id key bytes for every
+ * seed through a byte-serial dependency chain. Here the key is instead read once with
+ * 8-byte loads (the tail is assembled into a zeroed word) into a 64-bit base hash, and each
+ * seed only adds a multiply-xorshift finalizer of that base. Combining num_hashes seeds
+ * therefore costs a single pass over the key plus a few independent register operations
+ * per seed, which the compiler can also vectorize across seeds.
+ */
+
+static inline uint64_t mhash__mix64(uint64_t x) {
+    x *= 0xD6E8FEB86659FD93ULL;
+    x ^= x >> 32;
+    return x;
+}
+
+static inline uint64_t mhash_strn_word_base(const void *_s, size_t len) {
+    const unsigned char *s = (const unsigned char *)_s;
+    uint64_t h = 0x9E3779B97F4A7C15ULL ^ (uint64_t)len;
+    size_t pos = 0;
+    for (; pos + 8 <= len; pos += 8) {
+        uint64_t word;
+        memcpy(&word, s + pos, 8);
+        h = (h ^ word) * 0xBF58476D1CE4E5B9ULL;
+        h ^= h >> 29;
+    }
+    if (pos < len) {
+        // tail bytes are assembled in a register rather than with a variable-length memcpy call
+        uint64_t word = 0;
+        for (size_t k = 0; pos + k < len; ++k)
+            word |= (uint64_t)s[pos + k] << (8 * k);
+        h = (h ^ word) * 0xBF58476D1CE4E5B9ULL;
+        h ^= h >> 29;
+    }
+    return h;
+}
+
+static inline MHASH_UINT mhash_strn_word_multi(const void *s, size_t len, MHASH_UINT first_hash_id, MHASH_UINT num_hashes) {
+    uint64_t base = mhash_strn_word_base(s, len);
+    MHASH_UINT combined = 0;
+    for (MHASH_UINT id = first_hash_id; id <= num_hashes; ++id)
+        combined ^= (MHASH_UINT)mhash__mix64(base + 0x9E3779B97F4A7C15ULL * id);
+    return combined;
+}
+
+static inline MHASH_UINT mhash_strn_word(const void *s, size_t len, MHASH_UINT id) {
+    return mhash_strn_word_multi(s, len, id, id);
+}
+
+static inline MHASH_UINT mhash_str_word_multi(const void *s, MHASH_UINT first_hash_id, MHASH_UINT num_hashes) {
+    return mhash_strn_word_multi(s, strlen((const char *)s), first_hash_id, num_hashes);
+}
+
+static inline MHASH_UINT mhash_str_word(const void *s, MHASH_UINT id) {
+    return mhash_str_word_multi(s, id, id);
+}
+
 static inline int mhash_strcmp(const void *a, const void *b) {
     return strcmp((const char *)a, (const char *)b);
 }
@@ -0,0 +1,131 @@
+#include "multiclass.h"
+
+void multiclass_open(struct Multiclass *multi, size_t attribute_count) {
+    memset(multi, 0, sizeof(struct Multiclass));
+    column_init(&multi->classes, NULL, "classes", 0);
+    multi->attribute_count = attribute_count;
+}
+
+// makes room for the classes met so far, moving each matrix to the larger stride
+static int grow_classes(struct Multiclass *multi, size_t needed) {
+    size_t capacity = multi->capacity ? multi->capacity * 2 : 4;
+    while (capacity < needed)
+        capacity *= 2;
+    for (size_t a = 0; a < multi->attribute_count; ++a) {
+        double *grown = calloc(multi->group_capacity[a] * capacity * capacity + 1, sizeof(double));
+        if (!grown)
+            return 2;
+        for (size_t g = 0; g < multi->groups[a]; ++g)
+            for (size_t y = 0; y < multi->capacity; ++y)
+                memcpy(&grown[(g * capacity + y) * capacity], &multi->matrices[a][(g * multi->capacity + y) * multi->capacity],
+                       sizeof(double) * multi->capacity);
+        free(multi->matrices[a]);
+        multi->matrices[a] = grown;
+    }
+    multi->capacity = capacity;
+    return 0;
+}
+
+static int grow_groups(struct Multiclass *multi, size_t a, size_t needed) {
+    size_t capacity = multi->group_capacity[a] ? multi->group_capacity[a] * 2 : 16;
+    while (capacity < needed)
+        capacity *= 2;
+    size_t stride = multi->capacity * multi->capacity;
+    double *grown = realloc(multi->matrices[a], sizeof(double) * (capacity * stride + 1));
+    if (!grown)
+        return 2;
+    memset(&grown[multi->group_capacity[a] * stride], 0, sizeof(double) * (capacity - multi->group_capacity[a]) * stride);
+    multi->matrices[a] = grown;
+    multi->group_capacity[a] = capacity;
+    return 0;
+}
+
+int multiclass_push(struct Multiclass *multi, const uint32_t *groups, const char *label, size_t label_len,
+                    const char *prediction, size_t prediction_len) {
+    MHASH_INDEX_UINT y, p;
+    if (partition_find(&multi->classes, "classes", label, label_len, &y)
+        || partition_find(&multi->classes, "classes", prediction, prediction_len, &p))
+        return 2;
+    if (multi->classes.num_dimensions > multi->capacity) {
+        if (multi->classes.num_dimensions > MULTICLASS_MAX_CLASSES) {
+            fprintf(stderr, "Error: more than %d classes in the label and predict columns\n", MULTICLASS_MAX_CLASSES);
+            return 2;
+        }
+        if (grow_classes(multi, multi->classes.num_dimensions)) {
+            fprintf(stderr, "Error: out of memory allocating confusion matrices\n");
+            return 2;
+        }
+    }
+    size_t capacity = multi->capacity;
+    for (size_t a = 0; a < multi->attribute_count; ++a) {
+        size_t g = groups[a];
+        if (g >= multi->group_capacity[a] && grow_groups(multi, a, g + 1)) {
+            fprintf(stderr, "Error: out of memory allocating confusion matrices\n");
+            return 2;
+        }
+        if (g >= multi->groups[a])
+            multi->groups[a] = g + 1;
+        ++multi->matrices[a][(g * capacity + y) * capacity + p];
+    }
+    ++multi->total_rows;
+    return 0;
+}
+
+fbt **multiclass_split(const struct Multiclass *multi, const struct Column *columns, const size_t *accumulated, size_t accumulated_count) {
+    size_t k = multi->classes.num_dimensions;
+    size_t capacity = multi->capacity;
+    fbt **split = calloc(k ? k : 1, sizeof(fbt*));
+    double *labels = malloc(sizeof(double) * (capacity ? capacity : 1));
+    double *positives = malloc(sizeof(double) * (capacity ? capacity : 1));
+    if (!split || !labels || !positives) {
+        fprintf(stderr, "Error: out of memory splitting classes\n");
+        exit(2);
+    }
+    for (size_t c = 0; c < k; ++c) {
+        if (!(split[c] = partition_open(columns, accumulated, accumulated_count, 0.0)))
+            exit(2);
+        split[c]->total_rows = multi->total_rows;
+    }
+    for (size_t a = 0; a < multi->attribute_count; ++a) {
+        for (size_t c = 0; c < k; ++c)
+            if (fbt_reserve(split[c], a, multi->groups[a])) {
+                fprintf(stderr, "Error: out of memory splitting classes\n");
+                exit(2);
+            }
+        // the row and column sums of a matrix give the labels and predictions of every class at once
+        for (size_t g = 0; g < multi->groups[a]; ++g) {
+            const double *matrix = &multi->matrices[a][g * capacity * capacity];
+            double count = 0.0;
+            memset(positives, 0, sizeof(double) * k);
+            for (size_t y = 0; y < k; ++y) {
+                labels[y] = 0.0;
+                for (size_t p = 0; p < k; ++p) {
+                    labels[y] += matrix[y * capacity + p];
+                    positives[p] += matrix[y * capacity + p];
+                }
+                count += labels[y];
+            }
+            for (size_t c = 0; c < k; ++c) {
+                struct fbt_stats *st = &split[c]->attributes[a].stats[g];
+                st->tp = matrix[c * capacity + c];
+                st->tn = count - labels[c] - positives[c] + st->tp;
+                st->positives = positives[c];
+                st->labels = labels[c];
+                st->count = count;
+            }
+        }
+    }
+    free(labels);
+    free(positives);
+    return split;
+}
+
+void multiclass_close(struct Multiclass *multi) {
+    for (size_t a = 0; a < multi->attribute_count; ++a)
+        free(multi->matrices[a]);
+    if (multi->classes.map.table_size)
+        mhash_compact_free(&multi->classes.map);
+    for (size_t d = 0; d < multi->classes.num_dimensions; ++d)
+        free(multi->classes.dimension_names[d]);
+    free(multi->classes.dimension_names);
+}
@@ -0,0 +1,41 @@
+#ifndef MULTICLASS_H
+#define MULTICLASS_H
+
+#include "data.h"
+
+/*
+ * --multiclass: labels and predictions that are class names rather than binary values. Both
+ * columns share one dictionary of classes (an mhash, like the groups of a column), and each
+ * group of each accumulated column counts its rows in a K×K confusion matrix of label class by
+ * predicted class, so that a row costs one increment per column however many classes there
+ * are. Reports derive the one-vs-rest stats of every class from the matrices (e.g., the true
+ * positives of class c are the diagonal entry c, and its predicted positives are column c),
+ * and list the classes side by side like several predictors.
+ */
+
+#define MULTICLASS_MAX_CLASSES 256
+
+struct Multiclass {
+    struct Column classes;              // names of the classes, in the order they are met
+    size_t capacity;                    // classes each matrix has room for
+    size_t attribute_count;
+    double *matrices[MAX_COLS];         // per accumulated column, capacity×capacity counts per group, [label][prediction]
+    size_t groups[MAX_COLS];            // groups with a matrix
+    size_t group_capacity[MAX_COLS];
+    unsigned long total_rows;
+};
+
+void multiclass_open(struct Multiclass *multi, size_t attribute_count);
+
+// Counts a row with the given group of each accumulated column and the given label and
+// prediction cells. Returns 0 on success and 2 on error (with a message).
+int multiclass_push(struct Multiclass *multi, const uint32_t *groups, const char *label, size_t label_len,
+                    const char *prediction, size_t prediction_len);
+
+// Opens one accumulator per class (K = multi->classes.num_dimensions), with the one-vs-rest
+// stats of that class for each group. Returns NULL if out of memory (with a message).
+fbt **multiclass_split(const struct Multiclass *multi, const struct Column *columns, const size_t *accumulated, size_t accumulated_count);
+
+void multiclass_close(struct Multiclass *multi);
+
+#endif // MULTICLASS_H
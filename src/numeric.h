@@ -0,0 +1,96 @@
+#ifndef NUMERIC_H
+#define NUMERIC_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define NUMERIC_MAX_DIGITS 19      // decimal digits that always fit in a uint64_t
+#define NUMERIC_MAX_EXACT_POW 22   // largest power of ten that is exact in a double
+#define NUMERIC_MAX_EXACT_INT (((uint64_t)1) << 53)
+
+static const double numeric_pow10[NUMERIC_MAX_EXACT_POW + 1] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// Parses a decimal or scientific literal that spans exactly len bytes (the cell length
+// already known by the tokenizer) and sets *valid to whether the whole cell was a number.
+// Integers and mantissas of up to 2^53 with small exponents are computed exactly with one
+// multiplication or division (the Clinger fast path). Only literals outside that range,
+// which are rare in tabular data, fall back to strtod, which requires s[len] to be '\0'.
+// Malformed cells yield 0.
+static inline double parse_number(const char *s, size_t len, int *valid) {
+    const char *p = s;
+    const char *end = s + len;
+    int negative = 0;
+    if (p != end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        ++p;
+    }
+
+    uint64_t mantissa = 0;
+    int digits = 0;       // significant digits stored in the mantissa
+    int exponent = 0;     // decimal exponent applied to the mantissa
+    int seen_digit = 0;
+    for (; p != end && (unsigned char)(*p - '0') < 10; ++p) {
+        seen_digit = 1;
+        if (digits < NUMERIC_MAX_DIGITS) {
+            mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+            if (mantissa) ++digits;
+        }
+        else
+            ++exponent;
+    }
+    if (p != end && *p == '.') {
+        for (++p; p != end && (unsigned char)(*p - '0') < 10; ++p) {
+            seen_digit = 1;
+            if (digits < NUMERIC_MAX_DIGITS) {
+                mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+                if (mantissa) ++digits;
+                --exponent;
+            }
+        }
+    }
+    if (!seen_digit) {
+        *valid = 0;
+        return 0.0;
+    }
+    if (p != end && (*p == 'e' || *p == 'E')) {
+        ++p;
+        int exp_negative = 0;
+        if (p != end && (*p == '-' || *p == '+')) {
+            exp_negative = *p == '-';
+            ++p;
+        }
+        if (p == end || (unsigned char)(*p - '0') >= 10) {
+            *valid = 0;
+            return 0.0;
+        }
+        int explicit_exponent = 0;
+        for (; p != end && (unsigned char)(*p - '0') < 10; ++p)
+            if (explicit_exponent < 100000)
+                explicit_exponent = explicit_exponent * 10 + (*p - '0');
+        exponent += exp_negative ? -explicit_exponent : explicit_exponent;
+    }
+    if (p != end) {
+        *valid = 0;
+        return 0.0;
+    }
+
+    *valid = 1;
+    double value;
+    if (mantissa == 0)
+        value = 0.0;
+    else if (mantissa <= NUMERIC_MAX_EXACT_INT && exponent >= -NUMERIC_MAX_EXACT_POW && exponent <= NUMERIC_MAX_EXACT_POW) {
+        value = (double)mantissa;
+        if (exponent < 0)
+            value /= numeric_pow10[-exponent];
+        else if (exponent > 0)
+            value *= numeric_pow10[exponent];
+    }
+    else
+        return strtod(s, NULL);
+    return negative ? -value : value;
+}
+
+#endif // NUMERIC_H
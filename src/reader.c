@@ -0,0 +1,396 @@
+#include "reader.h"
+#include "mapping.h"
+#include "follow.h"
+#include "data.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+  #include <windows.h>
+  #include <malloc.h>
+#else
+  #include <fcntl.h>
+  #include <unistd.h>
+  #include <errno.h>
+#endif
+
+void wait_briefly(unsigned *spins) {
+    if (++*spins < 128)
+        return;
+#ifdef _WIN32
+    Sleep(1);
+#else
+    usleep(50);
+#endif
+}
+
+static char *aligned_buffer(size_t size) {
+#ifdef _WIN32
+    return (char *)_aligned_malloc(size, READER_ALIGNMENT);
+#else
+    void *buffer;
+    return posix_memalign(&buffer, READER_ALIGNMENT, size) ? NULL : (char *)buffer;
+#endif
+}
+
+static void aligned_free(char *buffer) {
+#ifdef _WIN32
+    _aligned_free(buffer);
+#else
+    free(buffer);
+#endif
+}
+
+// the I/O thread: fills free buffers in ring order until the end of the file
+#ifdef _WIN32
+static DWORD WINAPI prefetch(LPVOID arg) {
+#else
+static void *prefetch(void *arg) {
+#endif
+    struct Reader *reader = (struct Reader *)arg;
+    size_t filled = 0;
+    for (;;) {
+        unsigned spins = 0;
+        while (filled - atomic_load_explicit(&reader->consumed, memory_order_acquire) == READER_BUFFERS
+               && !atomic_load_explicit(&reader->stop, memory_order_relaxed))
+            wait_briefly(&spins);
+        if (atomic_load_explicit(&reader->stop, memory_order_relaxed))
+            break;
+        size_t slot = filled % READER_BUFFERS;
+        size_t length = fread(reader->buffers[slot], 1, READER_BUFFER_SIZE, reader->f);
+        if (length) {
+            reader->lengths[slot] = length;
+            atomic_store_explicit(&reader->filled, ++filled, memory_order_release);
+        }
+        if (length < READER_BUFFER_SIZE) {
+            reader->failed = ferror(reader->f);
+            atomic_store_explicit(&reader->done, 1, memory_order_release);
+            break;
+        }
+    }
+#ifdef _WIN32
+    return 0;
+#else
+    return NULL;
+#endif
+}
+
+int reader_open(struct Reader *reader, FILE *f, int prefetch_ahead) {
+    memset(reader, 0, sizeof(struct Reader));
+    reader->f = f;
+    atomic_init(&reader->filled, 0);
+    atomic_init(&reader->consumed, 0);
+    atomic_init(&reader->done, 0);
+    atomic_init(&reader->stop, 0);
+    if (!prefetch_ahead)
+        return 0;
+    for (size_t b = 0; b < READER_BUFFERS; ++b)
+        if (!(reader->buffers[b] = aligned_buffer(READER_BUFFER_SIZE))) {
+            fprintf(stderr, "Error: out of memory allocating read buffers\n");
+            return 2;
+        }
+#if defined(POSIX_FADV_SEQUENTIAL)
+    posix_fadvise(fileno(f), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+#ifdef _WIN32
+    reader->thread = CreateThread(NULL, 0, prefetch, reader, 0, NULL);
+    int started = reader->thread != NULL;
+#else
+    int started = pthread_create(&reader->thread, NULL, prefetch, reader) == 0;
+#endif
+    if (!started) {
+        fprintf(stderr, "Error: could not start the reading thread\n");
+        return 2;
+    }
+    reader->threaded = 1;
+    return 0;
+}
+
+static uint64_t splitmix64(uint64_t *state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+int reader_open_sampled(struct Reader *reader, const char *path, double rate, unsigned long seed) {
+    memset(reader, 0, sizeof(struct Reader));
+    const uint8_t *data;
+    if (map_file(path, &data, &reader->size, &reader->mapping)) {
+        fprintf(stderr, "Error opening file: %s\n", path);
+        return 2;
+    }
+    reader->data = (const char *)data;
+    reader->sampled = 1;
+    reader->block_size = READER_MIN_BLOCK;
+    while (reader->size / reader->block_size >= READER_MAX_BLOCKS)
+        reader->block_size *= 2;
+    size_t blocks = (reader->size + reader->block_size - 1) / reader->block_size;
+    reader->blocks = malloc(sizeof(size_t) * (blocks ? blocks : 1));
+    if (!reader->blocks) {
+        fprintf(stderr, "Error: out of memory sampling blocks\n");
+        return 2;
+    }
+    // Bernoulli choice of blocks, then a Fisher-Yates shuffle of the chosen ones
+    uint64_t state = seed;
+    for (size_t b = 0; b < blocks; ++b)
+        if (rate >= 1.0 || (double)(splitmix64(&state) >> 11) * 0x1.0p-53 < rate)
+            reader->blocks[reader->block_count++] = b;
+    for (size_t b = reader->block_count; b > 1; --b) {
+        size_t other = (size_t)(splitmix64(&state) % b);
+        size_t swap = reader->blocks[b - 1];
+        reader->blocks[b - 1] = reader->blocks[other];
+        reader->blocks[other] = swap;
+    }
+    const char *newline = (const char *)memchr(reader->data, '\n', reader->size);
+    reader->header_end = newline ? (size_t)(newline - reader->data) + 1 : reader->size;
+    reader->end = reader->header_end;  // so that the header line is read first
+    reader->bytes_read = reader->header_end;
+    return 0;
+}
+
+int reader_open_followed(struct Reader *reader, const char *const *paths, size_t count) {
+    memset(reader, 0, sizeof(struct Reader));
+    if (!(reader->follow = malloc(sizeof(struct Follow)))) {
+        fprintf(stderr, "Error: out of memory following files\n");
+        return 2;
+    }
+    return follow_open(reader->follow, paths, count);
+}
+
+int reader_fd(const struct Reader *reader) {
+    return reader->follow ? follow_fd(reader->follow) : fileno(reader->f);
+}
+
+double reader_fraction(const struct Reader *reader) {
+    return reader->size ? (double)reader->bytes_read / (double)reader->size : 1.0;
+}
+
+static int is_plain(char c) {
+    return c != '"' && c != '\n' && c != '\r' && !is_delimiter(c);
+}
+
+// the first row that starts at pos or later. Newlines within quoted cells do not end rows, so the
+// first quote after pos - 1 whose neighbours tell it apart (RFC 4180) decides whether the bytes
+// after it are quoted: one that follows a plain byte and ends its cell closes quotes, and one
+// that starts a cell before a plain byte opens them. As rows are at most MAX_LINE_SIZE bytes, a
+// cell quoted at pos closes within that many, and without such quotes pos is outside quotes.
+static size_t row_start(const struct Reader *reader, size_t pos) {
+    if (pos == 0)
+        return 0;
+    if (pos >= reader->size)
+        return reader->size;
+    const char *data = reader->data;
+    size_t i = pos - 1, limit = reader->size - i < MAX_LINE_SIZE ? reader->size : i + MAX_LINE_SIZE;
+    int quoted = 0;
+    for (const char *q = data + i; (q = (const char *)memchr(q, '"', (size_t)(data + limit - q))); ++q) {
+        char before = q > data ? q[-1] : '\n';
+        char after = q + 1 < data + reader->size ? q[1] : '\n';
+        if (is_plain(before) && after != '"' && !is_plain(after)) {
+            i = (size_t)(q - data) + 1;
+            break;
+        }
+        if (is_plain(after) && before != '"' && !is_plain(before)) {
+            i = (size_t)(q - data) + 1;
+            quoted = 1;
+            break;
+        }
+    }
+    for (; i < reader->size; ++i) {
+        if (data[i] == '"')
+            quoted = !quoted;
+        else if (data[i] == '\n' && !quoted)
+            return i + 1;
+    }
+    return reader->size;
+}
+
+// copies the line at pos, up to limit, and counts the bytes read past the end of the block
+static char *sampled_line(struct Reader *reader, char *line, size_t size, size_t limit) {
+    size_t take = limit - reader->pos;
+    if (take > size - 1)
+        take = size - 1;
+    const char *newline = (const char *)memchr(reader->data + reader->pos, '\n', take);
+    if (newline)
+        take = (size_t)(newline - (reader->data + reader->pos)) + 1;
+    memcpy(line, reader->data + reader->pos, take);
+    line[take] = '\0';
+    if (reader->pos + take > reader->end)
+        reader->bytes_read += reader->pos + take - (reader->pos > reader->end ? reader->pos : reader->end);
+    reader->pos += take;
+    return line;
+}
+
+static char *sampled_gets(struct Reader *reader, char *line, size_t size) {
+    while (reader->pos >= reader->end) {
+        if (reader->next_block == reader->block_count)
+            return NULL;
+        size_t block = reader->blocks[reader->next_block++];
+        size_t start = row_start(reader, block * reader->block_size);
+        reader->pos = start > reader->header_end ? start : reader->header_end;
+        reader->end = row_start(reader, (block + 1) * reader->block_size);
+        if (reader->end > reader->pos)
+            reader->bytes_read += reader->end - reader->pos;
+    }
+    return sampled_line(reader, line, size, reader->end);
+}
+
+// the line that continues a row, which is read from the bytes that follow it even past the end
+// of its block, and not from the next block visited
+static char *sampled_rest(struct Reader *reader, char *line, size_t size) {
+    if (reader->pos >= reader->size)
+        return NULL;
+    return sampled_line(reader, line, size, reader->size);
+}
+
+int reader_set_wait(struct Reader *reader, reader_wait wait, void *context) {
+#ifdef _WIN32
+    // pipes cannot be made non-blocking for stdio, so lines are awaited within fgets
+    (void)reader;
+    (void)wait;
+    (void)context;
+    return 1;
+#else
+    if (reader->follow) {
+        // followed files are never read blocking
+        reader->wait = wait;
+        reader->wait_context = context;
+        return 0;
+    }
+    int fd = fileno(reader->f);
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (reader->threaded || reader->sampled || flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+        return 1;
+    reader->wait = wait;
+    reader->wait_context = context;
+    return 0;
+#endif
+}
+
+// fgets on a non-blocking stream, which returns what has arrived of a line when the stream runs
+// dry and sets its error with EAGAIN; the rest of a started line (or of a row) is waited for
+static char *nonblocking_gets(struct Reader *reader, char *line, size_t size, int in_row) {
+    size_t len = 0;
+    line[0] = '\0';
+    for (;;) {
+        if (fgets(line + len, (int)(size - len), reader->f)) {
+            len += strlen(line + len);
+            if (line[len - 1] == '\n' || len + 1 >= size)
+                return line;
+        }
+        if (feof(reader->f) || !ferror(reader->f))
+            return len ? line : NULL;
+#ifndef _WIN32
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            return len ? line : NULL;
+#endif
+        clearerr(reader->f);
+        if (!len && !in_row)
+            return NULL;  // the caller decides what to do while no line is coming in
+        reader->wait(reader->wait_context, fileno(reader->f));
+    }
+}
+
+// the rest of a row in a followed file, which is waited for
+static char *followed_rest(struct Reader *reader, char *line, size_t size) {
+    char *got;
+    while (!(got = follow_gets(reader->follow, line, size, 1))) {
+        if (reader->wait)
+            reader->wait(reader->wait_context, follow_fd(reader->follow));
+        else
+            follow_wait(reader->follow, 100);
+    }
+    return got;
+}
+
+char *reader_gets_rest(struct Reader *reader, char *line, size_t size) {
+    if (reader->sampled)
+        return sampled_rest(reader, line, size);
+    if (reader->follow)
+        return followed_rest(reader, line, size);
+    if (reader->wait)
+        return nonblocking_gets(reader, line, size, 1);
+    return reader_gets(reader, line, size);
+}
+
+char *reader_gets(struct Reader *reader, char *line, size_t size) {
+    if (reader->sampled)
+        return sampled_gets(reader, line, size);
+    if (reader->follow)
+        return follow_gets(reader->follow, line, size, 0);
+    if (reader->wait)
+        return nonblocking_gets(reader, line, size, 0);
+    if (!reader->threaded)
+        return fgets(line, (int)size, reader->f);
+    size_t len = 0;
+    while (len + 1 < size) {
+        size_t consumed = atomic_load_explicit(&reader->consumed, memory_order_relaxed);
+        unsigned spins = 0;
+        while (consumed == atomic_load_explicit(&reader->filled, memory_order_acquire)) {
+            // filled is read again after done, as the last buffer may have been filled in between
+            if (atomic_load_explicit(&reader->done, memory_order_acquire)
+                && consumed == atomic_load_explicit(&reader->filled, memory_order_acquire)) {
+                if (!len)
+                    return NULL;
+                line[len] = '\0';
+                reader->offset += len;
+                return line;
+            }
+            wait_briefly(&spins);
+        }
+        size_t slot = consumed % READER_BUFFERS;
+        const char *buffer = reader->buffers[slot] + reader->pos;
+        size_t available = reader->lengths[slot] - reader->pos;
+        size_t room = size - 1 - len;
+        size_t take = available < room ? available : room;
+        const char *newline = (const char *)memchr(buffer, '\n', take);
+        if (newline)
+            take = (size_t)(newline - buffer) + 1;
+        memcpy(line + len, buffer, take);
+        len += take;
+        reader->pos += take;
+        if (reader->pos == reader->lengths[slot]) {
+            // a line that continues in the next buffer is stitched together on the next iteration
+            reader->pos = 0;
+            atomic_store_explicit(&reader->consumed, consumed + 1, memory_order_release);
+        }
+        if (newline)
+            break;
+    }
+    line[len] = '\0';
+    reader->offset += len;
+    return line;
+}
+
+int reader_close(struct Reader *reader) {
+    if (reader->follow) {
+        follow_close(reader->follow);
+        free(reader->follow);
+        reader->follow = NULL;
+        return 0;
+    }
+    if (reader->sampled) {
+        unmap_file((const uint8_t *)reader->data, reader->size, reader->mapping);
+        free(reader->blocks);
+        reader->sampled = 0;
+        return 0;
+    }
+    if (!reader->threaded)
+        return 0;
+    // the I/O thread may still be waiting for a free buffer if the parser stopped early
+    atomic_store_explicit(&reader->stop, 1, memory_order_relaxed);
+#ifdef _WIN32
+    WaitForSingleObject((HANDLE)reader->thread, INFINITE);
+    CloseHandle((HANDLE)reader->thread);
+#else
+    pthread_join(reader->thread, NULL);
+#endif
+    for (size_t b = 0; b < READER_BUFFERS; ++b)
+        aligned_free(reader->buffers[b]);
+    reader->threaded = 0;
+    if (reader->failed) {
+        fprintf(stderr, "Error: could not read the data file\n");
+        return 2;
+    }
+    return 0;
+}
@@ -0,0 +1,114 @@
+#ifndef READER_H
+#define READER_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#ifndef _WIN32
+  #include <pthread.h>
+#endif
+
+/*
+ * Line reader of CSV inputs. Data files are read ahead by an I/O thread into a ring of
+ * large aligned buffers, which it hands to the parsing thread through a lock-free
+ * single-producer/single-consumer queue, so that reading and parsing overlap. Lines are
+ * returned like fgets returns them, and lines that span two buffers are stitched back
+ * together. Streams (e.g., stdin in --stream mode) are read directly with fgets, since
+ * they may pause and resume. With --metrics, streams are read without blocking, so that
+ * the parsing thread can answer requests while no line is coming in.
+ *
+ * With --sample or --tolerance, files are instead mapped and split into blocks, of which a
+ * random subset is visited in random order, so that unread blocks are never touched and any
+ * prefix of the visited blocks is a random sample. A block holds the rows that start within
+ * it, which are told apart from newlines within quoted values by the quotes around the block's
+ * boundaries, and its last row is read to its end even if that lies in the next block.
+ *
+ * With --follow, lines are instead read from the files that are followed (see follow.h), and
+ * like non-blocking streams, only whole lines are returned while they are still being written.
+ */
+
+#define READER_BUFFERS 4
+#define READER_BUFFER_SIZE (1 << 20)
+#define READER_ALIGNMENT 4096
+#define READER_MIN_BLOCK (1 << 16)
+#define READER_MAX_BLOCKS (1 << 20)
+
+typedef void (*reader_wait)(void *context, int fd);
+
+struct Follow;
+
+struct Reader {
+    FILE *f;
+    int threaded;
+    reader_wait wait;         // called on partial lines of non-blocking streams, until more arrives
+    void *wait_context;
+    char *buffers[READER_BUFFERS];
+    size_t lengths[READER_BUFFERS];
+    atomic_size_t filled;     // buffers handed to the parser so far (written by the I/O thread)
+    atomic_size_t consumed;   // buffers handed back to the I/O thread (written by the parser)
+    atomic_int done;          // set once no buffers follow those filled
+    atomic_int stop;          // asks the I/O thread to stop early
+    int failed;               // a read failed, which the parser reports at the end of the data
+    size_t pos;               // next byte of the buffer being parsed
+    uint64_t offset;          // bytes of the lines returned so far when reading ahead (see --incremental)
+#ifdef _WIN32
+    void *thread;             // HANDLE of the I/O thread
+#else
+    pthread_t thread;
+#endif
+
+    // sampled blocks of a mapped file
+    int sampled;
+    const char *data;
+    size_t size;
+    void *mapping;
+    size_t block_size;
+    size_t *blocks;           // chosen blocks in the order they are visited
+    size_t block_count;
+    size_t next_block;
+    size_t header_end;        // the header line is read first, and belongs to no block
+    size_t end;               // end of the lines of the current block
+    size_t bytes_read;
+
+    struct Follow *follow;    // of --follow, or NULL
+};
+
+// Starts reading f, ahead of the parser if prefetch is set. Returns 0 on success and 2 on
+// error (with a message).
+int reader_open(struct Reader *reader, FILE *f, int prefetch);
+
+// Maps the file at path and keeps each of its blocks with probability rate, in a shuffled order
+// fixed by seed. Returns 0 on success and 2 on error (with a message).
+int reader_open_sampled(struct Reader *reader, const char *path, double rate, unsigned long seed);
+
+// Follows the files at the given paths (which must outlive the reader). Returns 0 on success
+// and 2 on error (with a message).
+int reader_open_followed(struct Reader *reader, const char *const *paths, size_t count);
+
+// a descriptor that becomes readable when more data arrives, for poll or select
+int reader_fd(const struct Reader *reader);
+
+// Returns the fraction of the bytes of a sampled file that were read so far.
+double reader_fraction(const struct Reader *reader);
+
+// Reads the next line into line like fgets, and returns NULL at the end of the data (or, for
+// non-blocking streams, if no line has started arriving yet).
+char *reader_gets(struct Reader *reader, char *line, size_t size);
+
+// Reads the line that continues a row, which non-blocking streams and followed files wait for.
+char *reader_gets_rest(struct Reader *reader, char *line, size_t size);
+
+// Makes a stream non-blocking (where supported), with wait(context, fd) called whenever a line
+// has only partly arrived, which should return once fd is readable or after a short timeout.
+// Returns 0 on success, and 1 if the stream stays blocking.
+int reader_set_wait(struct Reader *reader, reader_wait wait, void *context);
+
+// Stops reading and reports whether any read failed (with a message).
+int reader_close(struct Reader *reader);
+
+// Waits for the other side of a lock-free ring, spinning briefly before sleeping, as it usually
+// catches up within microseconds. spins starts at 0 for each wait.
+void wait_briefly(unsigned *spins);
+
+#endif // READER_H
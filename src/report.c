@@ -1,12 +1,13 @@
-#include "data.h"
+#include "fbt_internal.h"
+#include <stdio.h>
 #include <stdbool.h>
+#include <math.h>
 
 static const char* RESET  = "\033[0m";
 static const char* RED    = "\033[31m";
 static const char* GREEN  = "\033[32m";
 static const char* CYAN   = "\033[36m";
 static const char* BOLD   = "\033[1m";
-#define CHECK_COLS if(acc_col==RED || tpr_col==RED || tnr_col==RED || pr_col==RED) return_code=1;
 
 static inline const char *color_for(double v, double threshold) {
     if (v < threshold)
@@ -26,186 +27,588 @@ static inline void print_bar(double threshold, double value) {
     printf(" %s", RESET);
 }
 
-int print_report(
-    const struct Column *columns,
-    const char **col_names,
-    size_t col_count, 
-    MHASH_INDEX_UINT predict_index, 
-    MHASH_INDEX_UINT label_index,
+// prints one summary row and returns whether any of its values falls below the threshold
+static int print_summary_row(const char *name, const double values[FBT_NUM_METRICS], double threshold, int show_bars) {
+    int violated = 0;
+    for (int m = 0; m < FBT_NUM_METRICS; ++m)
+        if (color_for(values[m], threshold) == RED)
+            violated = 1;
+    printf("%-30s ", name);
+    if (show_bars) {
+        for (int m = 0; m < FBT_NUM_METRICS; ++m)
+            print_bar(threshold, values[m]);
+        printf("\n");
+    }
+    else printf("%s%.3f%s  %s%.3f%s  %s%.3f%s  %s%.3f%s\n",
+           color_for(values[FBT_METRIC_ACC], threshold), values[FBT_METRIC_ACC], RESET,
+           color_for(values[FBT_METRIC_TPR], threshold), values[FBT_METRIC_TPR], RESET,
+           color_for(values[FBT_METRIC_TNR], threshold), values[FBT_METRIC_TNR], RESET,
+           color_for(values[FBT_METRIC_PR], threshold), values[FBT_METRIC_PR], RESET);
+    return violated;
+}
+
+void fbt_metrics(const struct fbt_stats *st, double values[FBT_NUM_METRICS]) {
+    double tp = (double)st->tp;
+    double tn = (double)st->tn;
+    double count = (double)st->count;
+    double pred_pos = (double)st->positives;
+    double label_pos = (double)st->labels;
+    double label_neg = count - label_pos;
+    values[FBT_METRIC_ACC] = count ? (tp + tn) / count : 0.0;
+    values[FBT_METRIC_TPR] = label_pos ? tp / label_pos : 0.0;
+    values[FBT_METRIC_TNR] = label_neg ? tn / label_neg : 0.0;
+    values[FBT_METRIC_PR]  = pred_pos ? pred_pos / count : 0.0;
+}
+
+// Copies the metrics of a group as cached by the last fbt_refresh, or computes them if its stats
+// changed since (or nothing was cached).
+static void group_metrics(const struct Attribute *attr, size_t d, double values[FBT_NUM_METRICS]) {
+    if (d < attr->refreshed && !attr->dirty[d])
+        memcpy(values, attr->metrics[d], sizeof(double) * FBT_NUM_METRICS);
+    else
+        fbt_metrics(&attr->stats[d], values);
+}
+
+// the name of a group, or its id if it has none
+static const char *group_label(const char *const *const *group_names, size_t a, size_t d, char id[32]) {
+    const char *group_name = group_names && group_names[a] ? group_names[a][d] : NULL;
+    if (group_name)
+        return group_name;
+    snprintf(id, 32, "#%zu", d);
+    return id;
+}
+
+static void print_group(const char *attribute, const char *group, const double values[FBT_NUM_METRICS], double threshold, int show_bars) {
+    printf("%-15s%-15s ", attribute ? attribute : "", group);
+    if (show_bars) {
+        for (int m = 0; m < FBT_NUM_METRICS; ++m) {
+            print_bar(threshold, values[m]); printf(" ");
+        }
+        printf("\n");
+    }
+    else printf("%s%.3f%s  %s%.3f%s  %s%.3f%s  %s%.3f%s\n",
+           color_for(values[FBT_METRIC_ACC], threshold), values[FBT_METRIC_ACC], RESET,
+           color_for(values[FBT_METRIC_TPR], threshold), values[FBT_METRIC_TPR], RESET,
+           color_for(values[FBT_METRIC_TNR], threshold), values[FBT_METRIC_TNR], RESET,
+           color_for(values[FBT_METRIC_PR], threshold), values[FBT_METRIC_PR], RESET);
+}
+
+static void summarize_attributes(
+    const fbt *state,
     size_t min_samples,
-    size_t total_rows,
     double threshold,
     int show_bars,
-    int show_details
+    int show_details,
+    const char *const *const *group_names,
+    struct fbt_summary *summary
 ) {
-    int return_code = 0;
+    double wsum[FBT_NUM_METRICS], wsumv[FBT_NUM_METRICS];
+    for (int m = 0; m < FBT_NUM_METRICS; ++m) {
+        summary->min[m] = 1.0;
+        summary->max[m] = 0.0;
+        wsum[m] = 0.0;
+        wsumv[m] = 0.0;
+    }
 
-    if (show_details) {
-        printf("\n%s%-30s%s %sacc%s     %stpr%s     %stnr%s     %spr%s\n",
-               CYAN, "Groups", RESET, BOLD, RESET, BOLD, RESET, BOLD, RESET, BOLD, RESET);
+    // Re-run over attributes to accumulate aggregates
+    for (size_t a = 0; a < state->attribute_count; ++a) {
+        const struct Attribute *attr = &state->attributes[a];
+        for (size_t d = 0; d < attr->num_groups; ++d) {
+            const struct fbt_stats *st = &attr->stats[d];
+            if (st->count < (double)min_samples)
+                continue;
+
+            double values[FBT_NUM_METRICS];
+            group_metrics(attr, d, values);
+            for (int m = 0; m < FBT_NUM_METRICS; ++m) {
+                if (values[m] < summary->min[m]) summary->min[m] = values[m];
+                if (values[m] > summary->max[m]) summary->max[m] = values[m];
+                wsum[m] += st->count; wsumv[m] += st->count * values[m];
+            }
+
+            if (show_details) {
+                char id[32];
+                print_group(attr->name, group_label(group_names, a, d, id), values, threshold, show_bars);
+            }
+        }
     }
 
-    // Initialize aggregate accumulators
-    double acc_min = 1.0, acc_max = 0.0, acc_wsum = 0.0, acc_wsumv = 0.0;
-    double tpr_min = 1.0, tpr_max = 0.0, tpr_wsum = 0.0, tpr_wsumv = 0.0;
-    double tnr_min = 1.0, tnr_max = 0.0, tnr_wsum = 0.0, tnr_wsumv = 0.0;
-    double pr_min  = 1.0, pr_max  = 0.0, pr_wsum  = 0.0, pr_wsumv  = 0.0;
+    // --- Aggregates ---
+    for (int m = 0; m < FBT_NUM_METRICS; ++m) {
+        summary->wmean[m] = wsum[m] ? wsumv[m] / wsum[m] : 0.0;
+        summary->diff_fair[m] = (summary->min[m] > 0.0) ? (summary->min[m] / summary->max[m]) : 0.0;
+        summary->abs_fair[m] = 1.0 - (summary->max[m] - summary->min[m]);
+    }
+}
 
-    // Re-run over valid columns to accumulate aggregates
-    for (size_t i = 0; i < col_count; ++i) {
-        if (i == label_index || i == predict_index)
-            continue;
-        const struct Column *col = &columns[i];
-        if (col->num_dimensions == 0 || !col->stats)
-            continue;
+void fbt_summary(const fbt *state, size_t min_samples, struct fbt_summary *summary) {
+    summarize_attributes(state, min_samples, 0.0, 0, 0, NULL, summary);
+}
 
-        for (size_t d = 0; d < col->num_dimensions; ++d) {
-            struct Stats *st = &col->stats[d];
-            if (st->count < min_samples)
+// half-width of the Wilson score interval of a proportion p over n samples, which unlike the
+// normal approximation does not vanish when p is 0 or 1
+static double wilson_bound(double p, double n) {
+    const double z = 1.96;
+    double z2 = z * z;
+    return z / (1.0 + z2 / n) * sqrt(p * (1.0 - p) / n + z2 / (4.0 * n * n));
+}
+
+// samples in the denominator of each metric
+static void metric_samples(const struct fbt_stats *st, double samples[FBT_NUM_METRICS]) {
+    samples[FBT_METRIC_ACC] = st->count;
+    samples[FBT_METRIC_TPR] = st->labels;
+    samples[FBT_METRIC_TNR] = st->count - st->labels;
+    samples[FBT_METRIC_PR] = st->count;
+}
+
+double fbt_bound(const fbt *state, size_t min_samples) {
+    double widest = 0.0;
+    int any = 0;
+    for (size_t a = 0; a < state->attribute_count; ++a) {
+        const struct Attribute *attr = &state->attributes[a];
+        for (size_t d = 0; d < attr->num_groups; ++d) {
+            const struct fbt_stats *st = &attr->stats[d];
+            if (st->count < (double)min_samples || st->count <= 0.0)
                 continue;
-            int status = col->config?col->config->status:CONFIG_STATUS_AUTO;
-            if (status == CONFIG_STATUS_SKIP)
+            double values[FBT_NUM_METRICS], samples[FBT_NUM_METRICS];
+            fbt_metrics(st, values);
+            metric_samples(st, samples);
+            for (int m = 0; m < FBT_NUM_METRICS; ++m) {
+                if (samples[m] <= 0.0)
+                    continue;
+                double bound = wilson_bound(values[m], samples[m]);
+                widest = bound > widest ? bound : widest;
+            }
+            any = 1;
+        }
+    }
+    return any ? widest : 1.0;
+}
+
+int fbt_violations(const struct fbt_summary *summary, double threshold) {
+    for (int m = 0; m < FBT_NUM_METRICS; ++m)
+        if (summary->min[m] < threshold
+            || summary->wmean[m] < threshold
+            || summary->diff_fair[m] < threshold
+            || summary->abs_fair[m] < threshold)
+            return 1;
+    return 0;
+}
+
+// half-width of a confidence sequence of the mean of n values in [0,1], from the normal mixture
+// boundary of Howard et al. (2021) with variance proxy n/4, which holds at every n at once
+#define SEQUENCE_MIXTURE 25.0  // tightest around a few hundred samples
+static double sequence_bound(double n, double alpha) {
+    double v = n / 4.0 + SEQUENCE_MIXTURE;
+    return sqrt(v * log(v / (SEQUENCE_MIXTURE * alpha * alpha))) / n;
+}
+
+int fbt_verdict(const fbt *state, size_t min_samples, double threshold, double alpha) {
+    size_t groups = 0;
+    for (size_t a = 0; a < state->attribute_count; ++a)
+        for (size_t d = 0; d < state->attributes[a].num_groups; ++d)
+            if (state->attributes[a].stats[d].count >= (double)min_samples && state->attributes[a].stats[d].count > 0.0)
+                ++groups;
+    if (!groups)
+        return FBT_UNDECIDED;
+    // every metric of every group gets an equal share of alpha, and the summary rows are
+    // bounded by combining the lowest and highest values that the groups may take
+    double share = alpha / (double)(groups * FBT_NUM_METRICS);
+    struct fbt_summary low, high;
+    double weights = 0.0;
+    for (int m = 0; m < FBT_NUM_METRICS; ++m) {
+        low.min[m] = high.min[m] = 1.0;
+        low.max[m] = high.max[m] = 0.0;
+        low.wmean[m] = high.wmean[m] = 0.0;
+    }
+    for (size_t a = 0; a < state->attribute_count; ++a) {
+        const struct Attribute *attr = &state->attributes[a];
+        for (size_t d = 0; d < attr->num_groups; ++d) {
+            const struct fbt_stats *st = &attr->stats[d];
+            if (st->count < (double)min_samples || st->count <= 0.0)
                 continue;
+            double values[FBT_NUM_METRICS], samples[FBT_NUM_METRICS];
+            fbt_metrics(st, values);
+            metric_samples(st, samples);
+            for (int m = 0; m < FBT_NUM_METRICS; ++m) {
+                // metrics without samples in their denominator may still become anything
+                double bound = samples[m] > 0.0 ? sequence_bound(samples[m], share) : 1.0;
+                double lo = values[m] - bound < 0.0 ? 0.0 : values[m] - bound;
+                double hi = values[m] + bound > 1.0 ? 1.0 : values[m] + bound;
+                if (lo < low.min[m]) low.min[m] = lo;
+                if (hi < high.min[m]) high.min[m] = hi;
+                if (lo > low.max[m]) low.max[m] = lo;
+                if (hi > high.max[m]) high.max[m] = hi;
+                low.wmean[m] += st->count * lo;
+                high.wmean[m] += st->count * hi;
+            }
+            weights += st->count;
+        }
+    }
+    for (int m = 0; m < FBT_NUM_METRICS; ++m) {
+        low.wmean[m] /= weights;
+        high.wmean[m] /= weights;
+        low.diff_fair[m] = low.min[m] > 0.0 ? low.min[m] / high.max[m] : 0.0;
+        high.diff_fair[m] = low.max[m] > 0.0 ? high.min[m] / low.max[m] : 1.0;
+        if (high.diff_fair[m] > 1.0) high.diff_fair[m] = 1.0;
+        low.abs_fair[m] = 1.0 - (high.max[m] - low.min[m]);
+        high.abs_fair[m] = low.max[m] > high.min[m] ? 1.0 - (low.max[m] - high.min[m]) : 1.0;
+    }
+    if (fbt_violations(&high, threshold))
+        return 1;
+    if (!fbt_violations(&low, threshold))
+        return 0;
+    return FBT_UNDECIDED;
+}
 
-            double tp = (double)st->tp;
-            double tn = (double)st->tn;
-            double count = (double)st->count;
-            double pred_pos = (double)st->positives;
-            double label_pos = (double)st->labels;
-            double label_neg = count - label_pos;
-            double acc = count ? (tp + tn) / count : 0.0;
-            double tpr = label_pos ? tp / label_pos : 0.0;
-            double tnr = label_neg ? tn / label_neg : 0.0;
-            double pr  = pred_pos ? pred_pos / count : 0.0;
-
-            if (acc < acc_min) acc_min = acc;
-            if (acc > acc_max) acc_max = acc;
-            acc_wsum += count; acc_wsumv += count * acc;
-
-            if (tpr < tpr_min) tpr_min = tpr;
-            if (tpr > tpr_max) tpr_max = tpr;
-            tpr_wsum += count; tpr_wsumv += count * tpr;
-
-            if (tnr < tnr_min) tnr_min = tnr;
-            if (tnr > tnr_max) tnr_max = tnr;
-            tnr_wsum += count; tnr_wsumv += count * tnr;
-
-            if (pr < pr_min) pr_min = pr;
-            if (pr > pr_max) pr_max = pr;
-            pr_wsum += count; pr_wsumv += count * pr;
+// a group and how far below the weighted mean its metric is
+struct Deficit {
+    double deficit;
+    size_t attribute;
+    size_t group;
+};
 
-            if (show_details) {
-                const char *acc_color = color_for(acc, threshold);
-                const char *tpr_color = color_for(tpr, threshold);
-                const char *tnr_color = color_for(tnr, threshold);
-                const char *pr_color  = color_for(pr, threshold);
-                
-                if(status==CONFIG_STATUS_RANGE) {
-                    if(d==col->num_dimensions-1)
-                        printf("%-15s%-15s ", col_names[i], "other");
-                    else
-                        printf("%-15s%-15c ", col_names[i], col->config->range[0]+(char)d);
+static void sift_down(struct Deficit *heap, size_t count, size_t i) {
+    for (;;) {
+        size_t smallest = i, left = 2 * i + 1, right = left + 1;
+        if (left < count && heap[left].deficit < heap[smallest].deficit) smallest = left;
+        if (right < count && heap[right].deficit < heap[smallest].deficit) smallest = right;
+        if (smallest == i)
+            return;
+        struct Deficit swap = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = swap;
+        i = smallest;
+    }
+}
 
+// Prints the (at most) options->worst groups furthest below the weighted mean of each metric,
+// worst first. Groups are selected with a min-heap of the largest deficits so far, which takes
+// O(groups log worst) instead of sorting all groups, and only the selected groups are printed.
+// Returns 0 on success and 2 on error (with a message).
+static int print_worst(const fbt *state, const struct fbt_summary *summary, const struct fbt_report_options *options, const char *title) {
+    static const char *const metric_names[FBT_NUM_METRICS] = {"acc", "tpr", "tnr", "pr"};
+    size_t worst = options->worst;
+    struct Deficit *heap = malloc(sizeof(struct Deficit) * worst);
+    if (!heap) {
+        fprintf(stderr, "Error: out of memory selecting the worst groups\n");
+        return 2;
+    }
+    for (int m = 0; m < FBT_NUM_METRICS; ++m) {
+        size_t count = 0;
+        for (size_t a = 0; a < state->attribute_count; ++a) {
+            const struct Attribute *attr = &state->attributes[a];
+            for (size_t d = 0; d < attr->num_groups; ++d) {
+                if (attr->stats[d].count < (double)options->min_samples)
+                    continue;
+                double values[FBT_NUM_METRICS];
+                group_metrics(attr, d, values);
+                double deficit = summary->wmean[m] - values[m];
+                if (deficit <= 0.0 || (count == worst && deficit <= heap[0].deficit))
+                    continue;
+                struct Deficit entry = {deficit, a, d};
+                if (count < worst) {
+                    // sift up
+                    size_t i = count++;
+                    while (i && heap[(i - 1) / 2].deficit > entry.deficit) {
+                        heap[i] = heap[(i - 1) / 2];
+                        i = (i - 1) / 2;
+                    }
+                    heap[i] = entry;
                 }
                 else {
-                    const char *dim_name = col->num_dimensions==1?"[number]":col->dimension_names[d];
-                    printf("%-15s%-15s ", col_names[i], dim_name);
-                }
-
-                if (show_bars) {
-                    print_bar(threshold, acc); printf(" ");
-                    print_bar(threshold, tpr); printf(" ");
-                    print_bar(threshold, tnr); printf(" ");
-                    print_bar(threshold, pr);  printf(" ");
-                    printf("\n");
+                    heap[0] = entry;
+                    sift_down(heap, count, 0);
                 }
-                else printf("%s%.3f%s  %s%.3f%s  %s%.3f%s  %s%.3f%s\n",
-                       acc_color, acc, RESET,
-                       tpr_color, tpr, RESET,
-                       tnr_color, tnr, RESET,
-                       pr_color, pr, RESET);
             }
         }
+        // popping the smallest deficit into the back of the heap leaves it sorted worst first
+        for (size_t end = count; end > 1; --end) {
+            struct Deficit smallest = heap[0];
+            heap[0] = heap[end - 1];
+            heap[end - 1] = smallest;
+            sift_down(heap, end - 1, 0);
+        }
+        char header[64];
+        snprintf(header, sizeof(header), "Worst %zu by %s%s%.20s", worst, metric_names[m], title ? " of " : "", title ? title : "");
+        printf("\n%s%-30s%s %sacc%s     %stpr%s     %stnr%s     %spr%s\n",
+               CYAN, header, RESET, BOLD, RESET, BOLD, RESET, BOLD, RESET, BOLD, RESET);
+        if (!count)
+            printf("(no group below the weighted mean)\n");
+        for (size_t i = 0; i < count; ++i) {
+            const struct Attribute *attr = &state->attributes[heap[i].attribute];
+            double values[FBT_NUM_METRICS];
+            char id[32];
+            group_metrics(attr, heap[i].group, values);
+            print_group(attr->name, group_label(options->group_names, heap[i].attribute, heap[i].group, id), values, options->threshold, options->show_bars);
+        }
     }
+    free(heap);
+    return 0;
+}
 
-    // --- Aggregates ---
-    double acc_wmean = acc_wsum ? acc_wsumv / acc_wsum : 0.0;
-    double tpr_wmean = tpr_wsum ? tpr_wsumv / tpr_wsum : 0.0;
-    double tnr_wmean = tnr_wsum ? tnr_wsumv / tnr_wsum : 0.0;
-    double pr_wmean  = pr_wsum  ? pr_wsumv  / pr_wsum  : 0.0;
+int fbt_report(const fbt *state, const struct fbt_report_options *options) {
+    int return_code = 0;
+    double threshold = options->threshold;
+    int show_bars = options->show_bars;
+    int show_details = options->show_details && !options->worst;  // --worst shows a selection instead
 
-    double acc_diff_fair = (acc_min > 0.0) ? (acc_min / acc_max) : 0.0;
-    double tpr_diff_fair = (tpr_min > 0.0) ? (tpr_min / tpr_max) : 0.0;
-    double tnr_diff_fair = (tnr_min > 0.0) ? (tnr_min / tnr_max) : 0.0;
-    double pr_diff_fair  = (pr_min  > 0.0) ? (pr_min  / pr_max)  : 0.0;
+    if (show_details) {
+        printf("\n%s%-30s%s %sacc%s     %stpr%s     %stnr%s     %spr%s\n",
+               CYAN, "Groups", RESET, BOLD, RESET, BOLD, RESET, BOLD, RESET, BOLD, RESET);
+    }
 
-    double acc_abs_fair = 1.0 - (acc_max - acc_min);
-    double tpr_abs_fair = 1.0 - (tpr_max - tpr_min);
-    double tnr_abs_fair = 1.0 - (tnr_max - tnr_min);
-    double pr_abs_fair  = 1.0 - (pr_max  - pr_min);
+    struct fbt_summary summary;
+    summarize_attributes(state, options->min_samples, threshold, show_bars, show_details, options->group_names, &summary);
+    if (options->worst && print_worst(state, &summary, options, NULL))
+        return 2;
 
     printf("\n%s%-30s%s %sacc%s     %stpr%s     %stnr%s     %spr%s\n",
            CYAN, "Summary", RESET, BOLD, RESET, BOLD, RESET, BOLD, RESET, BOLD, RESET);
+    return_code |= print_summary_row("min", summary.min, threshold, show_bars);
+    return_code |= print_summary_row("weighted mean", summary.wmean, threshold, show_bars);
+    return_code |= print_summary_row("differentially fair", summary.diff_fair, threshold, show_bars);
+    return_code |= print_summary_row("absolutely fair", summary.abs_fair, threshold, show_bars);
 
-    const char *acc_col, *tpr_col, *tnr_col, *pr_col;
+    printf("\nSamples: %lu\n", state->total_rows);
+    printf("Threshold: %.2f\n", threshold);
+    return return_code;
+}
 
-    // --- MIN ---
-    acc_col = color_for(acc_min, threshold);
-    tpr_col = color_for(tpr_min, threshold);
-    tnr_col = color_for(tnr_min, threshold);
-    pr_col  = color_for(pr_min, threshold);
-    CHECK_COLS
-    printf("%-30s ", "min");
-    if (show_bars) { print_bar(threshold, acc_min); print_bar(threshold, tpr_min); print_bar(threshold, tnr_min); print_bar(threshold, pr_min); printf("\n");}
-    else printf("%s%.3f%s  %s%.3f%s  %s%.3f%s  %s%.3f%s\n",
-           acc_col, acc_min, RESET,
-           tpr_col, tpr_min, RESET,
-           tnr_col, tnr_min, RESET,
-           pr_col, pr_min, RESET);
-
-    // --- WEIGHTED MEAN ---
-    acc_col = color_for(acc_wmean, threshold);
-    tpr_col = color_for(tpr_wmean, threshold);
-    tnr_col = color_for(tnr_wmean, threshold);
-    pr_col  = color_for(pr_wmean, threshold);
-    CHECK_COLS
-    printf("%-30s ", "weighted mean");
-    if (show_bars) { print_bar(threshold, acc_wmean); print_bar(threshold, tpr_wmean); print_bar(threshold, tnr_wmean); print_bar(threshold, pr_wmean); printf("\n");}
-    else printf("%s%.3f%s  %s%.3f%s  %s%.3f%s  %s%.3f%s\n",
-           acc_col, acc_wmean, RESET,
-           tpr_col, tpr_wmean, RESET,
-           tnr_col, tnr_wmean, RESET,
-           pr_col, pr_wmean, RESET);
-
-    // --- DIFFERENTIALLY FAIR ---
-    acc_col = color_for(acc_diff_fair, threshold);
-    tpr_col = color_for(tpr_diff_fair, threshold);
-    tnr_col = color_for(tnr_diff_fair, threshold);
-    pr_col  = color_for(pr_diff_fair, threshold);
-    CHECK_COLS
-    printf("%-30s ", "differentially fair");
-    if (show_bars) { print_bar(threshold, acc_diff_fair); print_bar(threshold, tpr_diff_fair); print_bar(threshold, tnr_diff_fair); print_bar(threshold, pr_diff_fair); printf("\n");}
-    else printf("%s%.3f%s  %s%.3f%s  %s%.3f%s  %s%.3f%s\n",
-           acc_col, acc_diff_fair, RESET,
-           tpr_col, tpr_diff_fair, RESET,
-           tnr_col, tnr_diff_fair, RESET,
-           pr_col, pr_diff_fair, RESET);
-
-    // --- ABSOLUTELY FAIR ---
-    acc_col = color_for(acc_abs_fair, threshold);
-    tpr_col = color_for(tpr_abs_fair, threshold);
-    tnr_col = color_for(tnr_abs_fair, threshold);
-    pr_col  = color_for(pr_abs_fair, threshold);
-    CHECK_COLS
-    printf("%-30s ", "absolutely fair");
-    if (show_bars) { print_bar(threshold, acc_abs_fair); print_bar(threshold, tpr_abs_fair); print_bar(threshold, tnr_abs_fair); print_bar(threshold, pr_abs_fair); printf("\n");}
-    else printf("%s%.3f%s  %s%.3f%s  %s%.3f%s  %s%.3f%s\n",
-           acc_col, acc_abs_fair, RESET,
-           tpr_col, tpr_abs_fair, RESET,
-           tnr_col, tnr_abs_fair, RESET,
-           pr_col, pr_abs_fair, RESET);
+// a partition with its lowest absolutely fair value, by which partitions are ranked
+struct Ranked {
+    double worst;
+    size_t partition;
+};
+
+static int compare_partition_rank(const void *a, const void *b) {
+    const struct Ranked *ra = (const struct Ranked *)a;
+    const struct Ranked *rb = (const struct Ranked *)b;
+    if (ra->worst < rb->worst) return -1;
+    if (ra->worst > rb->worst) return 1;
+    return ra->partition < rb->partition ? -1 : (ra->partition > rb->partition);
+}
+
+int print_partitions(
+    fbt *const *partitions,
+    const char *const *partition_names,
+    size_t partition_count,
+    const struct fbt_report_options *options,
+    int rank
+) {
+    int return_code = 0;
+    if (!rank) {
+        size_t total_rows = 0;
+        for (size_t p = 0; p < partition_count; ++p) {
+            printf("\n%s===== Partition: %s =====%s\n", BOLD, partition_names[p], RESET);
+            int code = fbt_report(partitions[p], options);
+            if (code == 2)
+                return 2;
+            return_code |= code;
+            total_rows += partitions[p]->total_rows;
+        }
+        printf("\nPartitions: %zu (%zu samples)\n", partition_count, total_rows);
+        return return_code;
+    }
+
+    // ranked table of the partitions, worst absolute fairness first
+    struct fbt_summary *summaries = malloc(sizeof(struct fbt_summary) * (partition_count ? partition_count : 1));
+    struct Ranked *order = malloc(sizeof(struct Ranked) * (partition_count ? partition_count : 1));
+    if (!summaries || !order) {
+        free(summaries);
+        free(order);
+        fprintf(stderr, "Error: out of memory ranking partitions\n");
+        return 2;
+    }
+    size_t total_rows = 0;
+    for (size_t p = 0; p < partition_count; ++p) {
+        fbt_summary(partitions[p], options->min_samples, &summaries[p]);
+        return_code |= fbt_violations(&summaries[p], options->threshold);
+        total_rows += partitions[p]->total_rows;
+        order[p].worst = 1.0;
+        for (int m = 0; m < FBT_NUM_METRICS; ++m)
+            if (summaries[p].abs_fair[m] < order[p].worst)
+                order[p].worst = summaries[p].abs_fair[m];
+        order[p].partition = p;
+    }
+    qsort(order, partition_count, sizeof(struct Ranked), compare_partition_rank);
+
+    printf("\n%s%-20s%s%s%10s%s %sacc%s     %stpr%s     %stnr%s     %spr%s\n",
+           CYAN, "Partitions", RESET, BOLD, "samples", RESET, BOLD, RESET, BOLD, RESET, BOLD, RESET, BOLD, RESET);
+    for (size_t r = 0; r < partition_count; ++r) {
+        size_t p = order[r].partition;
+        char name[64];
+        snprintf(name, sizeof(name), "%-20.20s%10lu", partition_names[p], partitions[p]->total_rows);
+        print_summary_row(name, summaries[p].abs_fair, options->threshold, options->show_bars);
+    }
+    printf("\nRanked by absolute fairness (worst first)\n");
+    printf("Partitions: %zu (%zu samples)\n", partition_count, total_rows);
+    printf("Threshold: %.2f\n", options->threshold);
+    free(summaries);
+    free(order);
+    return return_code;
+}
+
+// a bucket with its label, which sorts in time order as labels are ISO 8601
+struct Timed {
+    const char *name;
+    size_t bucket;
+};
+
+static int compare_bucket_time(const void *a, const void *b) {
+    return strcmp(((const struct Timed *)a)->name, ((const struct Timed *)b)->name);
+}
+
+// positions of the buckets in time order, or NULL if out of memory (with a message)
+static size_t *time_order(const char *const *bucket_names, size_t bucket_count) {
+    size_t *order = malloc(sizeof(size_t) * (bucket_count ? bucket_count : 1));
+    struct Timed *timed = malloc(sizeof(struct Timed) * (bucket_count ? bucket_count : 1));
+    if (!order || !timed) {
+        free(order);
+        free(timed);
+        fprintf(stderr, "Error: out of memory ordering buckets\n");
+        return NULL;
+    }
+    for (size_t b = 0; b < bucket_count; ++b) {
+        timed[b].name = bucket_names[b];
+        timed[b].bucket = b;
+    }
+    qsort(timed, bucket_count, sizeof(struct Timed), compare_bucket_time);
+    for (size_t b = 0; b < bucket_count; ++b)
+        order[b] = timed[b].bucket;
+    free(timed);
+    return order;
+}
+
+int print_trend(
+    fbt *const *buckets,
+    const char *const *bucket_names,
+    size_t bucket_count,
+    const struct fbt_report_options *options
+) {
+    int return_code = 0;
+    size_t *order = time_order(bucket_names, bucket_count);
+    if (!order)
+        return 2;
+    size_t total_rows = 0;
+    printf("\n%s%-20s%s%s%10s%s %sacc%s     %stpr%s     %stnr%s     %spr%s\n",
+           CYAN, "Buckets", RESET, BOLD, "samples", RESET, BOLD, RESET, BOLD, RESET, BOLD, RESET, BOLD, RESET);
+    for (size_t r = 0; r < bucket_count; ++r) {
+        size_t b = order[r];
+        struct fbt_summary summary;
+        fbt_summary(buckets[b], options->min_samples, &summary);
+        char name[64];
+        snprintf(name, sizeof(name), "%-20.20s%10lu", bucket_names[b], buckets[b]->total_rows);
+        return_code |= print_summary_row(name, summary.abs_fair, options->threshold, options->show_bars);
+        total_rows += buckets[b]->total_rows;
+    }
+    printf("\nAbsolute fairness per bucket (in time order)\n");
+    printf("Buckets: %zu (%zu samples)\n", bucket_count, total_rows);
+    printf("Threshold: %.2f\n", options->threshold);
+    free(order);
+    return return_code;
+}
+
+int trend_save(const char *path, fbt *const *buckets, const char *const *bucket_names, size_t bucket_count, size_t min_samples) {
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        fprintf(stderr, "Error: could not write %s\n", path);
+        return 2;
+    }
+    const char *summaries[] = {"min", "wmean", "diff_fair", "abs_fair"};
+    const char *metrics[] = {"acc", "tpr", "tnr", "pr"};
+    fprintf(f, "bucket,samples");
+    for (int r = 0; r < 4; ++r)
+        for (int m = 0; m < FBT_NUM_METRICS; ++m)
+            fprintf(f, ",%s_%s", summaries[r], metrics[m]);
+    fprintf(f, "\n");
+    size_t *order = time_order(bucket_names, bucket_count);
+    if (!order) {
+        fclose(f);
+        return 2;
+    }
+    for (size_t r = 0; r < bucket_count; ++r) {
+        size_t b = order[r];
+        struct fbt_summary summary;
+        fbt_summary(buckets[b], min_samples, &summary);
+        const double *rows[] = {summary.min, summary.wmean, summary.diff_fair, summary.abs_fair};
+        fprintf(f, "%s,%lu", bucket_names[b], buckets[b]->total_rows);
+        for (int k = 0; k < 4; ++k)
+            for (int m = 0; m < FBT_NUM_METRICS; ++m)
+                fprintf(f, ",%.6f", rows[k][m]);
+        fprintf(f, "\n");
+    }
+    free(order);
+    if (fclose(f)) {
+        fprintf(stderr, "Error: could not write %s\n", path);
+        return 2;
+    }
+    return 0;
+}
+
+int print_predictors(
+    fbt *const *predictors,
+    const char *const *predictor_names,
+    size_t predictor_count,
+    const struct fbt_report_options *options,
+    const char *kind
+) {
+    int return_code = 0;
+    double threshold = options->threshold;
+    int show_bars = options->show_bars;
+    char name[64];
+
+    // predictors see the same rows, so that their groups and counts are those of the first
+    if (options->show_details && !options->worst) {
+        printf("\n%s%-30s%s %sacc%s     %stpr%s     %stnr%s     %spr%s\n",
+               CYAN, "Groups", RESET, BOLD, RESET, BOLD, RESET, BOLD, RESET, BOLD, RESET);
+        const fbt *first = predictors[0];
+        for (size_t a = 0; a < first->attribute_count; ++a) {
+            const struct Attribute *attr = &first->attributes[a];
+            for (size_t d = 0; d < attr->num_groups; ++d) {
+                if (attr->stats[d].count < (double)options->min_samples)
+                    continue;
+                char id[32];
+                printf("%-15s%-15s\n", attr->name ? attr->name : "", group_label(options->group_names, a, d, id));
+                for (size_t k = 0; k < predictor_count; ++k) {
+                    double values[FBT_NUM_METRICS];
+                    group_metrics(&predictors[k]->attributes[a], d, values);
+                    snprintf(name, sizeof(name), "  %.28s", predictor_names[k]);
+                    print_summary_row(name, values, threshold, show_bars);
+                }
+            }
+        }
+    }
+
+    struct fbt_summary *summaries = malloc(sizeof(struct fbt_summary) * predictor_count);
+    if (!summaries) {
+        fprintf(stderr, "Error: out of memory comparing predictors\n");
+        return 2;
+    }
+    for (size_t k = 0; k < predictor_count; ++k) {
+        fbt_summary(predictors[k], options->min_samples, &summaries[k]);
+        if (options->worst && print_worst(predictors[k], &summaries[k], options, predictor_names[k])) {
+            free(summaries);
+            return 2;
+        }
+    }
+
+    printf("\n%s%-30s%s %sacc%s     %stpr%s     %stnr%s     %spr%s\n",
+           CYAN, "Summary", RESET, BOLD, RESET, BOLD, RESET, BOLD, RESET, BOLD, RESET);
+    const char *rows[] = {"min", "weighted mean", "differentially fair", "absolutely fair"};
+    for (int r = 0; r < 4; ++r) {
+        printf("%s\n", rows[r]);
+        for (size_t k = 0; k < predictor_count; ++k) {
+            const struct fbt_summary *summary = &summaries[k];
+            const double *values = r == 0 ? summary->min : r == 1 ? summary->wmean : r == 2 ? summary->diff_fair : summary->abs_fair;
+            snprintf(name, sizeof(name), "  %.28s", predictor_names[k]);
+            return_code |= print_summary_row(name, values, threshold, show_bars);
+        }
+    }
 
-    printf("\nSamples: %lu\n", total_rows);
+    printf("\n%s: %zu\n", kind, predictor_count);
+    printf("Samples: %lu\n", predictors[0]->total_rows);
     printf("Threshold: %.2f\n", threshold);
+    free(summaries);
     return return_code;
 }
@@ -0,0 +1,471 @@
+#include "shards.h"
+#include <math.h>
+
+#ifdef _WIN32
+  #include <windows.h>
+  #define PARSER_RETURN DWORD WINAPI
+#else
+  #include <unistd.h>
+  #define PARSER_RETURN void *
+#endif
+
+// waits for a batch, sleeping longer once the input has been quiet for a while (e.g., an idle stream)
+static void wait_for_batch(unsigned *spins) {
+    if (*spins < 4096) {
+        wait_briefly(spins);
+        return;
+    }
+#ifdef _WIN32
+    Sleep(1);
+#else
+    usleep(1000);
+#endif
+}
+
+// accumulates the rows of a batch into the parser's own groups and partitions
+static int shard_parse(struct Shard *shard, char *batch, size_t length) {
+    const struct ShardLayout *layout = shard->layout;
+    struct RowBlock *block = &shard->block;
+    struct Column *partition_dict = layout->partition_col ? &shard->partition_dict : NULL;
+    size_t cell_start[MAX_COLS], cell_len[MAX_COLS], cell_count;
+    double values[MAX_COLS];
+    memset(values, 0, sizeof(values));
+    for (size_t pos = 0; pos < length;) {
+        char *row = batch + pos;
+        size_t len = strlen(row);
+        pos += len + 1;
+        if (csv_split(row, len, layout->delimiter, cell_start, cell_len, MAX_COLS, &cell_count))
+            return 2;
+        if (cell_count < layout->col_count) {
+            fprintf(stderr, "Error: row has fewer columns than the header\n");
+            return 2;
+        }
+        size_t r = block->n;
+        if (partition_dict) {
+            MHASH_INDEX_UINT partition_pos;
+            size_t i = layout->partition_index;
+            if (partition_find(partition_dict, layout->partition_col, &row[cell_start[i]], cell_len[i], &partition_pos))
+                return 2;
+            block->partition_dims[r] = (uint32_t)partition_pos;
+        }
+        for (size_t k = 0; k < layout->handled_count; ++k) {
+            size_t i = layout->handled[k];
+            struct Column *column = &shard->columns[i];
+            if (column_defers(column)) {
+                column->active_dim = MHASH_EMPTY_SLOT;  // looked up with the rest of the block
+                continue;
+            }
+            if (column->handle(column, &row[cell_start[i]], cell_len[i], &values[i]))
+                return 2;
+        }
+        for (size_t k = 0; k < layout->accumulated_count; ++k) {
+            size_t i = layout->accumulated[k];
+            if (shard->columns[i].active_dim != MHASH_EMPTY_SLOT)
+                block->codes[k][r] = (uint32_t)shard->columns[i].active_dim;
+            else if (row_block_defer(block, k, r, &row[cell_start[i]], cell_len[i]))
+                return 2;
+        }
+        block->y[r] = values[layout->label_index];
+        for (size_t k = 0; k < layout->predict_count; ++k)
+            block->p[k][r] = values[layout->predict_indexes[k]];
+        block->n = r + 1;
+        if (block->n == block->capacity
+            && row_block_push(block, &shard->partitions, &shard->partition_count, partition_dict, shard->columns,
+                              layout->accumulated, layout->accumulated_count, layout->predict_count, layout->forget))
+            return 2;
+    }
+    // batches are accumulated whole, so that merges see every row handed over
+    if (block->n && row_block_push(block, &shard->partitions, &shard->partition_count, partition_dict, shard->columns,
+                                   layout->accumulated, layout->accumulated_count, layout->predict_count, layout->forget))
+        return 2;
+    return 0;
+}
+
+// a parser thread: parses batches in ring order until no more follow
+static PARSER_RETURN parse_batches(void *arg) {
+    struct Shard *shard = (struct Shard *)arg;
+    for (;;) {
+        size_t consumed = atomic_load_explicit(&shard->consumed, memory_order_relaxed);
+        unsigned spins = 0;
+        int done = 0;
+        while (consumed == atomic_load_explicit(&shard->filled, memory_order_acquire)) {
+            // filled is read again after done, as the last batch may have been handed over in between
+            if (atomic_load_explicit(&shard->done, memory_order_acquire)
+                && consumed == atomic_load_explicit(&shard->filled, memory_order_acquire)) {
+                done = 1;
+                break;
+            }
+            wait_for_batch(&spins);
+        }
+        if (done)
+            break;
+        size_t slot = consumed % SHARD_BATCHES;
+        if (!atomic_load_explicit(&shard->failed, memory_order_relaxed)
+            && shard_parse(shard, shard->batches[slot], shard->lengths[slot]))
+            atomic_store_explicit(&shard->failed, 1, memory_order_relaxed);
+        atomic_store_explicit(&shard->consumed, consumed + 1, memory_order_release);
+    }
+#ifdef _WIN32
+    return 0;
+#else
+    return NULL;
+#endif
+}
+
+int shards_open(struct Shards *shards, size_t count, const struct ShardLayout *layout, struct Column *columns,
+                struct Column *partition_dict, fbt ***partitions, size_t *partition_count) {
+    memset(shards, 0, sizeof(struct Shards));
+    shards->layout = *layout;
+    // each parser sees about one in count samples of a group, which its stats forget correspondingly faster
+    if (layout->forget)
+        shards->layout.forget = 1.0 - pow(1.0 - layout->forget, (double)count);
+    shards->columns = columns;
+    shards->partition_dict = partition_dict;
+    shards->partitions = partitions;
+    shards->partition_count = partition_count;
+    shards->base = malloc(sizeof(fbt*) * (*partition_count ? *partition_count : 1));
+    if (!shards->base) {
+        fprintf(stderr, "Error: out of memory allocating parsers\n");
+        return 2;
+    }
+    for (; shards->base_count < *partition_count; ++shards->base_count)
+        if (!(shards->base[shards->base_count] = fbt_snapshot((*partitions)[shards->base_count]))) {
+            fprintf(stderr, "Error: out of memory allocating parsers\n");
+            return 2;
+        }
+    for (size_t i = 0; i < layout->col_count; ++i)
+        shards->base_malformed[i] = columns[i].malformed;
+    shards->shards = calloc(count, sizeof(struct Shard));
+    if (!shards->shards) {
+        fprintf(stderr, "Error: out of memory allocating parsers\n");
+        return 2;
+    }
+    shards->count = count;
+    for (size_t s = 0; s < count; ++s) {
+        struct Shard *shard = &shards->shards[s];
+        shard->layout = &shards->layout;
+        atomic_init(&shard->filled, 0);
+        atomic_init(&shard->consumed, 0);
+        atomic_init(&shard->done, 0);
+        atomic_init(&shard->failed, 0);
+        for (size_t b = 0; b < SHARD_BATCHES; ++b)
+            if (!(shard->batches[b] = malloc(SHARD_BATCH_SIZE))) {
+                fprintf(stderr, "Error: out of memory allocating parsers\n");
+                return 2;
+            }
+        if (row_block_open(&shard->block, ROW_BLOCK_ROWS, layout->accumulated_count, layout->predict_count))
+            return 2;
+    }
+    return 0;
+}
+
+// registers the values of the first row in the columns of the reading thread, and starts every
+// parser from those groups, so that all parsers agree on the first group of each column (which
+// also holds the numbers of columns with --numbers groups or more)
+static int shards_start(struct Shards *shards, const char *line, size_t len) {
+    const struct ShardLayout *layout = &shards->layout;
+    char row[MAX_LINE_SIZE + 1];
+    size_t cell_start[MAX_COLS], cell_len[MAX_COLS], cell_count;
+    double value;
+    memcpy(row, line, len + 1);
+    if (csv_split(row, len, layout->delimiter, cell_start, cell_len, MAX_COLS, &cell_count))
+        return 2;
+    if (cell_count < layout->col_count) {
+        fprintf(stderr, "Error: row has fewer columns than the header\n");
+        return 2;
+    }
+    for (size_t k = 0; k < layout->handled_count; ++k) {
+        size_t i = layout->handled[k];
+        struct Column *column = &shards->columns[i];
+        if (column->handle(column, &row[cell_start[i]], cell_len[i], &value))
+            return 2;
+    }
+    MHASH_INDEX_UINT partition_pos;
+    size_t p = layout->partition_index;
+    if (layout->partition_col
+        && partition_find(shards->partition_dict, layout->partition_col, &row[cell_start[p]], cell_len[p], &partition_pos))
+        return 2;
+
+    for (size_t s = 0; s < shards->count; ++s) {
+        struct Shard *shard = &shards->shards[s];
+        for (size_t i = 0; i < layout->col_count; ++i) {
+            const struct Column *column = &shards->columns[i];
+            if (column_init(&shard->columns[i], column->config, column->name, layout->categorical_dimensions))
+                return 2;
+            shard->columns[i].batched = column->batched;
+            if (!column_is_automatic(column) || !column->num_dimensions)
+                continue;
+            char **names = malloc(sizeof(char*) * column->num_dimensions);
+            if (!names) {
+                fprintf(stderr, "Error: out of memory allocating parsers\n");
+                return 2;
+            }
+            for (size_t d = 0; d < column->num_dimensions; ++d)
+                names[d] = xstrdup(column->dimension_names[d]);
+            if (column_preload(&shard->columns[i], names, column->num_dimensions))
+                return 2;
+        }
+        if (layout->partition_col) {
+            const char *first = shards->partition_dict->dimension_names[0];
+            if (shards->partition_dict->time_bucket)
+                partition_buckets(&shard->partition_dict, shards->partition_dict->time_bucket);
+            if (column_first_value(&shard->partition_dict, layout->partition_col, first, strlen(first)))
+                return 2;
+        }
+        else {
+            shard->partitions = malloc(sizeof(fbt*) * layout->predict_count);
+            if (!shard->partitions) {
+                fprintf(stderr, "Error: out of memory allocating accumulators\n");
+                return 2;
+            }
+            for (; shard->partition_count < layout->predict_count; ++shard->partition_count)
+                if (!(shard->partitions[shard->partition_count] = partition_open(shard->columns, layout->accumulated, layout->accumulated_count, layout->forget)))
+                    return 2;
+        }
+#ifdef _WIN32
+        shard->thread = CreateThread(NULL, 0, parse_batches, shard, 0, NULL);
+        int started = shard->thread != NULL;
+#else
+        int started = pthread_create(&shard->thread, NULL, parse_batches, shard) == 0;
+#endif
+        if (!started) {
+            fprintf(stderr, "Error: could not start the parsing threads\n");
+            return 2;
+        }
+    }
+    shards->started = 1;
+    return 0;
+}
+
+static size_t count_quotes(const char *text, size_t len) {
+    size_t quotes = 0;
+    const char *end = text + len;
+    while ((text = memchr(text, '"', (size_t)(end - text)))) {
+        ++quotes;
+        ++text;
+    }
+    return quotes;
+}
+
+// hands the batch being framed to its parser, and moves on to the next parser
+static int shards_hand_over(struct Shards *shards) {
+    struct Shard *shard = &shards->shards[shards->next];
+    size_t filled = atomic_load_explicit(&shard->filled, memory_order_relaxed);
+    shard->lengths[filled % SHARD_BATCHES] = shards->length;
+    atomic_store_explicit(&shard->filled, filled + 1, memory_order_release);
+    shards->length = 0;
+    shards->next = (shards->next + 1) % shards->count;
+    if (atomic_load_explicit(&shard->failed, memory_order_relaxed))
+        return 2;
+    return 0;
+}
+
+int shards_row(struct Shards *shards, char *line, size_t size, struct Reader *reader) {
+    // every quote opens or closes a quoted value, so rows end at the first line with an even count
+    size_t len = strlen(line);
+    size_t quotes = count_quotes(line, len);
+    while (quotes % 2) {
+        if (len + 1 >= size || !reader_gets_rest(reader, line + len, size - len)) {
+            fprintf(stderr, "Error: unterminated quoted value\n");
+            return 2;
+        }
+        size_t more = strlen(line + len);
+        quotes += count_quotes(line + len, more);
+        len += more;
+    }
+    if (!shards->started && shards_start(shards, line, len))
+        return 2;
+    if (shards->length + len + 1 > SHARD_BATCH_SIZE && shards_hand_over(shards))
+        return 2;
+    struct Shard *shard = &shards->shards[shards->next];
+    size_t filled = atomic_load_explicit(&shard->filled, memory_order_relaxed);
+    if (!shards->length) {
+        // the parser hands back batches in ring order, so this one is free once it is a ring behind
+        unsigned spins = 0;
+        while (filled - atomic_load_explicit(&shard->consumed, memory_order_acquire) == SHARD_BATCHES)
+            wait_briefly(&spins);
+    }
+    char *batch = shard->batches[filled % SHARD_BATCHES];
+    memcpy(batch + shards->length, line, len + 1);
+    shards->length += len + 1;
+    return 0;
+}
+
+// global ids of the groups (of an accumulated column) that a parser met since the last merge
+static int map_groups(struct Column *column, const struct Column *local, size_t **mapping, size_t from) {
+    size_t n = local->num_dimensions;
+    if (from >= n)
+        return 0;
+    size_t *grown = realloc(*mapping, sizeof(size_t) * n);
+    if (!grown) {
+        fprintf(stderr, "Error: out of memory merging parsers\n");
+        return 2;
+    }
+    *mapping = grown;
+    // names are resolved like cells, so that numbers fall into the numeric group of columns with
+    // --numbers groups or more, while other columns have the same fixed groups everywhere
+    int automatic = column_is_automatic(local);
+    for (size_t d = from; d < n; ++d) {
+        double value;
+        if (automatic && column->handle(column, local->dimension_names[d], strlen(local->dimension_names[d]), &value))
+            return 2;
+        grown[d] = automatic ? column->active_dim : d;
+    }
+    return 0;
+}
+
+// Forgetting stats weigh about the last 1/forget samples of each group, which every parser
+// holds an independent estimate of, so that these are averaged instead of summed. A group's
+// count after n samples, 1-(1-forget)^n, is the same in expectation either way. The local
+// groups of a parser that fall into the same group (e.g., numbers once a column reaches
+// --numbers groups) each estimate it too, and are averaged first.
+static int merge_forgetting(fbt *state, const fbt *other, const size_t *const *mappings, size_t shard_count) {
+    for (size_t a = 0; a < other->attribute_count; ++a) {
+        const struct Attribute *from = &other->attributes[a];
+        const size_t *mapping = mappings[a];
+        size_t groups = 0;
+        for (size_t g = 0; g < from->num_groups; ++g)
+            if ((mapping ? mapping[g] : g) + 1 > groups)
+                groups = (mapping ? mapping[g] : g) + 1;
+        if (!groups)
+            continue;
+        size_t *folded = calloc(groups, sizeof(size_t));
+        if (!folded || (groups > state->attributes[a].num_groups && fbt_reserve(state, a, groups))) {
+            free(folded);
+            fprintf(stderr, "Error: out of memory merging parsers\n");
+            return 2;
+        }
+        for (size_t g = 0; g < from->num_groups; ++g)
+            ++folded[mapping ? mapping[g] : g];
+        for (size_t g = 0; g < from->num_groups; ++g) {
+            size_t into = mapping ? mapping[g] : g;
+            double scale = 1.0 / (double)(shard_count * folded[into]);
+            struct fbt_stats *st = &state->attributes[a].stats[into];
+            st->tp += from->stats[g].tp * scale;
+            st->tn += from->stats[g].tn * scale;
+            st->positives += from->stats[g].positives * scale;
+            st->labels += from->stats[g].labels * scale;
+            st->count += from->stats[g].count * scale;
+            fbt_touch(&state->attributes[a], into);
+        }
+        free(folded);
+    }
+    state->total_rows += other->total_rows;
+    return 0;
+}
+
+int shards_merge(struct Shards *shards) {
+    if (!shards->started)
+        return 0;
+    if (shards->length && shards_hand_over(shards))
+        return 2;
+    // once a parser has handed back every batch, it leaves its state alone until the next one
+    int failed = 0;
+    for (size_t s = 0; s < shards->count; ++s) {
+        struct Shard *shard = &shards->shards[s];
+        size_t filled = atomic_load_explicit(&shard->filled, memory_order_relaxed);
+        unsigned spins = 0;
+        while (atomic_load_explicit(&shard->consumed, memory_order_acquire) != filled)
+            wait_briefly(&spins);
+        failed |= atomic_load_explicit(&shard->failed, memory_order_relaxed);
+    }
+    if (failed)
+        return 2;
+
+    const struct ShardLayout *layout = &shards->layout;
+    fbt **partitions = *shards->partitions;
+    for (size_t p = 0; p < *shards->partition_count; ++p) {
+        fbt *partition = partitions[p];
+        for (size_t a = 0; a < partition->attribute_count; ++a) {
+            struct Attribute *attr = &partition->attributes[a];
+            memset(attr->stats, 0, sizeof(struct fbt_stats) * attr->num_groups);
+            if (attr->refreshed)
+                memset(attr->dirty, 1, attr->refreshed);
+        }
+        partition->total_rows = 0;
+        if (p < shards->base_count && fbt_merge(partition, shards->base[p], NULL))
+            return 2;
+    }
+    for (size_t k = 0; k < layout->handled_count; ++k)
+        shards->columns[layout->handled[k]].malformed = shards->base_malformed[layout->handled[k]];
+    for (size_t s = 0; s < shards->count; ++s) {
+        struct Shard *shard = &shards->shards[s];
+        for (size_t k = 0; k < layout->accumulated_count; ++k) {
+            size_t i = layout->accumulated[k];
+            if (map_groups(&shards->columns[i], &shard->columns[i], &shard->group_mappings[k], shard->groups_mapped[k]))
+                return 2;
+            shard->groups_mapped[k] = shard->columns[i].num_dimensions;
+        }
+        for (size_t k = 0; k < layout->handled_count; ++k)
+            shards->columns[layout->handled[k]].malformed += shard->columns[layout->handled[k]].malformed;
+        // partitions are matched by name, and opened in the order they are first merged
+        if (layout->partition_col && shard->partitions_mapped < shard->partition_count) {
+            size_t *grown = realloc(shard->partition_mapping, sizeof(size_t) * shard->partition_count);
+            if (!grown) {
+                fprintf(stderr, "Error: out of memory merging parsers\n");
+                return 2;
+            }
+            shard->partition_mapping = grown;
+            for (; shard->partitions_mapped < shard->partition_count; ++shard->partitions_mapped) {
+                const char *name = shard->partition_dict.dimension_names[shard->partitions_mapped];
+                MHASH_INDEX_UINT pos;
+                // names are those of partitions already (e.g., of --time-col buckets rather than timestamps)
+                if (column_dimension(shards->partition_dict, layout->partition_col, name, strlen(name), &pos))
+                    return 2;
+                grown[shard->partitions_mapped] = pos;
+            }
+            if (partitions_fit(shards->partitions, shards->partition_count, shards->partition_dict->num_dimensions,
+                               shards->columns, layout->accumulated, layout->accumulated_count, layout->forget))
+                return 2;
+            partitions = *shards->partitions;
+        }
+        for (size_t p = 0; p < shard->partition_count; ++p) {
+            size_t into = layout->partition_col ? shard->partition_mapping[p] : p;
+            if (layout->forget ? merge_forgetting(partitions[into], shard->partitions[p], (const size_t *const *)shard->group_mappings, shards->count)
+                               : fbt_merge(partitions[into], shard->partitions[p], (const size_t *const *)shard->group_mappings))
+                return 2;
+        }
+    }
+    return 0;
+}
+
+static void column_free(struct Column *column) {
+    if (column->map.table_size)
+        mhash_compact_free(&column->map);
+    for (size_t d = 0; d < column->num_dimensions && column->dimension_names; ++d)
+        free(column->dimension_names[d]);
+    free(column->dimension_names);
+    free(column->bucket_dims);
+}
+
+void shards_close(struct Shards *shards) {
+    for (size_t s = 0; s < shards->count; ++s) {
+        struct Shard *shard = &shards->shards[s];
+        if (shards->started) {
+            atomic_store_explicit(&shard->done, 1, memory_order_release);
+#ifdef _WIN32
+            WaitForSingleObject((HANDLE)shard->thread, INFINITE);
+            CloseHandle((HANDLE)shard->thread);
+#else
+            pthread_join(shard->thread, NULL);
+#endif
+            for (size_t i = 0; i < shards->layout.col_count; ++i)
+                column_free(&shard->columns[i]);
+            column_free(&shard->partition_dict);
+        }
+        for (size_t p = 0; p < shard->partition_count; ++p)
+            fbt_close(shard->partitions[p]);
+        free(shard->partitions);
+        for (size_t k = 0; k < MAX_COLS; ++k)
+            free(shard->group_mappings[k]);
+        free(shard->partition_mapping);
+        for (size_t b = 0; b < SHARD_BATCHES; ++b)
+            free(shard->batches[b]);
+        row_block_free(&shard->block);
+    }
+    free(shards->shards);
+    for (size_t p = 0; p < shards->base_count; ++p)
+        fbt_close(shards->base[p]);
+    free(shards->base);
+    memset(shards, 0, sizeof(struct Shards));
+}
@@ -0,0 +1,102 @@
+#ifndef SHARDS_H
+#define SHARDS_H
+
+#include <stdatomic.h>
+#include "data.h"
+#include "reader.h"
+
+/*
+ * --threads: CSV rows parsed by several threads, for inputs (e.g., fire-hose stdin streams) that
+ * arrive faster than one thread parses them. The thread that reads the input only frames rows
+ * (with the lines their quoted values continue on) into large batches, and hands the batches
+ * round-robin to the parser threads, each through its own lock-free single-producer/single-
+ * consumer ring. Each parser owns its columns, --partition values and accumulators, so that
+ * parsers share nothing. Before reports, the reading thread waits until every ring is drained
+ * and sums the accumulators of all parsers into its own, matching groups and partitions by
+ * name. Sums do not depend on the order of rows, and --forget decays each parser's stats at the
+ * rate that spans the same number of rows of the whole stream, with these averaged instead.
+ */
+
+#define MAX_SHARDS 64
+#define SHARD_BATCHES 4                 // ring of batches per parser
+#define SHARD_BATCH_SIZE (1 << 18)      // bytes of framed rows per batch
+
+// what rows hold, shared read-only by all parsers
+struct ShardLayout {
+    char delimiter;
+    size_t col_count;
+    const size_t *handled;
+    size_t handled_count;
+    const size_t *accumulated;
+    size_t accumulated_count;
+    MHASH_INDEX_UINT label_index;
+    const MHASH_INDEX_UINT *predict_indexes;
+    size_t predict_count;
+    MHASH_INDEX_UINT partition_index;
+    const char *partition_col;          // NULL without --partition
+    MHASH_INDEX_UINT categorical_dimensions;
+    double forget;
+};
+
+struct Shard {
+    const struct ShardLayout *layout;
+    struct Column columns[MAX_COLS];
+    struct Column partition_dict;
+    fbt **partitions;
+    size_t partition_count;
+    struct RowBlock block;
+    // global group of each group met so far, per accumulated column, and global partition of each partition
+    size_t *group_mappings[MAX_COLS];
+    size_t groups_mapped[MAX_COLS];
+    size_t *partition_mapping;
+    size_t partitions_mapped;
+    char *batches[SHARD_BATCHES];       // rows separated by '\0'
+    size_t lengths[SHARD_BATCHES];
+    atomic_size_t filled;     // batches handed to the parser so far (written by the reading thread)
+    atomic_size_t consumed;   // batches parsed and accumulated so far (written by the parser)
+    atomic_int done;          // set once no batches follow those filled
+    atomic_int failed;        // a row could not be parsed (with a message), and later batches are skipped
+#ifdef _WIN32
+    void *thread;
+#else
+    pthread_t thread;
+#endif
+};
+
+struct Shards {
+    struct ShardLayout layout;
+    struct Shard *shards;
+    size_t count;
+    int started;              // parsers start with the first row, from whose values they learn the first groups
+    size_t next;              // shard of the batch being framed
+    size_t length;            // bytes framed into it so far
+    // the groups and accumulators of the reading thread, into which parsers are merged
+    struct Column *columns;
+    struct Column *partition_dict;
+    fbt ***partitions;
+    size_t *partition_count;
+    // what the accumulators held before the first row (e.g., stats restored by --incremental),
+    // which every merge starts from
+    fbt **base;
+    size_t base_count;
+    size_t base_malformed[MAX_COLS];
+};
+
+// Prepares count parsers of rows with the given layout, to be merged into the given columns and
+// accumulators (with the global --forget rate), on top of what these already hold. Returns 0 on success and 2 on error (with a message).
+int shards_open(struct Shards *shards, size_t count, const struct ShardLayout *layout, struct Column *columns,
+                struct Column *partition_dict, fbt ***partitions, size_t *partition_count);
+
+// Frames the row that starts with the line just read (of a buffer of the given size), reading the
+// lines its quoted values continue on, and hands it to a parser. Returns 0 on success and 2 on
+// error (with a message).
+int shards_row(struct Shards *shards, char *line, size_t size, struct Reader *reader);
+
+// Waits until every row framed so far is parsed, and sets the accumulators of the reading thread
+// to the sums of those of all parsers. Returns 0 on success and 2 if a parser failed.
+int shards_merge(struct Shards *shards);
+
+// Stops the parsers and releases them.
+void shards_close(struct Shards *shards);
+
+#endif // SHARDS_H
@@ -0,0 +1,258 @@
+#include "state.h"
+#include "mapping.h"
+
+#define STATE_MAGIC "FBTSTATE"
+#define STATE_VERSION 1
+
+// --- reading
+
+// copies the next len bytes of the state, and fails if it ends before them
+static int take(struct State *state, void *out, size_t len) {
+    if (len > state->size - state->pos)
+        return 1;
+    memcpy(out, state->data + state->pos, len);
+    state->pos += len;
+    return 0;
+}
+
+// finds the next string, which points into the state and is not null-terminated
+static int take_string(struct State *state, const char **s, uint32_t *len) {
+    if (take(state, len, 4) || *len > state->size - state->pos)
+        return 1;
+    *s = (const char *)state->data + state->pos;
+    state->pos += *len;
+    return 0;
+}
+
+// reads the first line of source, and hashes the bytes of source just before offset, which
+// appending to the file leaves as they were
+static int source_check(const char *source, uint64_t offset, char *first_line, uint64_t *tail_hash) {
+    FILE *f = fopen(source, "rb");
+    if (!f)
+        return 2;
+    char tail[STATE_TAIL_BYTES];
+    size_t len = offset < STATE_TAIL_BYTES ? (size_t)offset : STATE_TAIL_BYTES;
+    int failed = !fgets(first_line, MAX_LINE_SIZE, f) || file_seek(f, offset - len) || fread(tail, 1, len, f) != len;
+    fclose(f);
+    *tail_hash = (uint64_t)mhash_strn_word(tail, len, 1);
+    return failed ? 2 : 0;
+}
+
+// why the state cannot be resumed from, or NULL if it can
+static const char *state_check(struct State *state, const char *source, const char *signature) {
+    char magic[8];
+    uint64_t version, device, inode, tail_hash;
+    const char *header, *saved_signature;
+    uint32_t header_len, signature_len;
+    if (take(state, magic, 8) || memcmp(magic, STATE_MAGIC, 8) || take(state, &version, 8) || version != STATE_VERSION
+        || take(state, &device, 8) || take(state, &inode, 8) || take(state, &state->offset, 8) || take(state, &tail_hash, 8)
+        || take_string(state, &header, &header_len) || header_len >= MAX_LINE_SIZE
+        || take_string(state, &saved_signature, &signature_len))
+        return "unreadable";
+    memcpy(state->header, header, header_len);
+    state->header[header_len] = '\0';
+    if (signature_len != strlen(signature) || memcmp(saved_signature, signature, signature_len))
+        return "the options changed";
+    uint64_t source_device, source_inode, source_size;
+    int64_t source_mtime;
+    if (file_inode(source, &source_device, &source_inode) || file_identity(source, &source_size, &source_mtime)
+        || source_device != device || source_inode != inode)
+        return "the file was replaced";
+    if (source_size < state->offset)
+        return "the file was truncated";
+    char first_line[MAX_LINE_SIZE];
+    uint64_t source_hash;
+    if (source_check(source, state->offset, first_line, &source_hash) || strcmp(first_line, state->header) || source_hash != tail_hash)
+        return "the file was rewritten";
+    uint64_t total_rows;
+    if (take(state, &total_rows, 8))
+        return "unreadable";
+    state->total_rows = (unsigned long)total_rows;
+    return NULL;
+}
+
+int state_load(struct State *state, const char *path, const char *source, const char *signature) {
+    memset(state, 0, sizeof(struct State));
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return 1;  // the first run creates the state
+    uint64_t size;
+    int64_t mtime;
+    if (file_identity(path, &size, &mtime) || !(state->data = malloc(size ? (size_t)size : 1))) {
+        fclose(f);
+        fprintf(stderr, "Error: could not read incremental state %s\n", path);
+        return 2;
+    }
+    state->size = fread(state->data, 1, (size_t)size, f);
+    fclose(f);
+    const char *stale = state_check(state, source, signature);
+    if (stale) {
+        printf("Incremental state %s is stale (%s), so all of %s is read\n", path, stale, source);
+        state_free(state);
+        return 1;
+    }
+    printf("Resuming %s after %llu bytes and %lu rows\n", source, (unsigned long long)state->offset, state->total_rows);
+    return 0;
+}
+
+// the groups of a column, which takes ownership of their names
+static int restore_groups(struct State *state, struct Column *column, const char *col_name) {
+    uint64_t count;
+    if (take(state, &count, 8) || count > state->size - state->pos)
+        return 1;
+    if (!count)
+        return 0;
+    char **names = calloc((size_t)count, sizeof(char*));
+    if (!names)
+        return 1;
+    int failed = 0;
+    for (size_t d = 0; d < count && !failed; ++d) {
+        const char *name;
+        uint32_t len;
+        failed = take_string(state, &name, &len) || !(names[d] = malloc(len + 1));
+        if (!failed) {
+            memcpy(names[d], name, len);
+            names[d][len] = '\0';
+        }
+    }
+    if (failed) {
+        for (size_t d = 0; d < count; ++d)
+            free(names[d]);
+        free(names);
+        return 1;
+    }
+    return column_restore(column, col_name, names, (size_t)count) ? 1 : 0;
+}
+
+int state_restore_columns(struct State *state, struct Column *columns, size_t col_count, struct Column *partition_dict) {
+    for (size_t i = 0; i < col_count; ++i) {
+        uint64_t malformed;
+        if (take(state, &malformed, 8) || restore_groups(state, &columns[i], columns[i].name)) {
+            fprintf(stderr, "Error: could not restore column %s from the incremental state\n", columns[i].name);
+            return 2;
+        }
+        columns[i].malformed = (size_t)malformed;
+    }
+    uint64_t unpartitioned = 0;
+    if (partition_dict ? restore_groups(state, partition_dict, "partitions") : take(state, &unpartitioned, 8) || unpartitioned) {
+        fprintf(stderr, "Error: could not restore the partitions from the incremental state\n");
+        return 2;
+    }
+    return 0;
+}
+
+int state_restore_partitions(struct State *state, fbt ***partitions, size_t *partition_count, const struct Column *partition_dict,
+                             const struct Column *columns, const size_t *accumulated, size_t accumulated_count, double forget) {
+    uint64_t count;
+    if (take(state, &count, 8) || count > state->size - state->pos
+        || (partition_dict && partitions_fit(partitions, partition_count, (size_t)count, columns, accumulated, accumulated_count, forget))
+        || count != *partition_count) {
+        fprintf(stderr, "Error: could not restore the partitions from the incremental state\n");
+        return 2;
+    }
+    for (size_t p = 0; p < *partition_count; ++p) {
+        fbt *partition = (*partitions)[p];
+        uint64_t rows = 0;
+        int failed = take(state, &rows, 8);
+        partition->total_rows = (unsigned long)rows;
+        for (size_t a = 0; a < accumulated_count && !failed; ++a) {
+            uint64_t groups;
+            failed = take(state, &groups, 8) || groups > state->size - state->pos || fbt_reserve(partition, a, (size_t)groups)
+                  || (groups && take(state, partition->attributes[a].stats, sizeof(struct fbt_stats) * (size_t)groups));
+        }
+        if (failed) {
+            fprintf(stderr, "Error: could not restore the stats from the incremental state\n");
+            return 2;
+        }
+    }
+    return 0;
+}
+
+void state_free(struct State *state) {
+    free(state->data);
+    state->data = NULL;
+    state->size = 0;
+}
+
+// --- writing
+
+static void put(FILE *f, const void *data, size_t len, int *failed) {
+    if (len && fwrite(data, 1, len, f) != len)
+        *failed = 1;
+}
+
+static void put_u64(FILE *f, uint64_t v, int *failed) {
+    put(f, &v, 8, failed);
+}
+
+static void put_string(FILE *f, const char *s, size_t len, int *failed) {
+    uint32_t len32 = (uint32_t)len;
+    put(f, &len32, 4, failed);
+    put(f, s, len, failed);
+}
+
+// the groups of automatic columns and partition dictionaries, which other columns know up front
+static void put_groups(FILE *f, const struct Column *column, int saved, int *failed) {
+    size_t count = saved && column->dimension_names ? column->num_dimensions : 0;
+    put_u64(f, count, failed);
+    for (size_t d = 0; d < count; ++d)
+        put_string(f, column->dimension_names[d], strlen(column->dimension_names[d]), failed);
+}
+
+int state_save(const char *path, const char *source, uint64_t offset, const char *header, const char *signature,
+               unsigned long total_rows, const struct Column *columns, size_t col_count, const struct Column *partition_dict,
+               fbt *const *partitions, size_t partition_count) {
+    uint64_t device, inode, tail_hash;
+    char first_line[MAX_LINE_SIZE];
+    size_t len = strlen(path);
+    char *tmp_path = malloc(len + 5);
+    if (!tmp_path) {
+        fprintf(stderr, "Error: out of memory\n");
+        return 2;
+    }
+    memcpy(tmp_path, path, len);
+    memcpy(tmp_path + len, ".tmp", 5);
+    FILE *f = NULL;
+    int failed = file_inode(source, &device, &inode) || source_check(source, offset, first_line, &tail_hash)
+              || !(f = fopen(tmp_path, "wb"));
+    if (f) {
+        put(f, STATE_MAGIC, 8, &failed);
+        put_u64(f, STATE_VERSION, &failed);
+        put_u64(f, device, &failed);
+        put_u64(f, inode, &failed);
+        put_u64(f, offset, &failed);
+        put_u64(f, tail_hash, &failed);
+        put_string(f, header, strlen(header), &failed);
+        put_string(f, signature, strlen(signature), &failed);
+        put_u64(f, total_rows, &failed);
+        for (size_t i = 0; i < col_count; ++i) {
+            put_u64(f, columns[i].malformed, &failed);
+            put_groups(f, &columns[i], column_is_automatic(&columns[i]), &failed);
+        }
+        if (partition_dict)
+            put_groups(f, partition_dict, 1, &failed);
+        else
+            put_u64(f, 0, &failed);
+        put_u64(f, partition_count, &failed);
+        for (size_t p = 0; p < partition_count; ++p) {
+            const fbt *partition = partitions[p];
+            put_u64(f, partition->total_rows, &failed);
+            for (size_t a = 0; a < partition->attribute_count; ++a) {
+                put_u64(f, partition->attributes[a].num_groups, &failed);
+                put(f, partition->attributes[a].stats, sizeof(struct fbt_stats) * partition->attributes[a].num_groups, &failed);
+            }
+        }
+        if (ferror(f) | fclose(f))
+            failed = 1;
+    }
+    if (!failed) {
+        remove(path);  // rename does not replace existing files on Windows
+        failed = rename(tmp_path, path) != 0;
+    }
+    if (failed) {
+        fprintf(stderr, "Error: could not write incremental state %s\n", path);
+        remove(tmp_path);
+    }
+    free(tmp_path);
+    return failed ? 2 : 0;
+}
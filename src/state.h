@@ -0,0 +1,60 @@
+#ifndef STATE_H
+#define STATE_H
+
+#include "data.h"
+
+/*
+ * --incremental state file: what a run over an append-only CSV file accumulated, so that the
+ * next run seeks past the rows already read and parses only those appended since. It keeps
+ * the offset where those rows end, the header line (from which the delimiter is detected
+ * again), a signature of the options that decide how rows accumulate, the groups of every
+ * automatic column and of the partitions, in the order of their ids, and the stats of every
+ * partition. The file is read again from the start if it was replaced or truncated (its
+ * device, inode, first line or the bytes just before the offset differ, or it got shorter),
+ * if the options changed, or if the state is unreadable. A last line without a newline is
+ * left for the next run, as it may still be being written.
+ *
+ * Layout (native byte order, as states only serve later runs on the same machine; strings
+ * are a u32 length followed by their bytes):
+ *   header     magic, version, source device and inode, offset, hash of the bytes before it
+ *   strings    the header line and the signature
+ *   columns    total rows, then per column its malformed cells, a u64 group count and the
+ *              group names, then the partition dictionary likewise
+ *   partitions their count, then per partition its rows, and per accumulated column a u64
+ *              group count and the fbt_stats of each group
+ */
+
+#define STATE_TAIL_BYTES 4096   // bytes before the offset that must not change between runs
+
+struct State {
+    uint8_t *data;          // the whole state file
+    size_t size;
+    size_t pos;             // start of the sections restored next
+    uint64_t offset;        // where the rows that were read end
+    char header[MAX_LINE_SIZE];
+    unsigned long total_rows;
+};
+
+// Loads the state at path if it was saved for the file source with the same signature of
+// options, and the file was only appended to since. Returns 0 to resume from state->offset,
+// 1 to read the whole file (with a message if a state was discarded), and 2 on error.
+int state_load(struct State *state, const char *path, const char *source, const char *signature);
+
+// Restores the groups of the columns and of the partition dictionary (NULL without
+// --partition), before any row is read. Returns 0 on success and 2 on error (with a message).
+int state_restore_columns(struct State *state, struct Column *columns, size_t col_count, struct Column *partition_dict);
+
+// Restores the stats of the partitions (opening those of a partition dictionary), after the
+// columns. Returns 0 on success and 2 on error (with a message).
+int state_restore_partitions(struct State *state, fbt ***partitions, size_t *partition_count, const struct Column *partition_dict,
+                             const struct Column *columns, const size_t *accumulated, size_t accumulated_count, double forget);
+
+void state_free(struct State *state);
+
+// Saves the state of a run that read the rows of source up to offset. Returns 0 on success
+// and 2 on error (with a message).
+int state_save(const char *path, const char *source, uint64_t offset, const char *header, const char *signature,
+               unsigned long total_rows, const struct Column *columns, size_t col_count, const struct Column *partition_dict,
+               fbt *const *partitions, size_t partition_count);
+
+#endif // STATE_H
@@ -0,0 +1,142 @@
+#ifndef TIMESTAMP_H
+#define TIMESTAMP_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "numeric.h"
+
+// Timestamps of --time-col, read with a fixed-format parser instead of strptime and mktime
+// (which consult the locale and time zone for every call). Times are seconds since the Unix
+// epoch in UTC, and calendar dates are converted with the days-from-civil algorithm of the
+// proleptic Gregorian calendar.
+
+static inline int64_t floor_div(int64_t a, int64_t b) {
+    int64_t q = a / b;
+    return q - (a % b != 0 && (a < 0) != (b < 0));
+}
+
+static inline int64_t days_from_civil(int64_t y, unsigned m, unsigned d) {
+    y -= m <= 2;
+    int64_t era = floor_div(y, 400);
+    unsigned yoe = (unsigned)(y - era * 400);
+    unsigned doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+    unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + (int64_t)doe - 719468;
+}
+
+static inline void civil_from_days(int64_t z, int64_t *y, unsigned *m, unsigned *d) {
+    z += 719468;
+    int64_t era = floor_div(z, 146097);
+    unsigned doe = (unsigned)(z - era * 146097);
+    unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    unsigned mp = (5 * doy + 2) / 153;
+    *d = doy - (153 * mp + 2) / 5 + 1;
+    *m = mp < 10 ? mp + 3 : mp - 9;
+    *y = (int64_t)yoe + era * 400 + (*m <= 2);
+}
+
+// reads exactly count digits at *p, and moves past them
+static inline int timestamp_digits(const char **p, const char *end, int count, unsigned *value) {
+    *value = 0;
+    for (int i = 0; i < count; ++i, ++*p) {
+        if (*p == end || (unsigned char)(**p - '0') >= 10)
+            return 0;
+        *value = *value * 10 + (unsigned)(**p - '0');
+    }
+    return 1;
+}
+
+// Parses a cell of exactly len bytes into seconds since the epoch. Cells are either ISO 8601
+// dates with an optional time, i.e., YYYY-MM-DD[( |T)HH:MM[:SS[.fraction]]][Z|(+|-)HH[:]MM]
+// (or with / between date fields), or epoch numbers, which count milliseconds from 1e11 on.
+// Returns 0 on success and 1 if the cell is no timestamp.
+static inline int parse_timestamp(const char *s, size_t len, int64_t *seconds) {
+    const char *p = s;
+    const char *end = s + len;
+    if (len < 10 || (s[4] != '-' && s[4] != '/')) {
+        int valid;
+        double value = parse_number(s, len, &valid);
+        if (!valid || !len)
+            return 1;
+        if (value >= 1e11 || value <= -1e11)
+            value /= 1000.0;
+        if (value >= 9e15 || value <= -9e15)
+            return 1;
+        int64_t whole = (int64_t)value;
+        *seconds = whole - ((double)whole > value);
+        return 0;
+    }
+    unsigned year, month, day, hour = 0, minute = 0, second = 0;
+    char separator = s[4];
+    if (!timestamp_digits(&p, end, 4, &year) || *p++ != separator || !timestamp_digits(&p, end, 2, &month)
+        || p == end || *p++ != separator || !timestamp_digits(&p, end, 2, &day))
+        return 1;
+    if (p != end && (*p == 'T' || *p == ' ')) {
+        ++p;
+        if (!timestamp_digits(&p, end, 2, &hour) || p == end || *p++ != ':' || !timestamp_digits(&p, end, 2, &minute))
+            return 1;
+        if (p != end && *p == ':') {
+            ++p;
+            if (!timestamp_digits(&p, end, 2, &second))
+                return 1;
+            if (p != end && (*p == '.' || *p == ',')) {
+                ++p;
+                while (p != end && (unsigned char)(*p - '0') < 10)
+                    ++p;
+            }
+        }
+    }
+    int64_t offset = 0;
+    if (p != end && *p == 'Z')
+        ++p;
+    else if (p != end && (*p == '+' || *p == '-')) {
+        int64_t sign = *p++ == '-' ? -1 : 1;
+        unsigned offset_hours, offset_minutes = 0;
+        if (!timestamp_digits(&p, end, 2, &offset_hours))
+            return 1;
+        if (p != end && *p == ':')
+            ++p;
+        if (p != end && !timestamp_digits(&p, end, 2, &offset_minutes))
+            return 1;
+        offset = sign * (int64_t)(offset_hours * 3600 + offset_minutes * 60);
+    }
+    if (p != end || month < 1 || month > 12 || day < 1 || day > 31 || hour > 24 || minute > 59 || second > 60)
+        return 1;
+    *seconds = days_from_civil((int64_t)year, month, day) * 86400 + (int64_t)(hour * 3600 + minute * 60 + second) - offset;
+    return 0;
+}
+
+// Parses a bucket width like 30s, 15m, 1h, 1d or 1w (plain numbers are seconds). Returns the
+// width in seconds, or 0 if it is malformed.
+static inline int64_t parse_duration(const char *s) {
+    char *end;
+    long long count = strtoll(s, &end, 10);
+    int64_t unit = *end == 's' || !*end ? 1 : *end == 'm' ? 60 : *end == 'h' ? 3600 : *end == 'd' ? 86400 : *end == 'w' ? 604800 : 0;
+    if (count <= 0 || !unit || (*end && end[1]) || count > INT64_MAX / unit)
+        return 0;
+    return (int64_t)count * unit;
+}
+
+// Writes the start of a bucket as an ISO 8601 date, with the time of day down to the
+// precision of the width, so that labels sort in time order. Returns the label length.
+static inline size_t format_bucket(int64_t start, int64_t width, char label[32]) {
+    int64_t days = floor_div(start, 86400);
+    int64_t time = start - days * 86400;
+    int64_t year;
+    unsigned month, day;
+    civil_from_days(days, &year, &month, &day);
+    int written;
+    if (width % 86400 == 0)
+        written = snprintf(label, 32, "%04lld-%02u-%02u", (long long)year, month, day);
+    else if (width % 60 == 0)
+        written = snprintf(label, 32, "%04lld-%02u-%02u %02d:%02d", (long long)year, month, day,
+                           (int)(time / 3600), (int)(time / 60 % 60));
+    else
+        written = snprintf(label, 32, "%04lld-%02u-%02u %02d:%02d:%02d", (long long)year, month, day,
+                           (int)(time / 3600), (int)(time / 60 % 60), (int)(time % 60));
+    return written < 0 ? 0 : (size_t)written;
+}
+
+#endif // TIMESTAMP_H